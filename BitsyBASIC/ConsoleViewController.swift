@@ -27,6 +27,9 @@ import UIKit
 
 let ConsoleTextKey = "ConsoleText"
 let InputTextFieldTextKey = "InputTextFieldText"
+let InterpreterSnapshotKey = "InterpreterSnapshot"
+
+/// Key of the property list saved by older versions of the app
 let InterpreterStateKey = "InterpreterState"
 
 
@@ -77,7 +80,7 @@ final class ConsoleViewController: UIViewController, UITextFieldDelegate {
 
         coder.encodeObject(consoleText, forKey: ConsoleTextKey)
         coder.encodeObject(inputTextField.text, forKey: InputTextFieldTextKey)
-        coder.encodeObject(interpreter.stateAsPropertyList(), forKey: InterpreterStateKey)
+        coder.encodeObject(interpreter.stateAsData(), forKey: InterpreterSnapshotKey)
     }
 
     override func decodeRestorableStateWithCoder(coder: NSCoder) {
@@ -99,11 +102,18 @@ final class ConsoleViewController: UIViewController, UITextFieldDelegate {
             assert(false, "unable to restore \(InputTextFieldTextKey)")
         }
 
-        if let interpreterState = coder.decodeObjectForKey(InterpreterStateKey) as? NSDictionary {
+        // The snapshot restores the program without parsing it again.  State
+        // saved by older versions of the app is a property list instead.
+        if let snapshot = coder.decodeObjectForKey(InterpreterSnapshotKey) as? NSData {
+            // A snapshot made by an incompatible version is ignored, and
+            // the interpreter starts afresh
+            interpreter.restoreStateFromData(snapshot)
+        }
+        else if let interpreterState = coder.decodeObjectForKey(InterpreterStateKey) as? NSDictionary {
             interpreter.restoreStateFromPropertyList(interpreterState as [NSObject : AnyObject])
         }
         else {
-            assert(false, "unable to restore \(InterpreterStateKey)")
+            assert(false, "unable to restore \(InterpreterSnapshotKey)")
         }
     }
 
@@ -260,12 +270,18 @@ final class ConsoleViewController: UIViewController, UITextFieldDelegate {
 
     /// Drive the interpreter
     ///
-    /// Calls interpreter.next() to get it to do its next action.
+    /// Lets the interpreter run for a short time slice (or, for the
+    /// Swift interpreter, calls interpreter.next() to do its next action).
     /// Then schedules another step, unless the interpreter is
     /// waiting for input and we don't have any to give it.
     func stepInterpreter() {
         interpreterScheduled = false
-        interpreter.next()
+        #if BitsyBASIC_Swift
+            interpreter.next()
+        #else
+            // Short enough to keep the UI responsive
+            interpreter.runForTimeBudget(0.01)
+        #endif
 
         #if BitsyBASIC_Swift
             let state = interpreter.state
@@ -370,6 +386,14 @@ final class ConsoleViewController: UIViewController, UITextFieldDelegate {
         }
     }
 
+    #if !BitsyBASIC_Swift
+    /// Write specified output characters
+    func putOutputChars(chars: UnsafePointer<Char>, length: Int, forInterpreter interpreter: Interpreter) {
+        outputBuffer.extend(UnsafeBufferPointer(start: chars, count: length))
+        flushOutput()
+    }
+    #endif
+
     func flushOutput() {
         if outputBuffer.count > 0 {
             if let s = NSString(bytes: &self.outputBuffer,
@@ -29,6 +29,193 @@ func runInterpreter() {
     interpreter.runUntilEndOfInput()
 }
 
+
+// MARK: - Batch mode
+
+// With command-line arguments, finchbasic runs programs without a user:
+//
+//     finchbasic -f prog.bas [-f prog2.bas ...] [-i input.txt] [-o out.txt]
+//
+// Each program is loaded and RUN, with no prompts, and INPUT reads from the
+// -i file (or standard input).  Output goes to the -o file (or standard
+// output), and the exit status is EXIT_FAILURE if any error was reported.
+//
+// Several programs are run at the same time in separate processes, each
+// reading the whole -i file (or no input at all), and their outputs are
+// written one after another in the order the programs were given.
+
+let usageExitStatus: Int32 = 2
+
+/// Options given on the command line
+struct BatchOptions {
+    var programFiles: [String] = []
+    var inputFile: String? = nil
+    var outputFile: String? = nil
+}
+
+func showUsage() {
+    let usage = "usage: finchbasic [-f program ...] [-i input] [-o output]\n"
+    fputs(usage, stderr)
+}
+
+/// Parse the command-line arguments, returning nil if they are not valid
+func batchOptionsFromArguments(arguments: [String]) -> BatchOptions? {
+    var options = BatchOptions()
+    var i = 1
+    while i < arguments.count {
+        if i + 1 >= arguments.count {
+            return nil
+        }
+        let value = arguments[i + 1]
+        switch arguments[i] {
+        case "-f": options.programFiles.append(value)
+        case "-i": options.inputFile = value
+        case "-o": options.outputFile = value
+        default:   return nil
+        }
+        i += 2
+    }
+    return options.programFiles.isEmpty ? nil : options
+}
+
+/// Open a file, or display an error message and return nil
+func openFile(filename: String, mode: String) -> UnsafeMutablePointer<FILE>? {
+    let file = fopen((filename as NSString).UTF8String, (mode as NSString).UTF8String)
+    if file == nil {
+        fputs("finchbasic: unable to open file \"\(filename)\": \(errnoMessage())\n", stderr)
+        return nil
+    }
+    return file
+}
+
+/// Run one program in this process, returning the exit status
+func runBatchProgram(programFile: String, inputFile: String?, outputFile: String?) -> Int32 {
+    var input = stdin
+    if let inputFile = inputFile {
+        if let file = openFile(inputFile, "r") {
+            input = file
+        }
+        else {
+            return EXIT_FAILURE
+        }
+    }
+
+    var output = stdout
+    if let outputFile = outputFile {
+        if let file = openFile(outputFile, "w") {
+            output = file
+        }
+        else {
+            if input != stdin { fclose(input) }
+            return EXIT_FAILURE
+        }
+    }
+
+    let io = BatchIO(inputFile: input, outputFile: output, messagePrefix: "\(programFile): ")
+    let interpreter = Interpreter(interpreterIO: io)
+    interpreter.runProgramFile(programFile)
+    io.flush()
+
+    if input != stdin { fclose(input) }
+    if output != stdout && fclose(output) != 0 {
+        return EXIT_FAILURE
+    }
+    return io.errorCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE
+}
+
+/// Run each program in a child process, and write their outputs in order,
+/// returning the exit status
+///
+/// The Interpreter is not run on other threads, for the reason given below.
+func runBatchProgramsConcurrently(options: BatchOptions) -> Int32 {
+    let executablePath = NSBundle.mainBundle().executablePath!
+    let maxRunning = max(NSProcessInfo.processInfo().activeProcessorCount, 1)
+    let pid = getpid()
+
+    var outputPaths: [String] = []
+    var tasks: [NSTask] = []
+    var status = EXIT_SUCCESS
+
+    func waitForTask(task: NSTask) {
+        task.waitUntilExit()
+        if task.terminationStatus != EXIT_SUCCESS {
+            status = EXIT_FAILURE
+        }
+    }
+
+    for (index, programFile) in enumerate(options.programFiles) {
+        // Limit the number of children running at once
+        if index >= maxRunning {
+            waitForTask(tasks[index - maxRunning])
+        }
+
+        let outputPath = NSTemporaryDirectory().stringByAppendingPathComponent("finchbasic-\(pid)-\(index).out")
+        outputPaths.append(outputPath)
+
+        var arguments = ["-f", programFile, "-o", outputPath]
+        if let inputFile = options.inputFile {
+            arguments.extend(["-i", inputFile])
+        }
+
+        let task = NSTask()
+        task.launchPath = executablePath
+        task.arguments = arguments
+        if options.inputFile == nil {
+            task.standardInput = NSFileHandle.fileHandleWithNullDevice()
+        }
+        task.launch()
+        tasks.append(task)
+    }
+
+    for index in max(tasks.count - maxRunning, 0)..<tasks.count {
+        waitForTask(tasks[index])
+    }
+
+    // Combine the outputs
+    var output = stdout
+    var isOutputOpen = true
+    if let outputFile = options.outputFile {
+        if let file = openFile(outputFile, "w") {
+            output = file
+        }
+        else {
+            isOutputOpen = false
+            status = EXIT_FAILURE
+        }
+    }
+
+    for outputPath in outputPaths {
+        if isOutputOpen {
+            if let data = NSData(contentsOfFile: outputPath) {
+                fwrite(data.bytes, 1, data.length, output)
+            }
+        }
+        NSFileManager.defaultManager().removeItemAtPath(outputPath, error: nil)
+    }
+
+    if output != stdout && fclose(output) != 0 {
+        status = EXIT_FAILURE
+    }
+    fflush(stdout)
+    return status
+}
+
+/// Run the programs given on the command line, and exit
+func runBatch(arguments: [String]) {
+    if let options = batchOptionsFromArguments(arguments) {
+        if options.programFiles.count == 1 {
+            exit(runBatchProgram(options.programFiles[0], options.inputFile, options.outputFile))
+        }
+        exit(runBatchProgramsConcurrently(options))
+    }
+    showUsage()
+    exit(usageExitStatus)
+}
+
+if Process.arguments.count > 1 {
+    runBatch(Process.arguments)
+}
+
 // Put -DUSE_INTERPRETER_THREAD=1 in Build Settings
 // to run the interpreter in another thread.
 //
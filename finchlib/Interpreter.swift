@@ -369,7 +369,11 @@ public final class Interpreter: NSObject, NSCoding {
 
     /// Interpret a String
     func interpretString(s: String) {
-        let chars = Array<UInt8>(s.utf8)
+        interpretChars(Array<UInt8>(s.utf8))
+    }
+
+    /// Interpret an array of characters
+    func interpretChars(chars: [Char]) {
         let charCount = chars.count
         var index = 0
         loop: while true {
@@ -390,7 +394,7 @@ public final class Interpreter: NSObject, NSCoding {
                 break loop
 
             case .Waiting:
-                assert(false, "getInputLine() for pasteboard should never return .Waiting")
+                assert(false, "getInputLine() for an array should never return .Waiting")
                 break loop
             }
         }
@@ -436,6 +440,22 @@ public final class Interpreter: NSObject, NSCoding {
         } while !hasReachedEndOfInput
     }
 
+    /// Load a program from a file, RUN it, and continue until it stops.
+    ///
+    /// This is for hosts that run programs without a user, so no command
+    /// prompts are shown.  INPUT statements still read from the
+    /// InterpreterIO object.  Errors are reported to the InterpreterIO object
+    /// as usual, and the program is not run if the file can't be read.
+    public func runProgramFile(filename: String) {
+        clearProgram()
+        if loadFile(filename) {
+            RUN()
+            while state == .Running || state == .ReadingInput {
+                next()
+            }
+        }
+    }
+
     /// Perform next operation.
     /// 
     /// The host can drive the interpreter by calling `next()`
@@ -840,41 +860,45 @@ public final class Interpreter: NSObject, NSCoding {
 
     /// Execute LOAD statement
     func LOAD(filename: String) {
+        loadFile(filename)
+    }
+
+    /// Read a file and interpret its lines
+    ///
+    /// The whole file is read before any of it is interpreted.  Returns false,
+    /// after aborting with an error message, if the file can't be read.
+    func loadFile(filename: String) -> Bool {
         let filenameCString = (filename as NSString).UTF8String
         let modeCString = ("r" as NSString).UTF8String
 
         let file = fopen(filenameCString, modeCString)
-        if file != nil {
-            // Read lines until end-of-stream or error
-            loop: while true {
-                let maybeInputLine = getInputLine {
-                    let c = fgetc(file)
-                    return (c == EOF) ? .EndOfStream : .Value(Char(c))
-                }
-
-                switch maybeInputLine {
-
-                case let .Value(inputLine): processInput(inputLine)
-
-                case .EndOfStream:
-                    break loop
+        if file == nil {
+            abortRunWithErrorMessage("error: LOAD - unable to open file \"\(filename)\": \(errnoMessage())")
+            return false
+        }
 
-                case .Waiting:
-                    assert(false, "getInputLine() for file should never return .Waiting")
-                    break loop
-                }
+        var chars: [Char] = Array()
+        var buffer: [Char] = Array(count: 65536, repeatedValue: 0)
+        loop: while true {
+            let count = fread(&buffer, 1, buffer.count, file)
+            if count > 0 {
+                chars.extend(buffer[0..<count])
             }
-
-            // If we got an error, report it
-            if ferror(file) != 0 {
-                abortRunWithErrorMessage("error: LOAD - read error for file \"\(filename)\": \(errnoMessage())")
+            if count < buffer.count {
+                break loop
             }
+        }
 
+        // If we got an error, report it
+        if ferror(file) != 0 {
+            abortRunWithErrorMessage("error: LOAD - read error for file \"\(filename)\": \(errnoMessage())")
             fclose(file)
+            return false
         }
-        else {
-            abortRunWithErrorMessage("error: LOAD - unable to open file \"\(filename)\": \(errnoMessage())")
-        }
+
+        fclose(file)
+        interpretChars(chars)
+        return true
     }
 
     func FILES() {
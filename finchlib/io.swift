@@ -120,3 +120,80 @@ public final class StandardIO: NSObject, InterpreterIO {
         exit(EXIT_SUCCESS)
     }
 }
+
+/// Implementation of InterpreterIO for running programs without a user
+///
+/// Input is read from one file and output is written to another.  Output is
+/// collected in a large buffer, which is written when it fills and when
+/// `flush()` is called.  No prompts are displayed.
+///
+/// Error messages are sent to stderr, each preceded by `messagePrefix`, and
+/// counted, so that the host can set its exit status.
+public final class BatchIO: NSObject, InterpreterIO {
+    let inputFile: UnsafeMutablePointer<FILE>
+    let outputFile: UnsafeMutablePointer<FILE>
+    let messagePrefix: String
+
+    let outputBufferSize = 65536
+    var outputBuffer: [Char] = Array()
+
+    /// Number of error messages that have been displayed
+    public private(set) var errorCount = 0
+
+    public init(inputFile: UnsafeMutablePointer<FILE>,
+        outputFile: UnsafeMutablePointer<FILE>,
+        messagePrefix: String)
+    {
+        self.inputFile = inputFile
+        self.outputFile = outputFile
+        self.messagePrefix = messagePrefix
+        super.init()
+        outputBuffer.reserveCapacity(outputBufferSize)
+    }
+
+    /// Write any buffered output to the output file
+    public func flush() {
+        if outputBuffer.count > 0 {
+            fwrite(outputBuffer, 1, outputBuffer.count, outputFile)
+            outputBuffer.removeAll(keepCapacity: true)
+        }
+        fflush(outputFile)
+    }
+
+    public func getInputCharForInterpreter(interpreter: Interpreter) -> InputCharResult {
+        let c = fgetc(inputFile)
+        return c == EOF ? .EndOfStream : .Value(Char(c))
+    }
+
+    public func putOutputChar(c: Char, forInterpreter interpreter: Interpreter) {
+        outputBuffer.append(c)
+        if outputBuffer.count >= outputBufferSize {
+            flush()
+        }
+    }
+
+    public func showCommandPromptForInterpreter(interpreter: Interpreter) {
+    }
+
+    public func showInputPromptForInterpreter(interpreter: Interpreter) {
+    }
+
+    public func showErrorMessage(message: String, forInterpreter interpreter: Interpreter) {
+        // Keep output and errors in order if they go to the same terminal
+        flush()
+
+        ++errorCount
+        var chars = charsFromString(messagePrefix + message)
+        chars.append(Ch_Linefeed)
+        fwrite(chars, 1, chars.count, stderr)
+        fflush(stderr)
+    }
+
+    public func showDebugTraceMessage(message: String, forInterpreter interpreter: Interpreter) {
+        outputBuffer.extend(charsFromString(message))
+    }
+
+    public func byeForInterpreter(interpreter: Interpreter) {
+        // BYE stops the program, which is all that is needed here
+    }
+}
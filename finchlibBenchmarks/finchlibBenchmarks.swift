@@ -0,0 +1,366 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+import Foundation
+import XCTest
+
+// This source file is used by finchlibBenchmarks and finchlib_cppBenchmarks,
+// so that the Swift and C++ interpreters run the same workloads.
+//
+// Wall time is reported by XCTest's measureBlock(), and can be compared
+// against a baseline by using the Set Baseline button in Xcode's test
+// report.  Each benchmark also prints the number of statements (or lines)
+// it processed per second, and the number of blocks and bytes that entering
+// and running the program left allocated, from the malloc zone statistics.
+// The C++ interpreter's block counts are checked against the baselines in
+// `allocationBaselines`.  Allocations can be examined in more detail by
+// running the benchmark scheme's Profile action with the Allocations
+// instrument.
+//
+// Before it is timed, each workload is run once and its output is checked
+// against the output written here, which is the same for both interpreters,
+// so that a difference in speed can't come from one of them doing less work.
+#if FINCHLIB_CPP
+    import finchlib_cpp
+#else
+    import finchlib
+#endif
+
+
+/// Change in the blocks and bytes allocated from the malloc zones
+struct AllocationCount {
+    var blocks = 0
+    var bytes = 0
+
+    var description: String {
+        return "\(blocks) blocks (\(bytes) bytes)"
+    }
+}
+
+/// Upper bounds on the number of blocks that a benchmark's program may
+/// leave allocated after it is entered (or loaded) and after it is run
+struct AllocationBaseline {
+    let programBlocks: Int
+    let runBlocks: Int
+}
+
+#if FINCHLIB_CPP
+    // Each bound is 1.5 times the count measured for the same workload with
+    // a libstdc++ build of finchlib_cpp, rounded up to a multiple of ten.
+    // libc++ keeps more short strings inline, so it allocates no more.
+    let allocationBaselines: [String: AllocationBaseline] = [
+        "tight loop":  AllocationBaseline(programBlocks: 80, runBlocks: 10),
+        "deep gosub":  AllocationBaseline(programBlocks: 100, runBlocks: 20),
+        "array sweep": AllocationBaseline(programBlocks: 120, runBlocks: 20),
+        "print heavy": AllocationBaseline(programBlocks: 80, runBlocks: 20),
+        "load":        AllocationBaseline(programBlocks: 15_300, runBlocks: 0)
+    ]
+#else
+    let allocationBaselines: [String: AllocationBaseline] = [:]
+#endif
+
+/// Return the number of blocks and bytes that `block` leaves allocated
+func measureAllocations(block: () -> ()) -> AllocationCount {
+    var before = malloc_statistics_t()
+    malloc_zone_statistics(nil, &before)
+    block()
+    var after = malloc_statistics_t()
+    malloc_zone_statistics(nil, &after)
+
+    return AllocationCount(blocks: Int(after.blocks_in_use) - Int(before.blocks_in_use),
+        bytes: after.size_in_use - before.size_in_use)
+}
+
+
+/// Implementation of InterpreterIO that reads from an array of characters
+/// and discards output, unless `recordsOutput` is set
+class BenchmarkIO: NSObject, InterpreterIO {
+    /// Characters to be returned by getInputChar()
+    var inputChars: [Char] = []
+
+    /// Index of the next character of inputChars to be returned by getInputChar()
+    var inputIndex: Int = 0
+
+    /// Number of characters written
+    var outputCount: Int = 0
+
+    /// If true, written characters are kept in outputChars
+    var recordsOutput = false
+
+    /// Characters written while recordsOutput is true
+    var outputChars: [Char] = []
+
+    /// Get outputChars as a String value
+    var outputString: String {
+        var cchars = outputChars.map { CChar($0) }
+        cchars.append(0)
+        return String.fromCString(cchars) ?? ""
+    }
+
+    /// Strings passed to showError()
+    var errors: [String] = []
+
+    /// Set inputChars from a String value
+    func setInput(s: String) {
+        inputChars = Array(s.utf8)
+        inputIndex = 0
+    }
+
+    /// Get the first recorded error message. Returns empty string if no errors recorded.
+    var firstError: String {
+        if errors.count > 0 {
+            return errors[0]
+        }
+        return ""
+    }
+
+    func getInputCharForInterpreter(interpreter: Interpreter) -> InputCharResult {
+        if inputIndex < inputChars.count {
+            let value = inputChars[inputIndex++]
+            #if FINCHLIB_CPP
+                return InputCharResult_Value(value)
+            #else
+                return .Value(value)
+            #endif
+        }
+
+    #if FINCHLIB_CPP
+        return InputCharResult_EndOfStream()
+    #else
+        return .EndOfStream
+    #endif
+    }
+
+    func putOutputChar(c: Char, forInterpreter interpreter: Interpreter) {
+        ++outputCount
+        if recordsOutput {
+            outputChars.append(c)
+        }
+    }
+
+    #if FINCHLIB_CPP
+    func putOutputChars(chars: UnsafePointer<Char>, length: Int, forInterpreter interpreter: Interpreter) {
+        outputCount += length
+        if recordsOutput {
+            outputChars += UnsafeBufferPointer(start: chars, count: length)
+        }
+    }
+    #endif
+
+    func showCommandPromptForInterpreter(interpreter: Interpreter) {
+        // does nothing
+    }
+
+    func showInputPromptForInterpreter(interpreter: Interpreter) {
+        // does nothing
+    }
+
+    func showErrorMessage(message: String, forInterpreter interpreter: Interpreter) {
+        errors.append(message)
+    }
+
+    func showDebugTraceMessage(message: String, forInterpreter interpreter: Interpreter) {
+        // does nothing
+    }
+
+    func byeForInterpreter(interpreter: Interpreter) {
+        // does nothing
+    }
+}
+
+class finchlibBenchmarks: XCTestCase {
+
+    /// Run `input` on a new interpreter, and check that it writes
+    /// `expectedOutput` without errors
+    func verifyOutput(name: String, input: String, expectedOutput: String) {
+        let io = BenchmarkIO()
+        io.recordsOutput = true
+        let interpreter = Interpreter(interpreterIO: io)
+        io.setInput(input)
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "\(name): unexpected \"\(io.firstError)\"")
+        XCTAssertTrue(io.outputString == expectedOutput, "\(name): output differs from the expected output")
+    }
+
+    /// Print the allocations of a benchmark, and check its block counts
+    /// against its entry in `allocationBaselines`, if it has one
+    func reportAllocations(name: String, program: AllocationCount, run: AllocationCount?) {
+        let runDescription = run.map { ", run \($0.description)" } ?? ""
+        println("\(name): program \(program.description)\(runDescription) left allocated")
+
+        if let baseline = allocationBaselines[name] {
+            XCTAssertTrue(program.blocks <= baseline.programBlocks,
+                "\(name): program left \(program.blocks) blocks allocated, baseline is \(baseline.programBlocks)")
+            if let run = run {
+                XCTAssertTrue(run.blocks <= baseline.runBlocks,
+                    "\(name): run left \(run.blocks) blocks allocated, baseline is \(baseline.runBlocks)")
+            }
+        }
+    }
+
+    /// Enter a program, check its output, then measure the time taken to
+    /// RUN it
+    ///
+    /// `statementCount` is the number of statements that the program
+    /// executes, and is used to report the statements per second.
+    func measureProgram(name: String, program: [String], statementCount: Int, expectedOutput: String) {
+        let programText = "\n".join(program) + "\n"
+        verifyOutput(name, input: programText + "run\n", expectedOutput: expectedOutput)
+
+        var totalSeconds = 0.0
+        var runCount = 0
+        var programAllocations = AllocationCount()
+        var runAllocations = AllocationCount()
+
+        measureBlock() {
+            let io = BenchmarkIO()
+            let interpreter = Interpreter(interpreterIO: io)
+            io.setInput(programText)
+            programAllocations = measureAllocations {
+                interpreter.runUntilEndOfInput()
+            }
+
+            io.setInput("run\n")
+            let start = CFAbsoluteTimeGetCurrent()
+            runAllocations = measureAllocations {
+                interpreter.runUntilEndOfInput()
+            }
+            totalSeconds += CFAbsoluteTimeGetCurrent() - start
+            ++runCount
+
+            XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        }
+
+        if totalSeconds > 0 {
+            let rate = Double(statementCount * runCount) / totalSeconds
+            println("\(name): \(Int(rate)) statements/sec")
+        }
+        reportAllocations(name, program: programAllocations, run: runAllocations)
+    }
+
+    func testTightLoop() {
+        let n = 100_000
+        measureProgram("tight loop", program: [
+            "10 i = 0",
+            "20 i = i + 1",
+            "30 if i < \(n) goto 20",
+            "40 print i",
+            "50 end"
+            ], statementCount: 3 + 2 * n, expectedOutput: "\(n)\n")
+    }
+
+    func testDeepGosub() {
+        let depth = 100
+        let repeats = 200
+        measureProgram("deep gosub", program: [
+            "10 r = 0",
+            "20 d = 0",
+            "30 gosub 100",
+            "40 r = r + 1",
+            "50 if r < \(repeats) goto 20",
+            "60 print r; \" \"; d",
+            "70 end",
+            "100 d = d + 1",
+            "110 if d < \(depth) gosub 100",
+            "120 return"
+            ], statementCount: 3 + repeats * (4 + 3 * depth), expectedOutput: "\(repeats) \(depth)\n")
+    }
+
+    func testArraySweep() {
+        let n = 1000
+        let passes = 20
+        measureProgram("array sweep", program: [
+            "10 dim @(\(n))",
+            "20 p = 0",
+            "30 i = 0",
+            "40 @(i) = i * 2",
+            "50 i = i + 1",
+            "60 if i < \(n) goto 40",
+            "70 i = 0",
+            "80 s = s + @(i)",
+            "90 i = i + 1",
+            "100 if i < \(n) goto 80",
+            "110 p = p + 1",
+            "120 if p < \(passes) goto 30",
+            "130 print s",
+            "140 end"
+            ], statementCount: 4 + passes * (4 + 6 * n),
+            expectedOutput: "\(passes * n * (n - 1))\n")
+    }
+
+    func testPrintHeavy() {
+        let n = 10_000
+        var expectedOutput = ""
+        for i in 0..<n {
+            expectedOutput += "line \(i) of output\t\(i * 2)\t\(i * 3)\n"
+        }
+        measureProgram("print heavy", program: [
+            "10 i = 0",
+            "20 print \"line \"; i; \" of output\", i * 2, i * 3",
+            "30 i = i + 1",
+            "40 if i < \(n) goto 20",
+            "50 end"
+            ], statementCount: 2 + 3 * n, expectedOutput: expectedOutput)
+    }
+
+    func testLoad() {
+        let n = 10_000
+        var fileLines: [String] = []
+        for i in 1...n {
+            fileLines.append("\(i * 10) let a = a + \(i)")
+        }
+        let path = NSTemporaryDirectory().stringByAppendingPathComponent("finchlibBenchmarks.bas")
+        ("\n".join(fileLines) + "\n" as NSString).writeToFile(path,
+            atomically: true, encoding: NSUTF8StringEncoding, error: nil)
+
+        verifyOutput("load", input: "load \"\(path)\"\nlist \((n - 1) * 10), \(n * 10)\n",
+            expectedOutput: "\((n - 1) * 10) LET A = A + \(n - 1)\n\(n * 10) LET A = A + \(n)\n")
+
+        var totalSeconds = 0.0
+        var runCount = 0
+        var programAllocations = AllocationCount()
+
+        measureBlock() {
+            let io = BenchmarkIO()
+            let interpreter = Interpreter(interpreterIO: io)
+            io.setInput("load \"\(path)\"\n")
+            let start = CFAbsoluteTimeGetCurrent()
+            programAllocations = measureAllocations {
+                interpreter.runUntilEndOfInput()
+            }
+            totalSeconds += CFAbsoluteTimeGetCurrent() - start
+            ++runCount
+
+            XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        }
+
+        if totalSeconds > 0 {
+            let rate = Double(n * runCount) / totalSeconds
+            println("load: \(Int(rate)) lines/sec")
+        }
+        reportAllocations("load", program: programAllocations, run: nil)
+
+        NSFileManager.defaultManager().removeItemAtPath(path, error: nil)
+    }
+}
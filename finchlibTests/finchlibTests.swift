@@ -175,6 +175,67 @@ class StringIO: NSObject, InterpreterIO {
     }
 }
 
+#if FINCHLIB_CPP || os(iOS)
+/// StringIO that also implements the bulk-input method, returning at most
+/// `chunkSize` characters from each call
+class ChunkedStringIO: StringIO {
+    /// Largest number of characters returned by one call of getInputChars()
+    let chunkSize: Int
+
+    /// Number of times getInputChars() has been called
+    var getInputCharsCount: Int = 0
+
+    /// Number of calls, before any others, that return .Value with a count
+    /// of zero
+    var emptyValueCount: Int = 0
+
+    init(chunkSize: Int) {
+        self.chunkSize = chunkSize
+        super.init()
+    }
+
+    func getInputChars(buffer: UnsafeMutablePointer<Char>, maxLength: Int, count: UnsafeMutablePointer<Int>, forInterpreter interpreter: Interpreter) -> InputResultKind {
+        ++getInputCharsCount
+        if getInputCharsCount <= emptyValueCount {
+            count.memory = 0
+            return .Value
+        }
+        let n = min(chunkSize, maxLength, inputChars.count - inputIndex)
+        for i in 0..<n {
+            buffer[i] = inputChars[inputIndex++]
+        }
+        count.memory = n
+        return n > 0 ? .Value : .EndOfStream
+    }
+}
+#endif
+
+#if FINCHLIB_CPP || os(iOS)
+/// StringIO that also records output, input prompts, and errors in the
+/// order they are sent, with each block of output as one event
+class EventLogIO: StringIO {
+    /// "output:" followed by the characters of each putOutputChars() call,
+    /// "prompt" for each input prompt, and "error:" followed by each message
+    var events: [String] = []
+
+    func putOutputChars(chars: UnsafePointer<Char>, length: Int, forInterpreter interpreter: Interpreter) {
+        let block = Array(UnsafeBufferPointer(start: chars, count: length))
+        outputChars += block
+        events.append("output:" + stringFromChars(block))
+    }
+
+    override func showInputPromptForInterpreter(interpreter: Interpreter) {
+        super.showInputPromptForInterpreter(interpreter)
+        events.append("prompt")
+    }
+
+    override func showErrorMessage(message: String, forInterpreter interpreter: Interpreter) {
+        super.showErrorMessage(message, forInterpreter: interpreter)
+        events.append("error:" + message)
+    }
+}
+#endif
+
 class finchlibTests: XCTestCase {
 
     var io: StringIO!
@@ -492,6 +553,28 @@ class finchlibTests: XCTestCase {
         XCTAssertEqual("hello\ngoodbye\nhello\n", io.outputString, "should print expected lines")
     }
 
+    func testComputedGotoAndGosub() {
+        io.inputString = lines(
+            "10 let n = 1",
+            "20 gosub 100 + n * 10",
+            "30 let n = n + 1",
+            "40 if n < 3 then goto 10 * 2",
+            "50 if -n + 3 = 0 then if n > 2 then goto 70",
+            "60 print \"skipped\"",
+            "70 end",
+            "110 print \"one\"",
+            "115 return",
+            "120 print \"two\"",
+            "125 return",
+            "run"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual("one\ntwo\n", io.outputString, "should print expected lines")
+    }
+
     func testRem() {
         io.inputString = lines(
             "10  rem-This is a comment",
@@ -566,6 +649,28 @@ class finchlibTests: XCTestCase {
         XCTAssertEqual(expectedOutput, io.outputString, describeDifference(expectedOutput, io.outputString))
     }
 
+    #if FINCHLIB_CPP || os(iOS)
+    func testInputKeepsExtraValuesForNextInput() {
+        io.inputString = lines(
+            "10 input a",
+            "20 input b, c",
+            "30 input d",
+            "40 print a; \" \"; b; \" \"; c; \" \"; d",
+            "50 end",
+            "run",
+            "1, 2",
+            "3, -4",
+            ""
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual(2, io.inputPromptCount, "only lines that are read should be prompted for")
+        XCTAssertEqual("1 2 3 -4\n", io.outputString)
+    }
+    #endif
+
     func testInputWithBadEntry() {
         io.inputString = lines(
             "5 let x = 23"                                     ,
@@ -850,6 +955,35 @@ class finchlibTests: XCTestCase {
         XCTAssertEqual(expectedOutput, io.outputString, describeDifference(expectedOutput, io.outputString))
     }
 
+    func testConstantExpressionsInProgram() {
+        io.inputString = lines(
+            "10 let i = 3",
+            "20 let @(i+0) = (10*4)+2",
+            "30 if 1*(2+2) = 4 then goto (10*4)/2+30",
+            "40 print 0",
+            "50 print @(3), -(2+3)*2",
+            "60 end",
+            "list",
+            "run"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        var expectedOutput = lines(
+            "10 LET I = 3",
+            "20 LET @(I + 0) = (10 * 4) + 2",
+            "30 IF 1 * (2 + 2) = 4 THEN GOTO (10 * 4) / 2 + 30",
+            "40 PRINT 0",
+            "50 PRINT @(3), -(2 + 3) * 2",
+            "60 END",
+            "42\t-10",
+            ""
+        )
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual(expectedOutput, io.outputString, describeDifference(expectedOutput, io.outputString))
+    }
+
     func testArray() {
         io.inputString = lines(
             "10 let x = 99"                          ,
@@ -874,6 +1008,27 @@ class finchlibTests: XCTestCase {
         XCTAssertEqual(expectedOutput, io.outputString, describeDifference(expectedOutput, io.outputString))
     }
 
+    func testArrayIndexWraps() {
+        io.inputString = lines(
+            "dim @(3000)"                        ,
+            "@(-1) = 1"                          ,
+            "@(3000) = 2"                        ,
+            "@(-3000) = @(0) + 3"                ,
+            "@(2500) = 4"                        ,
+            "print @(2999), @(0), @(-500), @(1)"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        var expectedOutput = lines(
+            "1\t5\t4\t0" ,
+            ""
+        )
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual(expectedOutput, io.outputString, describeDifference(expectedOutput, io.outputString))
+    }
+
     func testAbbreviations() {
         io.inputString = lines(
             "10  p r 99"                              ,
@@ -982,4 +1137,856 @@ class finchlibTests: XCTestCase {
         }
 
     }
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testProfile() {
+        io.inputString = lines(
+            "10 profile",
+            "20 gosub 100",
+            "30 gosub 200",
+            "40 gosub 100",
+            "50 end",
+            "100 a = a + 1",
+            "110 return",
+            "200 return",
+            "run"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+
+        var hits = [Int: Int]()
+        var gosubCalls = [Int: Int]()
+        for entry in interpreter.profileReport() as! [NSDictionary] {
+            let lineNumber = (entry[InterpreterProfileLineNumberKey] as! NSNumber).integerValue
+            hits[lineNumber] = (entry[InterpreterProfileHitsKey] as! NSNumber).integerValue
+            gosubCalls[lineNumber] = (entry[InterpreterProfileGosubCallsKey] as! NSNumber).integerValue
+        }
+
+        XCTAssertEqual(2, hits[100] ?? 0, "line 100 should be executed twice")
+        XCTAssertEqual(2, hits[110] ?? 0, "line 110 should be executed twice")
+        XCTAssertEqual(1, hits[200] ?? 0, "line 200 should be executed once")
+        XCTAssertEqual(2, gosubCalls[100] ?? 0, "line 100 should be called twice")
+        XCTAssertEqual(1, gosubCalls[200] ?? 0, "line 200 should be called once")
+        XCTAssertNil(hits[10], "line 10 is executed before profiling starts")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testMetrics() {
+        io.inputString = lines(
+            "10 gosub 100",
+            "20 print \"hi\"",
+            "30 end",
+            "100 gosub 200",
+            "110 return",
+            "200 return",
+            "run"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+
+        let metrics = interpreter.metrics()
+        func metric(key: String) -> Int {
+            return (metrics[key] as! NSNumber).integerValue
+        }
+
+        XCTAssertEqual(7, metric(InterpreterMetricsStatementsExecutedKey), "six program lines and RUN")
+        XCTAssertEqual(2, metric(InterpreterMetricsMaxGosubDepthKey))
+        XCTAssertEqual(7, metric(InterpreterMetricsLinesParsedKey))
+        XCTAssertEqual(3, metric(InterpreterMetricsOutputCharsKey))
+        XCTAssertEqual(0, metric(InterpreterMetricsLoadCountKey))
+
+        let histogram = metrics[InterpreterMetricsParseTimeHistogramKey] as! [NSNumber]
+        XCTAssertEqual(16, histogram.count)
+        XCTAssertEqual(7, histogram.reduce(0) { $0 + $1.integerValue }, "every parsed line is in the histogram")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testStateAsData() {
+        io.inputString = lines(
+            "10 print a; @(2)",
+            "20 end",
+            "a = 12",
+            "@(2) = 34"
+        )
+        interpreter.runUntilEndOfInput()
+
+        let data = interpreter.stateAsData()
+
+        let restoredIO = StringIO()
+        let restored = Interpreter(interpreterIO: restoredIO)
+        XCTAssertTrue(restored.restoreStateFromData(data), "snapshot should be accepted")
+        XCTAssertFalse(restored.restoreStateFromData(data.subdataWithRange(NSMakeRange(0, data.length - 1))),
+            "truncated snapshot should be rejected")
+
+        restoredIO.inputString = lines("list", "goto 10")
+        restored.runUntilEndOfInput()
+
+        let expectedOutput = lines(
+            "10 PRINT A; @(2)",
+            "20 END",
+            "1234",
+            ""
+        )
+        XCTAssertEqual(0, restoredIO.errors.count, "unexpected \"\(restoredIO.firstError)\"")
+        XCTAssertEqual(expectedOutput, restoredIO.outputString, describeDifference(expectedOutput, restoredIO.outputString))
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testInterpreterPool() {
+        let programs = [
+            lines("10 input a, b", "20 print a * b", "30 end"),
+            lines("10 print \"before\"", "20 bye", "30 print \"after\""),
+            lines("10 goto 10")
+        ]
+        let inputDecks = ["6, 7\n"]
+
+        let pool = InterpreterPool(workerCount: 2)
+        pool.statementLimit = 10_000
+        let results = pool.runPrograms(programs, inputDecks: inputDecks) as! [InterpreterPoolResult]
+
+        XCTAssertEqual(3, results.count)
+
+        XCTAssertEqual("42\n", results[0].output)
+        XCTAssertEqual(0, results[0].errorMessages.count, "unexpected errors")
+        XCTAssertFalse(results[0].didReachStatementLimit)
+
+        XCTAssertEqual("before\n", results[1].output)
+        XCTAssertFalse(results[1].didReachStatementLimit)
+
+        XCTAssertEqual("", results[2].output)
+        XCTAssertTrue(results[2].didReachStatementLimit, "endless loop should be stopped")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testFork() {
+        io.inputString = lines(
+            "10 @(1) = @(1) + a",
+            "20 print a; \" \"; @(1); \" \"; @(2)",
+            "30 end",
+            "@(1) = 100",
+            "@(2) = 5",
+            ""
+        )
+        interpreter.runUntilEndOfInput()
+
+        let forkIO = StringIO()
+        let fork = interpreter.forkWithInterpreterIO(forkIO)
+        forkIO.inputString = lines("a = 7", "goto 10", "")
+        fork.runUntilEndOfInput()
+
+        XCTAssertEqual(0, forkIO.errors.count, "unexpected \"\(forkIO.firstError)\"")
+        XCTAssertEqual("7 107 5\n", forkIO.outputString, "fork should start with the parent's array")
+
+        io.inputString = lines("a = 1", "goto 10", "")
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual("1 101 5\n", io.outputString, "parent should not see the fork's changes")
+
+        let pool = InterpreterPool(workerCount: 2)
+        let inputs = [lines("a = 2", "goto 10", ""), lines("a = 3", "goto 10", "")]
+        let results = pool.runForksOfInterpreter(interpreter, inputs: inputs) as! [InterpreterPoolResult]
+
+        XCTAssertEqual(2, results.count)
+        XCTAssertEqual("2 103 5\n", results[0].output)
+        XCTAssertEqual("3 104 5\n", results[1].output)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testArrayPagesCanBeWrittenAfterForksEnd() {
+        io.inputString = lines("@(1) = 100", "@(2) = 5", "")
+        interpreter.runUntilEndOfInput()
+
+        let keptIO = StringIO()
+        var kept: Interpreter? = interpreter.forkWithInterpreterIO(keptIO)
+
+        let pool = InterpreterPool(workerCount: 2)
+        let results = pool.runForksOfInterpreter(interpreter, inputs: [lines("@(1) = 1", "print @(1)", "")]) as! [InterpreterPoolResult]
+        XCTAssertEqual("1\n", results[0].output)
+
+        // The pool's fork has gone, but the pages are still shared with `kept`
+        io.inputString = lines("@(2) = 6", "print @(1); \" \"; @(2)", "")
+        interpreter.runUntilEndOfInput()
+        XCTAssertEqual("100 6\n", io.outputString)
+
+        keptIO.inputString = lines("print @(1); \" \"; @(2)", "")
+        kept!.runUntilEndOfInput()
+        XCTAssertEqual("100 5\n", keptIO.outputString, "fork should not see the parent's changes")
+
+        // Now no other interpreter shares the parent's pages
+        kept = nil
+        io.inputString = lines("@(1) = 101", "print @(1); \" \"; @(2)", "")
+        interpreter.runUntilEndOfInput()
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual("100 6\n101 6\n", io.outputString)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testForksHaveTheirOwnProgramsAndRandomNumbers() {
+        io.inputString = lines(
+            "10 print rnd(1000000)",
+            "20 end",
+            "randomize 5",
+            ""
+        )
+        interpreter.runUntilEndOfInput()
+
+        let forkIO = StringIO()
+        let fork = interpreter.forkWithInterpreterIO(forkIO)
+        forkIO.inputString = lines("15 print 15", "list", "")
+        fork.runUntilEndOfInput()
+        XCTAssertEqual(lines("10 PRINT RND(1000000)", "15 PRINT 15", "20 END", ""), forkIO.outputString)
+
+        io.inputString = lines("list", "")
+        interpreter.runUntilEndOfInput()
+        XCTAssertEqual(lines("10 PRINT RND(1000000)", "20 END", ""), io.outputString,
+            "parent should not see the fork's new line")
+
+        let pool = InterpreterPool(workerCount: 2)
+        let inputs = [String](count: 3, repeatedValue: lines("goto 10", ""))
+        let outputs = (pool.runForksOfInterpreter(interpreter, inputs: inputs) as! [InterpreterPoolResult]).map { $0.output }
+        let repeatedOutputs = (pool.runForksOfInterpreter(interpreter, inputs: inputs) as! [InterpreterPoolResult]).map { $0.output }
+
+        XCTAssertTrue(outputs == repeatedOutputs, "forks with the same index should get the same numbers")
+        XCTAssertNotEqual(outputs[0], outputs[1], "each fork should have its own stream")
+        XCTAssertNotEqual(outputs[1], outputs[2], "each fork should have its own stream")
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testRandomize() {
+        io.inputString = lines(
+            "randomize 12345",
+            "print rnd(1000); rnd(1000); rnd(1000)",
+            "randomize 12345",
+            "print rnd(1000); rnd(1000); rnd(1000)"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+
+        let outputLines = io.outputString.componentsSeparatedByString("\n")
+        XCTAssertEqual(3, outputLines.count)
+        XCTAssertEqual(outputLines[0], outputLines[1], "same seed should give same numbers")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testArrayBulkOperations() {
+        io.inputString = lines(
+            "dim @(5)",
+            "fill 0, 5, 3",
+            "@(1) = 9",
+            "@(4) = -2",
+            "copy 0, 2, 2",
+            "print sum(0, 5); \" \"; min(0, 5); \" \"; max(0, 5); \" \"; find(9, 0, 5); \" \"; find(9, 4, 2)",
+            "print sum(3, 4); \" \"; find(7, 0, 5)"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual("22 -2 9 1 -1\n19 -1\n", io.outputString)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testStatementBudgetCountsLoopLines() {
+        io.inputString = lines(
+            "10 i = 0",
+            "20 i = i + 1",
+            "30 if i < 5 then goto 20",
+            "40 print i",
+            "50 end",
+            "run"
+        )
+
+        while interpreter.state() != .Running {
+            interpreter.next()
+        }
+
+        // Each line of the loop uses one statement of the budget
+        XCTAssertEqual(InterpreterStopReason.BudgetExhausted, interpreter.runForStatementBudget(9))
+        XCTAssertEqual("", io.outputString)
+        XCTAssertEqual(InterpreterStopReason.BudgetExhausted, interpreter.runForStatementBudget(2))
+        XCTAssertEqual("", io.outputString)
+        XCTAssertEqual(InterpreterStopReason.BudgetExhausted, interpreter.runForStatementBudget(1))
+        XCTAssertEqual("5\n", io.outputString)
+        XCTAssertEqual(InterpreterStopReason.ProgramEnded, interpreter.runForStatementBudget(1))
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testTakeProgramChanges() {
+        io.inputString = lines(
+            "10 print 1",
+            "20 print 2",
+            "30 print 3"
+        )
+        interpreter.runUntilEndOfInput()
+
+        var low: InterpreterLineNumber = 0
+        var high: InterpreterLineNumber = 0
+        var text = interpreter.takeProgramChangesWithLowLineNumber(&low, highLineNumber: &high)
+        XCTAssertEqual(lines("10 PRINT 1", "20 PRINT 2", "30 PRINT 3", ""), text)
+        XCTAssertEqual(10, low)
+        XCTAssertEqual(30, high)
+
+        XCTAssertNil(interpreter.takeProgramChangesWithLowLineNumber(&low, highLineNumber: &high))
+
+        io.inputString = lines(
+            "20 print 22",
+            "25 print 25",
+            "10"
+        )
+        interpreter.runUntilEndOfInput()
+
+        text = interpreter.takeProgramChangesWithLowLineNumber(&low, highLineNumber: &high)
+        XCTAssertEqual(lines("20 PRINT 22", "25 PRINT 25", ""), text)
+        XCTAssertEqual(10, low)
+        XCTAssertEqual(25, high)
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testNumberBitsIsASupportedWidth() {
+        let bits = Interpreter.numberBits()
+        XCTAssertTrue(bits == 16 || bits == 32 || bits == 64, "unexpected width \(bits)")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testNumbersReachTheLimitsOfTheirWidth() {
+        // Double A until it is half of the smallest power of two that is too
+        // large, then build the largest and smallest Numbers from it without
+        // overflowing, in a variable and in an array element
+        let bits = Interpreter.numberBits()
+        io.inputString = lines(
+            "10 let a = 1",
+            "20 let i = 0",
+            "30 if i = \(bits - 2) then goto 70",
+            "40 let a = a * 2",
+            "50 let i = i + 1",
+            "60 goto 30",
+            "70 dim @(1)",
+            "80 let @(0) = -a - a",
+            "90 print a - 1 + a",
+            "100 print @(0)",
+            "110 end",
+            "run"
+        )
+
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        switch bits {
+        case 16:
+            XCTAssertEqual("32767\n-32768\n", io.outputString)
+        case 32:
+            XCTAssertEqual("2147483647\n-2147483648\n", io.outputString)
+        default:
+            XCTAssertEqual("9223372036854775807\n-9223372036854775808\n", io.outputString)
+        }
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testProgramChangesAfterNewCoverAllLineNumbersOfTheWidth() {
+        io.inputString = lines(
+            "10 print 1",
+            "new"
+        )
+        interpreter.runUntilEndOfInput()
+
+        var low: InterpreterLineNumber = 0
+        var high: InterpreterLineNumber = 0
+        XCTAssertEqual("", interpreter.takeProgramChangesWithLowLineNumber(&low, highLineNumber: &high))
+
+        let bits = Interpreter.numberBits()
+        let largest = InterpreterLineNumber.max >> InterpreterLineNumber(64 - bits)
+        XCTAssertEqual(-largest - 1, low)
+        XCTAssertEqual(largest, high)
+    }
+    #endif
+
+    // Native code is only generated if finchlib_cpp is built with
+    // FINCHLIB_JIT=1, so this test also needs -DFINCHLIB_JIT in the test
+    // target's Swift flags.
+    #if FINCHLIB_CPP && FINCHLIB_JIT && arch(x86_64)
+    func testNativeCodeGivesSameOutputAsBytecode() {
+        // The loop runs well past NativeTier.HotLineThreshold, makes a GOSUB
+        // from the compiled lines, and changes a line between runs, which
+        // must discard the native code for the old line.
+        let input = lines(
+            "10 s = 0",
+            "20 i = 0",
+            "30 s = s + i * i",
+            "40 @(i) = s - j",
+            "50 gosub 200",
+            "60 i = i + 1",
+            "70 if i < 1000 then goto 30",
+            "80 print s; \" \"; @(999); \" \"; j",
+            "90 end",
+            "200 j = j + i",
+            "210 return",
+            "run",
+            "30 s = s + i * 2",
+            "run",
+            ""
+        )
+        let expectedOutput = lines("332833500 332334999 499500", "999000 500499 499500", "")
+
+        // A budget of 0 means no budget.  Tracing makes every line run in
+        // the bytecode interpreter.
+        func run(budget: Int, isTracing: Bool) -> (output: String, nativeLines: Int) {
+            let runIO = StringIO()
+            let runInterpreter = Interpreter(interpreterIO: runIO)
+            runIO.inputString = (isTracing ? "tron\n" : "") + input
+            if budget > 0 {
+                while runInterpreter.runForStatementBudget(budget) != .EndOfInput {}
+            }
+            else {
+                runInterpreter.runUntilEndOfInput()
+            }
+            XCTAssertEqual(0, runIO.errors.count, "unexpected \"\(runIO.firstError)\"")
+            let nativeLines = runInterpreter.metrics()[InterpreterMetricsNativeLinesExecutedKey] as! NSNumber
+            return (runIO.outputString, nativeLines.integerValue)
+        }
+
+        let bytecodeRun = run(0, true)
+        XCTAssertEqual(expectedOutput, bytecodeRun.output)
+        XCTAssertEqual(0, bytecodeRun.nativeLines, "tracing should keep to the bytecode")
+
+        // Small budgets make the native code return when its lines run out
+        for budget in [0, 7, 64, 1000] {
+            let nativeRun = run(budget, false)
+            XCTAssertEqual(bytecodeRun.output, nativeRun.output, "budget \(budget)")
+            XCTAssertTrue(nativeRun.nativeLines > 0, "budget \(budget)")
+        }
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testPushedInput() {
+        let expectation = expectationWithDescription("input available")
+        interpreter.inputAvailableHandler = { interpreter in
+            expectation.fulfill()
+        }
+
+        interpreter.pushInputString(lines("10 input a", "20 print a * 2", "30 end", "run", ""))
+        XCTAssertEqual(InterpreterStopReason.WaitingForInput, interpreter.runForStatementBudget(100))
+
+        interpreter.pushInputString("21\n")
+        interpreter.pushEndOfInput()
+        waitForExpectationsWithTimeout(5, handler: nil)
+
+        XCTAssertEqual(InterpreterStopReason.ProgramEnded, interpreter.runForStatementBudget(100))
+        XCTAssertEqual(InterpreterStopReason.EndOfInput, interpreter.runForStatementBudget(100))
+        XCTAssertEqual("42\n", io.outputString)
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testTimeBudgetIsExhaustedByEndlessLoop() {
+        io.inputString = lines(
+            "10 goto 10",
+            "run"
+        )
+
+        let start = NSDate()
+        XCTAssertEqual(InterpreterStopReason.BudgetExhausted, interpreter.runForTimeBudget(0.05))
+        XCTAssertTrue(NSDate().timeIntervalSinceDate(start) >= 0.05, "should run until the budget is used up")
+        XCTAssertEqual(InterpreterState.Running, interpreter.state())
+
+        // The program is still running, and carries on in the next call
+        XCTAssertEqual(InterpreterStopReason.BudgetExhausted, interpreter.runForTimeBudget(0.01))
+        XCTAssertEqual(InterpreterState.Running, interpreter.state())
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testTimeBudgetStopsWhenWaitingForInput() {
+        interpreter.pushInputString(lines("10 input a", "20 print a * 2", "30 end", "run", ""))
+
+        // A long budget is not used up while the program waits
+        let start = NSDate()
+        XCTAssertEqual(InterpreterStopReason.WaitingForInput, interpreter.runForTimeBudget(60))
+        XCTAssertTrue(NSDate().timeIntervalSinceDate(start) < 30, "should stop without using the budget")
+        XCTAssertEqual(InterpreterState.ReadingInput, interpreter.state())
+        XCTAssertEqual("", io.outputString)
+
+        interpreter.pushInputString("21\n")
+        interpreter.pushEndOfInput()
+        XCTAssertEqual(InterpreterStopReason.ProgramEnded, interpreter.runForTimeBudget(60))
+        XCTAssertEqual("42\n", io.outputString)
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testTimeBudgetStopsWhenProgramEnds() {
+        io.inputString = lines(
+            "10 print 1",
+            "20 end",
+            "run",
+            "print 2"
+        )
+
+        XCTAssertEqual(InterpreterStopReason.ProgramEnded, interpreter.runForTimeBudget(60))
+        XCTAssertEqual("1\n", io.outputString)
+
+        // The rest of the input is read by the next call
+        XCTAssertEqual(InterpreterStopReason.EndOfInput, interpreter.runForTimeBudget(60))
+        XCTAssertEqual("1\n2\n", io.outputString)
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testRequestBreakStopsProgramRunningOnAnotherThread() {
+        // The loop never ends, so runUntilEndOfInput() only returns if the
+        // break is taken.  When native code is enabled, the loop is running
+        // as native code by then.
+        io.inputString = lines(
+            "10 let a = a + 1",
+            "20 goto 10",
+            "run",
+            "print \"after\""
+        )
+
+        let interpreter = self.interpreter
+        let delay = dispatch_time(DISPATCH_TIME_NOW, Int64(0.1 * Double(NSEC_PER_SEC)))
+        dispatch_after(delay, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)) {
+            interpreter.requestBreak()
+        }
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(1, io.errors.count)
+        XCTAssertTrue(io.firstError.hasPrefix("BREAK at line "), "unexpected \"\(io.firstError)\"")
+        XCTAssertEqual("after\n", io.outputString)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testSampleProgramsGiveSameOutputAsImmediateStatements() {
+        // The samples from README.md, each statement with the input it
+        // reads.  Run as a program, the statements are compiled to
+        // bytecode.  Entered without line numbers, they are executed by
+        // evaluating their syntax trees.  Both should give the same output.
+        typealias Step = (statement: String, response: String?)
+        let samples: [[Step]] = [
+            [
+                ("PRINT \"Hello, world\"", nil),
+                ("LET A = 2", nil),
+                ("LET B = 3", nil),
+                ("PRINT \"a + b = \"; A + B", nil),
+                ("IF A < B THEN PRINT \"a is less than b\"", nil)
+            ],
+            [
+                ("Print \"Enter first number\"", nil),
+                ("Input a", "12"),
+                ("Print \"Enter second number\"", nil),
+                ("Input b", "30"),
+                ("Print a; \" + \"; b; \" = \"; a + b", nil)
+            ],
+            [
+                ("PRINT \"Enter three numbers:\"", nil),
+                ("INPUT A, B, C", "123, 456, -789"),
+                ("PRINT A + B + C, (A - B) * C / 7, -A", nil),
+                ("? \"abbreviated\"; 1 + 2 * 3", nil),
+                ("@(3) = A * 2", nil),
+                ("pr @(3) - @(-1); \" \"; c", nil),
+                ("' a comment", nil)
+            ]
+        ]
+
+        for sample in samples {
+            var programLines: [String] = []
+            var responses: [String] = []
+            var immediateLines: [String] = []
+            for (i, step) in enumerate(sample) {
+                programLines.append("\((i + 1) * 10) \(step.statement)")
+                immediateLines.append(step.statement)
+                if let response = step.response {
+                    responses.append(response)
+                    immediateLines.append(response)
+                }
+            }
+            programLines += ["\((sample.count + 1) * 10) END", "RUN"] + responses
+
+            let programIO = StringIO()
+            programIO.inputString = lines(programLines)
+            Interpreter(interpreterIO: programIO).runUntilEndOfInput()
+
+            let immediateIO = StringIO()
+            immediateIO.inputString = lines(immediateLines)
+            Interpreter(interpreterIO: immediateIO).runUntilEndOfInput()
+
+            XCTAssertEqual(0, programIO.errors.count, "unexpected \"\(programIO.firstError)\"")
+            XCTAssertEqual(0, immediateIO.errors.count, "unexpected \"\(immediateIO.firstError)\"")
+            XCTAssertFalse(programIO.outputString.isEmpty)
+            XCTAssertEqual(immediateIO.outputString, programIO.outputString,
+                describeDifference(immediateIO.outputString, programIO.outputString))
+            XCTAssertEqual(immediateIO.inputPromptCount, programIO.inputPromptCount)
+        }
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testOutputIsFlushedBeforePromptsAndErrors() {
+        let eventIO = EventLogIO()
+        let eventInterpreter = Interpreter(interpreterIO: eventIO)
+        eventIO.inputString = lines(
+            "10 print \"Number\";",
+            "20 input a",
+            "30 print a * 2; \" done\";",
+            "40 print",
+            "50 print \"partial\";",
+            "60 goto 99",
+            "70 print \"end\";",
+            "80 end",
+            "run",
+            "21",
+            "goto 70"
+        )
+        eventInterpreter.runUntilEndOfInput()
+
+        // Text without a newline is sent before the prompt or error that
+        // follows it, and when END stops the program part-way through a line
+        let expectedEvents = [
+            "output:Number",
+            "prompt",
+            "output:42 done\n",
+            "output:partial",
+            "error:error: GOTO 99 - no line with that number",
+            "error:abort: program terminated",
+            "output:end"
+        ]
+        XCTAssertTrue(eventIO.events == expectedEvents, "events were \(eventIO.events)")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testOutputIsFlushedWhenTheBufferIsFull() {
+        let eventIO = EventLogIO()
+        let eventInterpreter = Interpreter(interpreterIO: eventIO)
+        eventIO.inputString = lines(
+            "10 i = 0",
+            "20 print \"0123456789\";",
+            "30 i = i + 1",
+            "40 if i < 500 then goto 20",
+            "50 end",
+            "run"
+        )
+        eventInterpreter.runUntilEndOfInput()
+
+        // 5000 characters with no newline: the buffer is sent once it holds
+        // 4096 or more, and the rest at END
+        let blockLengths = eventIO.events.map { count($0.utf8) - count("output:".utf8) }
+        XCTAssertTrue(blockLengths == [4100, 900], "blocks were \(blockLengths)")
+        XCTAssertEqual(0, eventIO.errors.count, "unexpected \"\(eventIO.firstError)\"")
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testBulkInput() {
+        // The last line has no newline, so input ends part-way through it
+        let input = lines(
+            "10 input a, b",
+            "20 print a + b",
+            "30 input c",
+            "40 print c",
+            "50 end",
+            "run",
+            "3, 4",
+            "5",
+            "print 12"
+        )
+
+        // A chunk of one character, chunks that split lines, and a chunk
+        // that holds all of the input, which is then read a line at a time
+        for chunkSize in [1, 5, 4096] {
+            let chunkedIO = ChunkedStringIO(chunkSize: chunkSize)
+            let chunkedInterpreter = Interpreter(interpreterIO: chunkedIO)
+            chunkedIO.inputString = input
+            chunkedInterpreter.runUntilEndOfInput()
+
+            XCTAssertEqual(0, chunkedIO.errors.count, "unexpected \"\(chunkedIO.firstError)\"")
+            XCTAssertEqual("7\n5\n12\n", chunkedIO.outputString, "chunk size \(chunkSize)")
+            XCTAssertEqual(2, chunkedIO.inputPromptCount)
+
+            // Each call fills a chunk.  Then the end of input is found
+            // twice: once ending the last line, and once more when the
+            // interpreter asks for another line.
+            let expectedCalls = (count(input.utf8) + chunkSize - 1) / chunkSize + 2
+            XCTAssertEqual(expectedCalls, chunkedIO.getInputCharsCount, "chunk size \(chunkSize)")
+        }
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testBulkInputDropsNonGraphicCharacters() {
+        // The non-graphic characters are in the middle of runs that are
+        // longer than eight characters, and at the ends of the runs
+        let chunkedIO = ChunkedStringIO(chunkSize: 4096)
+        let chunkedInterpreter = Interpreter(interpreterIO: chunkedIO)
+        chunkedIO.inputString = lines(
+            "print \"abcdefgh\u{7f}ijklmnop\tqrstuvwx\r\"; \"\u{e9}t\u{e9} is long enough to span words\"\u{01}",
+            ""
+        )
+        chunkedInterpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, chunkedIO.errors.count, "unexpected \"\(chunkedIO.firstError)\"")
+        XCTAssertEqual("abcdefghijklmnop qrstuvwxt is long enough to span words\n", chunkedIO.outputString)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testBulkInputOfNoCharactersIsWaiting() {
+        let chunkedIO = ChunkedStringIO(chunkSize: 4096)
+        let chunkedInterpreter = Interpreter(interpreterIO: chunkedIO)
+        chunkedIO.inputString = lines("print 12", "")
+        chunkedIO.emptyValueCount = 2
+
+        // Each value of no characters stops the interpreter, rather than
+        // having it ask again straight away
+        XCTAssertEqual(InterpreterStopReason.WaitingForInput, chunkedInterpreter.runForStatementBudget(100))
+        XCTAssertEqual(1, chunkedIO.getInputCharsCount)
+        XCTAssertEqual(InterpreterStopReason.WaitingForInput, chunkedInterpreter.runForStatementBudget(100))
+        XCTAssertEqual(2, chunkedIO.getInputCharsCount)
+        XCTAssertEqual("", chunkedIO.outputString)
+
+        chunkedInterpreter.runUntilEndOfInput()
+        XCTAssertEqual(0, chunkedIO.errors.count, "unexpected \"\(chunkedIO.firstError)\"")
+        XCTAssertEqual("12\n", chunkedIO.outputString)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testLoadLargeFileMatchesLineByLineInput() {
+        // Text of 64KiB or more is parsed in parallel by LOAD.  It should
+        // give the same program and errors as reading the same lines one
+        // at a time, including when it contains an immediate statement.
+        func programText(immediateLine: String?) -> String {
+            var textLines: [String] = []
+            for n in 1...5000 {
+                textLines.append("\(n) print \(n)")
+                switch n {
+                case 1000: textLines.append("17 print (")
+                case 2000: textLines.append("10 print \"last\"")
+                case 2500: if let line = immediateLine { textLines.append(line) }
+                case 3000: textLines.append("   ")
+                case 3500: textLines.append("30 print 1 +")
+                default: break
+                }
+            }
+            textLines.append("")
+            return lines(textLines)
+        }
+
+        let filename = NSTemporaryDirectory().stringByAppendingPathComponent("finchlibTests-load.bas")
+        for immediateLine in [nil, "print \"loading\""] as [String?] {
+            let text = programText(immediateLine)
+            XCTAssertTrue(count(text.utf8) >= 64 * 1024, "text should be parsed in parallel")
+            text.writeToFile(filename, atomically: true, encoding: NSUTF8StringEncoding, error: nil)
+
+            let serialIO = StringIO()
+            let serial = Interpreter(interpreterIO: serialIO)
+            serialIO.inputString = text + lines("list 1, 40", "list 4999", "")
+            serial.runUntilEndOfInput()
+
+            let parallelIO = StringIO()
+            let parallel = Interpreter(interpreterIO: parallelIO)
+            parallelIO.inputString = lines("load \"\(filename)\"", "list 1, 40", "list 4999", "")
+            parallel.runUntilEndOfInput()
+
+            XCTAssertTrue(parallelIO.errors == ["line 17: error: not a valid statement", "line 30: error: not a valid statement"],
+                "errors should be reported in source order")
+            XCTAssertTrue(serialIO.errors == parallelIO.errors, "errors should match line-by-line input")
+            XCTAssertEqual(serialIO.outputString, parallelIO.outputString,
+                describeDifference(serialIO.outputString, parallelIO.outputString))
+            XCTAssertTrue(parallelIO.outputString.rangeOfString("10 PRINT \"last\"\n") != nil,
+                "last definition of a line should win")
+            XCTAssertEqual(immediateLine != nil, parallelIO.outputString.hasPrefix("loading\n"))
+        }
+        NSFileManager.defaultManager().removeItemAtPath(filename, error: nil)
+    }
+    #endif
+
+    #if FINCHLIB_CPP || os(iOS)
+    func testProgramIsKeptWhenMostOfItsLinesAreDeleted() {
+        // The lines of a LOAD share arenas.  Deleting most of them leaves
+        // the arenas mostly unused, so the next LOAD copies the remaining
+        // lines into a new arena.
+        var programLines: [String] = []
+        var deletions: [String] = []
+        var expectedListing: [String] = []
+        var expectedRun: [String] = []
+        for n in 1...5000 {
+            programLines.append("\(n) print \"line \(n)\", \(n) * (a + \(n))")
+            if n % 100 == 0 {
+                expectedListing.append("\(n) PRINT \"line \(n)\", \(n) * (A + \(n))")
+                expectedRun.append("line \(n)\t\(n * n)")
+            } else {
+                deletions.append("\(n)")
+            }
+        }
+        deletions.append("9999 end")
+        expectedListing.append("9999 END")
+        expectedRun.append("")
+
+        let programFilename = NSTemporaryDirectory().stringByAppendingPathComponent("finchlibTests-program.bas")
+        let deletionsFilename = NSTemporaryDirectory().stringByAppendingPathComponent("finchlibTests-deletions.bas")
+        lines(programLines + [""]).writeToFile(programFilename, atomically: true, encoding: NSUTF8StringEncoding, error: nil)
+        lines(deletions + [""]).writeToFile(deletionsFilename, atomically: true, encoding: NSUTF8StringEncoding, error: nil)
+
+        io.inputString = lines(
+            "load \"\(programFilename)\"",
+            "load \"\(deletionsFilename)\"",
+            "list",
+            "run"
+        )
+        interpreter.runUntilEndOfInput()
+
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+        let expectedOutput = lines(expectedListing + expectedRun)
+        XCTAssertEqual(expectedOutput, io.outputString, describeDifference(expectedOutput, io.outputString))
+
+        NSFileManager.defaultManager().removeItemAtPath(programFilename, error: nil)
+        NSFileManager.defaultManager().removeItemAtPath(deletionsFilename, error: nil)
+    }
+    #endif
+
+    #if !FINCHLIB_CPP && !os(iOS)
+    func testRunProgramFile() {
+        let filename = NSTemporaryDirectory().stringByAppendingPathComponent("finchlibTests-run.bas")
+        lines("10 input a", "20 print a * 2", "30 end", "").writeToFile(filename, atomically: true, encoding: NSUTF8StringEncoding, error: nil)
+
+        io.inputString = "21\n"
+        interpreter.runProgramFile(filename)
+        NSFileManager.defaultManager().removeItemAtPath(filename, error: nil)
+
+        XCTAssertEqual("42\n", io.outputString)
+        XCTAssertEqual(0, io.errors.count, "unexpected \"\(io.firstError)\"")
+
+        interpreter.runProgramFile(filename)
+        XCTAssertEqual(1, io.errors.count, "file has been removed")
+    }
+    #endif
 }
@@ -29,7 +29,11 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 @class Interpreter;
 
 typedef unsigned char Char;
-typedef int Number;
+
+// Line numbers exchanged with the host.  BASIC numbers, and so line
+// numbers, are 16, 32, or 64 bits wide depending on how the library was
+// built (see +numberBits), and this type holds any of them.
+typedef int64_t InterpreterLineNumber;
 
 typedef NS_ENUM(NSInteger, InputResultKind)
 {
@@ -79,6 +83,31 @@ __END_DECLS
 /// Called when BYE is executed
 - (void)byeForInterpreter:(Interpreter *)interpreter;
 
+@optional
+
+/// Write specified output characters
+///
+/// If this method is implemented, the interpreter calls it, instead of
+/// `putOutputChar:forInterpreter:`, with a line or more of output at a time.
+- (void)putOutputChars:(const Char *)chars
+                length:(NSUInteger)length
+        forInterpreter:(Interpreter *)interpreter;
+
+/// Read available input characters
+///
+/// If this method is implemented, the interpreter calls it, instead of
+/// `getInputCharForInterpreter:`, to read up to `maxLength` characters into
+/// `buffer`.  On return, `*count` is the number of characters stored.
+///
+/// Return `InputResultKindValue` if at least one character was stored, or
+/// `InputResultKindEndOfStream` or `InputResultKindWaiting` with the same
+/// meanings as for `getInputCharForInterpreter:`.  `InputResultKindValue`
+/// with a count of zero is treated as `InputResultKindWaiting`.
+- (InputResultKind)getInputChars:(Char *)buffer
+                       maxLength:(NSUInteger)maxLength
+                           count:(NSUInteger *)count
+                  forInterpreter:(Interpreter *)interpreter;
+
 @end
 
 /// State of the interpreter
@@ -115,13 +144,97 @@ typedef NS_ENUM(NSInteger, InterpreterState)
     InterpreterStateReadingInput
 };
 
+/// Reason that `runForStatementBudget:` or `runForTimeBudget:` returned
+typedef NS_ENUM(NSInteger, InterpreterStopReason)
+{
+    /// The budget was used up.  The interpreter has more to do.
+    InterpreterStopReasonBudgetExhausted,
+
+    /// The InterpreterIO object returned `Waiting` for input
+    InterpreterStopReasonWaitingForInput,
+
+    /// The end of the input stream was reached
+    InterpreterStopReasonEndOfInput,
+
+    /// A running program stopped, due to END or an error
+    InterpreterStopReasonProgramEnded,
+
+    /// `breakExecution` was called
+    InterpreterStopReasonBreak
+};
+
+// Keys of the dictionaries returned by `profileReport`
+FOUNDATION_EXPORT NSString *const InterpreterProfileLineNumberKey;  // NSNumber (long long)
+FOUNDATION_EXPORT NSString *const InterpreterProfileHitsKey;        // NSNumber (unsigned long)
+FOUNDATION_EXPORT NSString *const InterpreterProfileSecondsKey;     // NSNumber (double)
+FOUNDATION_EXPORT NSString *const InterpreterProfileGosubCallsKey;  // NSNumber (unsigned long)
+
+// Keys of the dictionary returned by `metrics`.  Counts are NSNumbers
+// (unsigned long long) and times are NSNumbers (double) in seconds.
+FOUNDATION_EXPORT NSString *const InterpreterMetricsStatementsExecutedKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsMaxGosubDepthKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsLinesParsedKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsParseSecondsKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsParseTimeHistogramKey;  // NSArray (see `metrics`)
+FOUNDATION_EXPORT NSString *const InterpreterMetricsLoadCountKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsLoadBytesKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsLoadSecondsKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsSaveCountKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsSaveBytesKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsSaveSecondsKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsOutputCharsKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsInputWaitsKey;
+FOUNDATION_EXPORT NSString *const InterpreterMetricsNativeLinesExecutedKey;  // 0 unless FINCHLIB_JIT
+
 @interface Interpreter : NSObject <NSCoding>
 
 @property id<InterpreterIO> io;
 
+/// Block called when input is pushed while the interpreter is waiting for it
+///
+/// The block is called on `inputAvailableQueue`, or on the main queue if
+/// that is nil.  It would normally resume the interpreter by calling
+/// `runForTimeBudget:` or `next`.  See `pushInputChars:length:`.
+@property (copy) void (^inputAvailableHandler)(Interpreter *interpreter);
+
+/// Queue on which `inputAvailableHandler` is called
+@property (strong) dispatch_queue_t inputAvailableQueue;
+
 /// Initializer
 - (instancetype)initWithInterpreterIO:(id<InterpreterIO>)interpreterIO;
 
+/// Return the width in bits of BASIC numbers: 16, 32, or 64
+///
+/// The width is chosen when the library is built, by defining
+/// FINCHLIB_NUMBER_BITS.
++ (NSUInteger)numberBits;
+
+/// Return a new interpreter that starts with a copy of this one's state
+///
+/// The new interpreter uses `interpreterIO`, and is independent of this
+/// one, so it may be used on a different thread.  The parsed program is
+/// shared rather than copied, and the pages of the `@()` array are shared
+/// until one of the interpreters changes them, so a fork of a large program
+/// is quick to make and uses little memory.  This is useful for running a
+/// program many times with small changes, such as different values of a few
+/// variables.
+///
+/// Each fork's `RND()` continues on its own stream of numbers, so forks
+/// do not repeat each other's numbers or this interpreter's.
+///
+/// Input that this interpreter has read but not yet used is not copied.
+/// An interpreter that has not been used since it was last forked may be
+/// forked on several threads at once.
+- (Interpreter *)forkWithInterpreterIO:(id<InterpreterIO>)interpreterIO;
+
+/// Return a fork whose `RND()` stream is selected by `forkIndex`
+///
+/// Forks made with the same index from the same state get the same numbers,
+/// so results that use `RND()` can be reproduced.  Forks made with
+/// different indexes get different numbers.
+- (Interpreter *)forkWithInterpreterIO:(id<InterpreterIO>)interpreterIO
+                             forkIndex:(NSUInteger)forkIndex;
+
 /// Return the state of the interpreter as a property-list dictionary.
 ///
 /// This property list can be used to restore interpreter state
@@ -131,6 +244,29 @@ typedef NS_ENUM(NSInteger, InterpreterState)
 /// Set interpreter's properties using archived state produced by stateAsPropertyList()'
 - (void)restoreStateFromPropertyList:(NSDictionary *)propertyList;
 
+/// Return the state of the interpreter as a compact binary snapshot.
+///
+/// The snapshot holds the program in its parsed form, so it is faster to
+/// produce and to restore than the property list.  It is tied to the
+/// version of the interpreter that produced it.
+- (NSData *)stateAsData;
+
+/// Set interpreter's properties using a snapshot produced by stateAsData
+///
+/// Returns NO, leaving the interpreter unchanged, if the data is not a
+/// valid snapshot of a supported version.
+- (BOOL)restoreStateFromData:(NSData *)data;
+
+/// Return the listing of the part of the program that has changed since the
+/// last call, or nil if no line has been added, replaced, or deleted.
+///
+/// On return, `*lowLineNumber` and `*highLineNumber` are the range of line
+/// numbers that may have changed.  The result lists the lines that are now
+/// in that range, so it can replace the same range of a saved copy of the
+/// program.
+- (NSString *)takeProgramChangesWithLowLineNumber:(InterpreterLineNumber *)lowLineNumber
+                                   highLineNumber:(InterpreterLineNumber *)highLineNumber;
+
 /// Display prompt and read input lines and interpret them until end of input.
 ///
 /// This method should only be used when `InterpreterIO.getInputChar()`
@@ -138,16 +274,82 @@ typedef NS_ENUM(NSInteger, InterpreterState)
 /// Otherwise, host should call `next()` in a loop.
 - (void)runUntilEndOfInput;
 
+/// Add characters to the interpreter's input
+///
+/// This may be called on any thread, and is an alternative to having the
+/// InterpreterIO object supply input.  Once anything has been pushed, the
+/// interpreter reads input only from what has been pushed, and no longer
+/// calls the input methods of its InterpreterIO object.
+///
+/// When there is no pushed input to read, the interpreter stops as if
+/// the InterpreterIO object had returned `Waiting`.  The next push then
+/// calls `inputAvailableHandler`, so the host does not have to poll.
+- (void)pushInputChars:(const Char *)chars length:(NSUInteger)length;
+
+/// Add the UTF-8 characters of a string to the interpreter's input
+///
+/// See `pushInputChars:length:`.
+- (void)pushInputString:(NSString *)string;
+
+/// Mark the end of the interpreter's input
+///
+/// Once it has read everything that was pushed, the interpreter sees the
+/// end of the input stream.  See `pushInputChars:length:`.
+- (void)pushEndOfInput;
+
 /// Perform next operation.
 ///
 /// The host can drive the interpreter by calling `next()`
 /// in a loop.
 - (void)next;
 
+/// Perform operations until the specified number of them have been done,
+/// or until there is a reason to stop.
+///
+/// Each operation is what one call to `next()` would do, such as executing
+/// one statement of a running program.
+- (InterpreterStopReason)runForStatementBudget:(NSUInteger)maxStatements;
+
+/// Perform operations until the specified time has elapsed, or until there is
+/// a reason to stop.
+///
+/// The time is checked between operations, so the call may run a little
+/// longer than requested.
+- (InterpreterStopReason)runForTimeBudget:(NSTimeInterval)seconds;
+
 /// Return interpreter state
 - (InterpreterState)state;
 
 /// Halt running machine
 - (void)breakExecution;
 
+/// Halt the running program at the start of its next line, or call
+/// `breakExecution` before the next operation if no program is running
+///
+/// Unlike `breakExecution`, this may be called from any thread, such as
+/// while another thread is in `runUntilEndOfInput`.
+- (void)requestBreak;
+
+/// Return the statistics collected since the last `PROFILE` statement
+///
+/// The result is an array with a dictionary for each program line that
+/// has been executed, sorted by descending time.  See the
+/// `InterpreterProfile...Key` constants for the contents of the dictionaries.
+- (NSArray *)profileReport;
+
+/// Return statistics collected since the interpreter was created
+///
+/// Unlike `profileReport`, these are always collected, and this method may
+/// be called from any thread, even while the interpreter is running.  See
+/// the `InterpreterMetrics...Key` constants for the contents.
+///
+/// The parse-time histogram is an array of 16 counts of lines.  Element `i`
+/// counts lines that took at least 2^(i+7) and less than 2^(i+8)
+/// nanoseconds to parse, except that the first element also counts faster
+/// lines and the last also counts slower ones.
+///
+/// Signpost intervals for RUN, LOAD, SAVE, and archiving and restoring
+/// state are also recorded for Instruments, where the OS supports them.
+- (NSDictionary *)metrics;
+
 @end
@@ -28,6 +28,27 @@ using namespace finchlib_cpp;
 
 
 static NSString *InterpreterPropertyListKey = @"InterpreterPropertyList";
+static NSString *InterpreterSnapshotKey = @"InterpreterSnapshot";
+
+NSString *const InterpreterProfileLineNumberKey = @"lineNumber";
+NSString *const InterpreterProfileHitsKey = @"hits";
+NSString *const InterpreterProfileSecondsKey = @"seconds";
+NSString *const InterpreterProfileGosubCallsKey = @"gosubCalls";
+
+NSString *const InterpreterMetricsStatementsExecutedKey = @"statementsExecuted";
+NSString *const InterpreterMetricsMaxGosubDepthKey = @"maxGosubDepth";
+NSString *const InterpreterMetricsLinesParsedKey = @"linesParsed";
+NSString *const InterpreterMetricsParseSecondsKey = @"parseSeconds";
+NSString *const InterpreterMetricsParseTimeHistogramKey = @"parseTimeHistogram";
+NSString *const InterpreterMetricsLoadCountKey = @"loadCount";
+NSString *const InterpreterMetricsLoadBytesKey = @"loadBytes";
+NSString *const InterpreterMetricsLoadSecondsKey = @"loadSeconds";
+NSString *const InterpreterMetricsSaveCountKey = @"saveCount";
+NSString *const InterpreterMetricsSaveBytesKey = @"saveBytes";
+NSString *const InterpreterMetricsSaveSecondsKey = @"saveSeconds";
+NSString *const InterpreterMetricsOutputCharsKey = @"outputChars";
+NSString *const InterpreterMetricsInputWaitsKey = @"inputWaits";
+NSString *const InterpreterMetricsNativeLinesExecutedKey = @"nativeLinesExecuted";
 
 
 InputCharResult InputCharResult_Value(Char c)
@@ -65,6 +86,43 @@ InputCharResult InputCharResult_Waiting()
     return self;
 }
 
++ (NSUInteger)numberBits
+{
+    return FINCHLIB_NUMBER_BITS;
+}
+
+/// Initialize with a fork of another interpreter's engine
+- (instancetype)initWithInterpreterIO:(id<InterpreterIO>)interpreterIO
+                           forkOfEngine:(InterpreterEngine &)parent
+                              forkIndex:(uint64_t)forkIndex
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    self.io = interpreterIO;
+
+    _engine = new InterpreterEngine(self, parent, forkIndex);
+
+    return self;
+}
+
+- (Interpreter *)forkWithInterpreterIO:(id<InterpreterIO>)interpreterIO
+{
+    const auto forkIndex = _engine->forkCount.fetch_add(1, std::memory_order_relaxed);
+    return [[Interpreter alloc] initWithInterpreterIO:interpreterIO
+                                         forkOfEngine:*_engine
+                                            forkIndex:forkIndex];
+}
+
+- (Interpreter *)forkWithInterpreterIO:(id<InterpreterIO>)interpreterIO
+                             forkIndex:(NSUInteger)forkIndex
+{
+    return [[Interpreter alloc] initWithInterpreterIO:interpreterIO
+                                         forkOfEngine:*_engine
+                                            forkIndex:forkIndex];
+}
+
 - (instancetype)initWithCoder:(NSCoder *)coder
 {
     self = [super init];
@@ -73,6 +131,14 @@ InputCharResult InputCharResult_Waiting()
 
     _engine = new InterpreterEngine(self);
 
+    // Archives written by older versions contain a property list
+    // rather than a snapshot
+    NSData *snapshot = [coder decodeObjectForKey:InterpreterSnapshotKey];
+    if (snapshot && _engine->restoreStateFromData(snapshot))
+    {
+        return self;
+    }
+
     NSDictionary *propertyList = [coder decodeObjectForKey:InterpreterPropertyListKey];
     if (propertyList)
     {
@@ -93,8 +159,8 @@ InputCharResult InputCharResult_Waiting()
 
 - (void)encodeWithCoder:(NSCoder *)coder
 {
-    NSDictionary *propertyList = _engine->stateAsPropertyList();
-    [coder encodeObject:propertyList forKey:InterpreterPropertyListKey];
+    NSData *snapshot = _engine->stateAsData();
+    [coder encodeObject:snapshot forKey:InterpreterSnapshotKey];
 }
 
 - (NSDictionary *)stateAsPropertyList
@@ -107,16 +173,88 @@ InputCharResult InputCharResult_Waiting()
     _engine->restoreStateFromPropertyList(propertyList);
 }
 
+- (NSData *)stateAsData
+{
+    return _engine->stateAsData();
+}
+
+- (BOOL)restoreStateFromData:(NSData *)data
+{
+    return _engine->restoreStateFromData(data);
+}
+
+- (NSString *)takeProgramChangesWithLowLineNumber:(InterpreterLineNumber *)lowLineNumber
+                                   highLineNumber:(InterpreterLineNumber *)highLineNumber
+{
+    auto low = Number{0};
+    auto high = Number{0};
+    auto text = string{};
+    if (!_engine->takeProgramChanges(low, high, text))
+    {
+        return nil;
+    }
+
+    *lowLineNumber = low;
+    *highLineNumber = high;
+    return [NSString stringWithUTF8String:text.c_str()];
+}
+
 - (void)runUntilEndOfInput
 {
     _engine->runUntilEndOfInput();
 }
 
+- (void)pushInputChars:(const Char *)chars length:(NSUInteger)length
+{
+    [self resumeIfWaiting:_engine->inputQueue().push(chars, length)];
+}
+
+- (void)pushInputString:(NSString *)string
+{
+    const char *chars = string.UTF8String;
+    [self pushInputChars:reinterpret_cast<const Char *>(chars) length:strlen(chars)];
+}
+
+- (void)pushEndOfInput
+{
+    [self resumeIfWaiting:_engine->inputQueue().pushEndOfInput()];
+}
+
+/// Call the inputAvailableHandler if a push found the engine waiting for input
+- (void)resumeIfWaiting:(BOOL)wasWaiting
+{
+    void (^handler)(Interpreter *) = self.inputAvailableHandler;
+    if (!wasWaiting || handler == nil)
+    {
+        return;
+    }
+
+    dispatch_queue_t queue = self.inputAvailableQueue ?: dispatch_get_main_queue();
+    __weak Interpreter *weakSelf = self;
+    dispatch_async(queue, ^{
+        Interpreter *interpreter = weakSelf;
+        if (interpreter)
+        {
+            handler(interpreter);
+        }
+    });
+}
+
 - (void)next
 {
     _engine->next();
 }
 
+- (InterpreterStopReason)runForStatementBudget:(NSUInteger)maxStatements
+{
+    return _engine->runForStatementBudget(maxStatements);
+}
+
+- (InterpreterStopReason)runForTimeBudget:(NSTimeInterval)seconds
+{
+    return _engine->runForTimeBudget(seconds);
+}
+
 - (InterpreterState)state
 {
     return _engine->state();
@@ -127,4 +265,19 @@ InputCharResult InputCharResult_Waiting()
     _engine->breakExecution();
 }
 
+- (void)requestBreak
+{
+    _engine->requestBreak();
+}
+
+- (NSArray *)profileReport
+{
+    return _engine->profileReport();
+}
+
+- (NSDictionary *)metrics
+{
+    return _engine->metricsReport();
+}
+
 @end
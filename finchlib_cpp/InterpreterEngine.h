@@ -26,6 +26,13 @@
 
 #import "Interpreter.h"
 #import "syntax.h"
+#import "bytecode.h"
+#import "inputqueue.h"
+#import "metrics.h"
+#import "jit.h"
+
+#include <atomic>
+#include <chrono>
 
 namespace finchlib_cpp
 {
@@ -48,14 +55,52 @@ struct InputLineResult
     static InputLineResult waiting() { return {InputResultKindWaiting}; }
 };
 
+/// Execution statistics for a program line, collected by the profiler
+struct LineProfile
+{
+    Number lineNumber;
+    unsigned long hits;
+    unsigned long gosubCalls;  // number of GOSUBs that targeted this line
+    std::chrono::steady_clock::duration time;
+};
+
 #pragma mark - InterpreterEngine
 
+/// Tiny BASIC interpreter
+///
+/// An engine is not itself thread-safe, but it shares no mutable state with
+/// other engines, so separate engines may run on separate threads at the same
+/// time.  Each engine must only be used by one thread at a time, and its
+/// InterpreterIO callbacks are made on that thread.  (Forks of an engine
+/// share only state that none of them changes.)
+///
+/// The exception is CLIPSAVE and CLIPLOAD, which use the system pasteboard.
+/// Programs that use them should be run on the main thread.
 class InterpreterEngine
 {
 public:
     /// Constructor
     InterpreterEngine(Interpreter *interpreter);
 
+    /// Construct a fork of another engine, for a different Interpreter
+    ///
+    /// The fork starts with a copy of the parent's program, variables,
+    /// array, and execution state.  The program, its compiled code, and the
+    /// array pages are shared until one of the engines changes them, so
+    /// forking a large program is cheap.  Input that the parent has read
+    /// but not used, profiling statistics, and metrics are not copied.
+    ///
+    /// The fork's RND() continues from the parent's state on a stream
+    /// selected by `forkIndex`, so forks with different indexes get
+    /// different numbers, and a fork gets the same numbers each time it
+    /// is made with the same index.  None of them repeats the parent's
+    /// numbers.
+    ///
+    /// The parent is changed only to mark its program and array pages as
+    /// shared.  An engine that has not been used since it was last forked
+    /// may be forked on several threads at once.
+    InterpreterEngine(Interpreter *interpreter, InterpreterEngine &parent, uint64_t forkIndex);
+
     /// Return the state of the interpreter as a property-list dictionary.
     ///
     /// This property list can be used to restore interpreter state
@@ -65,6 +110,36 @@ public:
     /// Set interpreter's properties using archived state produced by stateAsPropertyList()'
     void restoreStateFromPropertyList(NSDictionary *propertyList);
 
+    /// Return the state of the interpreter as a compact binary snapshot.
+    ///
+    /// Unlike the property list, the snapshot holds the program in its
+    /// parsed form, so it can be restored without parsing.
+    NSData *stateAsData();
+
+    /// Set interpreter's properties using a snapshot produced by stateAsData()
+    ///
+    /// Returns false, leaving the interpreter unchanged, if the data is not
+    /// a valid snapshot of a supported version.
+    bool restoreStateFromData(NSData *data);
+
+    /// Write the snapshot returned by stateAsData()
+    void writeSnapshot(SnapshotWriter &w);
+
+    /// Read a snapshot written by writeSnapshot()
+    ///
+    /// Returns false, leaving the interpreter unchanged, if the snapshot is
+    /// not valid.
+    bool readSnapshot(SnapshotReader &r);
+
+    /// Get the part of the program that has changed since the last call
+    ///
+    /// Returns false if no line has been added, replaced, or deleted.
+    /// Otherwise sets `lowLineNumber` and `highLineNumber` to the range of
+    /// line numbers that may have changed, and `text` to the listing of the
+    /// lines now in that range.
+    bool takeProgramChanges(Number &lowLineNumber, Number &highLineNumber,
+                            string &text);
+
     /// Display prompt and read input lines and interpret them until end of input.
     ///
     /// This method should only be used when `InterpreterIO.getInputChar()`
@@ -78,12 +153,40 @@ public:
     /// in a loop.
     void next();
 
+    /// Perform up to the specified number of `next()` operations, returning
+    /// early if there is a reason to stop.
+    InterpreterStopReason runForStatementBudget(size_t maxStatements);
+
+    /// Perform `next()` operations until the specified time has elapsed,
+    /// returning early if there is a reason to stop.
+    InterpreterStopReason runForTimeBudget(NSTimeInterval seconds);
+
+    /// Return the queue through which the host can push input
+    ///
+    /// Unlike the engine's other members, the queue may be used from any
+    /// thread.
+    InputQueue &inputQueue() { return pushedInput; }
+
+    /// Return the engine's aggregate statistics, as a dictionary with the
+    /// `InterpreterMetrics...Key` keys
+    ///
+    /// Like `inputQueue()`, this may be called from any thread.
+    NSDictionary *metricsReport() const;
+
     /// Return interpreter state
     InterpreterState state();
 
     /// Halt running machine
     void breakExecution();
 
+    /// Have the engine call breakExecution() at the start of the next line
+    /// of the running program, or before its next operation if no program
+    /// is running
+    ///
+    /// Like `inputQueue()`, this may be called from any thread, such as
+    /// while `runUntilEndOfInput()` runs a program that does not end.
+    void requestBreak() { isBreakRequested.store(true, std::memory_order_relaxed); }
+
     /// Execute a PRINT statement with arguments
     void PRINT(const PrintList &printList);
 
@@ -127,6 +230,16 @@ public:
     /// Execute a DIM statement
     void DIM(const Expression &expr);
 
+    /// Execute a RANDOMIZE statement
+    void RANDOMIZE(const Expression &expr);
+
+    /// Execute a FILL statement
+    void FILL(const Expression &first, const Expression &count, const Expression &value);
+
+    /// Execute a COPY statement
+    void COPY(const Expression &source, const Expression &destination,
+              const Expression &count);
+
     /// Execute a SAVE statement
     void SAVE(const string &filename);
 
@@ -148,6 +261,16 @@ public:
     /// Execute a TROFF statement
     void TROFF();
 
+    /// Execute a PROFILE statement
+    void PROFILE();
+
+    /// Execute an UNPROFILE statement
+    void UNPROFILE();
+
+    /// Return the statistics collected by the profiler, as an array of
+    /// dictionaries sorted by descending time
+    NSArray *profileReport();
+
     /// Evaluate an expression
     Number evaluate(const Expression &expr);
 
@@ -171,41 +294,175 @@ private:
     VariableBindings v;
 
     /// Array of numbers, addressable using the syntax "@(i)"
-    Numbers a;
+    ArrayStore a;
+
+    /// Generator for RND()
+    RandomGenerator rng;
+
+    /// Number of forks made by the Interpreter, used as their fork indexes
+    std::atomic<uint64_t> forkCount{0};
 
     /// Characters that have been read from input but not yet been returned by
     /// readInputLine()
     InputLine inputLineBuffer;
 
+    /// Characters received from `getInputChars:maxLength:count:forInterpreter:`
+    /// that have not yet been added to inputLineBuffer
+    ///
+    /// Only the characters starting at pendingInputStart are pending.
+    vec<Char> pendingInput;
+    size_t pendingInputStart{0};
+
+    /// Input pushed by the host
+    ///
+    /// Once anything has been pushed, input is read only from here, and not
+    /// from the InterpreterIO object.
+    InputQueue pushedInput;
+
+    /// Statistics that can be read from any thread
+    EngineMetrics metrics;
+
+    /// Signpost interval for a running program
+    Signpost runSignpost;
+
+    /// Characters that have been written but not yet sent to the
+    /// InterpreterIO object
+    vec<Char> outputBuffer;
+
     /// Array of program lines
-    Program program;
+    ///
+    /// Forks share the lines until one of the engines changes its program,
+    /// which then gets its own copy, as with the pages of the array.  The
+    /// program is changed only through writableProgram() and
+    /// replaceProgram().
+    sptr<const Program> program;
+
+    /// The program, if no other engine shares it, or nullptr
+    Program *exclusiveProgram{nullptr};
 
     /// Index of currently executing line in program
     size_t programIndex{0};
 
+    /// Incremented whenever a line is added to or removed from the program
+    unsigned long programVersion{1};
+
+    /// Lowest and highest numbers of the lines that have been added,
+    /// replaced, or deleted since takeProgramChanges() was last called
+    ///
+    /// There are no changes if the lowest is greater than the highest.
+    Number lowestChangedLineNumber{numeric_limits<Number>::max()};
+    Number highestChangedLineNumber{numeric_limits<Number>::min()};
+
+    /// Compiled form of the program
+    ///
+    /// The code is never changed once compiled, so forks of the engine
+    /// share it.
+    sptr<const Bytecode> bytecode{make_shared<const Bytecode>()};
+
+    /// Value of programVersion when bytecode was compiled
+    unsigned long bytecodeVersion{0};
+
+#if FINCHLIB_JIT
+    /// Native code for hot lines of the bytecode
+    NativeTier nativeTier;
+#endif
+
+    /// Map from line number to index in program, used by GOTO and GOSUB
+    unordered_map<Number, size_t> lineIndexes;
+
+    /// Value of programVersion when lineIndexes was built
+    unsigned long lineIndexesVersion{0};
+
+    /// Stack used to evaluate expressions in compiled code
+    Numbers evaluationStack;
+
     /// Return stack used by GOSUB/RETURN
     ReturnStack returnStack;
 
     /// If true, print line numbers while program runs
     bool isTraceOn{false};
 
+    /// If true, collect execution statistics while program runs
+    bool isProfiling{false};
+
+    /// Statistics collected by the profiler, one element per program line
+    vec<LineProfile> lineProfiles;
+
+    /// Value of programVersion when lineProfiles was last matched to the
+    /// program
+    unsigned long lineProfilesVersion{0};
+
     /// If true, have encountered EOF while processing input
     bool hasReachedEndOfInput{false};
 
+    /// If true, the last attempt to read input returned `Waiting`
+    bool isWaitingForInput{false};
+
+    /// Set by breakExecution(), so that a time slice can report it
+    bool hasBreakOccurred{false};
+
+    /// Set by requestBreak(), and checked between lines by both the
+    /// interpreter and native code
+    std::atomic<bool> isBreakRequested{false};
+
     /// Lvalues being read by current INPUT statement
     Lvalues inputLvalues;
 
+    /// Arena holding inputLvalues nodes, if they are not part of the program
+    sptr<NodeArena> inputLvaluesArena;
+
     /// State that interpreter was in when INPUT was called
     InterpreterState stateBeforeInput{InterpreterStateIdle};
 
+    /// Line most recently read by INPUT
+    ///
+    /// If the line has more values than the INPUT statement reads, those
+    /// following inputValuesIndex are used by the next INPUT statements of the
+    /// running program before another line is read.
+    InputLine inputValues;
+    size_t inputValuesIndex{0};
+
+    /// Buffer used by SAVE to build the program listing
+    string saveBuffer;
+
 #pragma mark - Private methods
 
     /// Return the entire program listing as a single String
     string programAsString();
 
+    /// Append the listing of the program lines with numbers in the specified
+    /// range to a string
+    void appendProgramText(string &s,
+                           Number lowLineNumber = numeric_limits<Number>::min(),
+                           Number highLineNumber = numeric_limits<Number>::max());
+
+    /// Record that the lines with numbers in the specified range have changed
+    void markProgramChanged(Number lowLineNumber, Number highLineNumber);
+
+    /// Record that any line of the program may have changed
+    void markProgramChanged();
+
     /// Interpret a string
     void interpretString(const string &s);
 
+    /// Interpret a buffer containing lines of text
+    ///
+    /// Numbered lines are added to the program in batches rather than
+    /// one at a time.
+    void interpretText(const char *text, size_t length);
+
+    /// Interpret a buffer containing lines of text, parsing the lines on
+    /// several threads
+    ///
+    /// Returns false, having done nothing, if any non-empty line of the
+    /// text does not start with a line number.  Such a line could be an
+    /// immediate statement, so the text has to be parsed one line at a time.
+    bool interpretTextInParallel(const char *text, size_t length);
+
+    /// Interpret a line parsed by interpretText(), adding a numbered
+    /// statement to `numberedLines`
+    void interpretLine(const struct Line &line, vec<NumberedStatement> &numberedLines);
+
     /// Set values of all variables and array elements to zero
     void clearVariablesAndArray();
 
@@ -218,26 +475,84 @@ private:
     /// Parse an input line and execute it or add it to the program
     void processInput(const InputLine &input);
 
-    struct Line parseInputLine(const InputLine &input);
+    /// Execute a parsed line or add it to the program
+    void processLine(const struct Line &line);
+
+    /// Parse an input line, recording the time taken
+    ///
+    /// A numbered statement's nodes go in `programArena`, or in a new arena
+    /// of their own if that is null.
+    struct Line parseInputLine(const InputLine &input, const sptr<NodeArena> &programArena);
 
-    void insertLineIntoProgram(Number lineNumber, Statement statement);
+    void insertLineIntoProgram(NumberedStatement line);
 
     /// Delete the line with the specified number from the program.
     ///
     /// No effect if there is no such line.
     void deleteLineFromProgram(Number lineNumber);
 
-    Program::iterator programLineWithNumber(Number lineNumber);
+    /// Add lines to the program, replacing any existing lines with the same
+    /// numbers, and leave `lines` empty
+    void mergeLinesIntoProgram(vec<NumberedStatement> &lines);
 
-    /// Return line number of the last line in the program.
+    /// Copy the nodes of the program into one arena, if most of the memory
+    /// of its arenas is used by lines that are no longer in it
     ///
-    /// Returns 0 if there is no program.
-    Number getLastProgramLineNumber();
+    /// The program must not be shared with a fork.
+    void compactProgramArenas();
+
+    /// Return the program for changing, copying it first if it is shared
+    /// with a fork
+    Program &writableProgram();
+
+    /// Replace the program with `lines`, which must be sorted by line number
+    void replaceProgram(Program lines);
+
+    Program::const_iterator programLineWithNumber(Number lineNumber);
+
+    /// Return iterator to the first program line whose number is not less
+    /// than the specified line number.
+    ///
+    /// Uses a binary search, as the program is sorted by line number.
+    Program::const_iterator programLineAtOrAfter(Number lineNumber);
 
     void execute(Statement s);
 
+    /// Perform the next operation, and return the number of operations done
+    ///
+    /// If a program is running, up to `maxProgramLines` of its lines may be
+    /// executed, with the same effect as that many calls to `next()`.
+    size_t advance(size_t maxProgramLines);
+
+    /// Execute at least one and at most `maxLines` lines of the running
+    /// program, stopping early if the program stops running, and return the
+    /// number of lines executed
+    size_t executeProgramLines(size_t maxLines);
+
     void executeNextProgramStatement();
 
+    /// Execute the compiled code for the program line at the specified index
+    void executeCompiledLine(size_t lineIndex);
+
+    /// Execute the compiled code for the program line at the specified
+    /// index, and record its statistics in lineProfiles
+    void executeProfiledLine(size_t lineIndex);
+
+    /// Make lineProfiles have one element for each program line, keeping
+    /// the statistics of lines that are still in the program
+    void updateLineProfiles();
+
+    /// Return the profiles of lines that have been executed, sorted by
+    /// descending time
+    vec<LineProfile> sortedLineProfiles();
+
+    /// Continue execution at the line with the specified number
+    void gotoLineNumber(Number lineNumber);
+
+    /// Save return address and continue execution at the line with the
+    /// specified number
+    void gosubLineNumber(Number lineNumber);
+
     /// Display error message and stop running
     ///
     /// Call this method if an unrecoverable error happens while executing a
@@ -253,9 +568,15 @@ private:
     /// Send string to the output stream
     void writeOutput(const string &s);
 
+    /// Send characters to the output stream
+    void writeOutput(const Char *chars, size_t count);
+
     /// Print an object that conforms to the PrintTextProvider protocol
     void writeOutput(const PrintTextProvider &p);
 
+    /// Send any buffered output to the InterpreterIO object
+    void flushOutput();
+
     /// Display error message
     void showError(const string &message);
 
@@ -272,6 +593,14 @@ private:
     /// input.
     InputLineResult readInputLine();
 
+    /// Read a line using the bulk-input method of the InterpreterIO interface,
+    /// or from the pushed input once the host has used it
+    InputLineResult readBufferedInputLine();
+
+    /// Add input characters to inputLineBuffer, converting tabs to spaces and
+    /// dropping other non-graphic characters
+    void appendToInputLineBuffer(const Char *begin, const Char *end);
+
     /// Get a line of input, using specified function to retrieve characters.
     ///
     /// Result does not include any non-graphic characters that were in the input
@@ -286,8 +615,24 @@ private:
     /// following a .Waiting result from readInputLine()
     void continueInput();
 
+    /// Perform `next()` operations until `maxSteps` have been done, the
+    /// deadline (if any) has passed, or there is a reason to stop
+    InterpreterStopReason runWithBudget(size_t maxSteps,
+                                        const std::chrono::steady_clock::time_point *deadline);
+
     /// Display error message to user during an INPUT operation
     void showInputHelpMessage();
+
+    /// Discard the lvalues of a completed or aborted INPUT operation
+    void finishInput();
+
+    /// Return true if values are left over from the line read by a previous
+    /// INPUT statement
+    bool hasInputValues() const;
+
+    /// Discard any values left over from the line read by a previous INPUT
+    /// statement
+    void discardInputValues();
 };
 
 }  // namespace finchlib_cpp
@@ -24,7 +24,12 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "InterpreterEngine.h"
 #include "parse.h"
 #include "pasteboard.h"
+#include "snapshot.h"
 
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <unordered_set>
 #include <unistd.h>
 #include <dirent.h>
 
@@ -34,6 +39,7 @@ static NSString *VariablesKey = @"variables";
 static NSString *ArrayCountKey = @"arrayCount";
 static NSString *ArrayValuesKey = @"arrayValues";
 static NSString *InputLineBufferKey = @"inputLineBuffer";
+static NSString *PendingInputKey = @"pendingInput";
 static NSString *ProgramKey = @"program";
 static NSString *ProgramIndexKey = @"programIndex";
 static NSString *ReturnStackKey = @"returnStack";
@@ -41,6 +47,18 @@ static NSString *IsTraceOnKey = @"isTraceOn";
 static NSString *HasReachedEndOfInputKey = @"hasReachedEndOfInput";
 static NSString *InputLvaluesKey = @"inputLvalues";
 static NSString *StateBeforeInputKey = @"stateBeforeInput";
+static NSString *InputValuesKey = @"inputValues";
+static NSString *RandomStateKey = @"randomState";
+static NSString *RandomIncrementKey = @"randomIncrement";
+
+// Header of a binary snapshot
+//
+// SnapshotVersion must be incremented whenever the format changes.  The
+// byte-order mark and the size of a Number identify snapshots produced on
+// an incompatible host.
+static const char SnapshotMagic[4] = {'F', 'B', 'S', 'N'};
+static const uint32_t SnapshotVersion = 4;
+static const uint32_t SnapshotByteOrderMark = 0x01020304;
 
 
 namespace finchlib_cpp
@@ -70,14 +88,21 @@ struct Line
     Statement statement;
     string errorMessage;
 
-    static Line numberedStatement(Number n, Statement s)
+    /// Arena holding the nodes of the statement
+    sptr<NodeArena> arena;
+
+    /// Number of bytes of the arena used by the nodes of the statement
+    size_t nodeBytes;
+
+    static Line numberedStatement(Number n, Statement s, sptr<NodeArena> arena,
+                                  size_t nodeBytes)
     {
-        return {LineKind::NumberedStatement, n, s};
+        return {LineKind::NumberedStatement, n, s, "", arena, nodeBytes};
     }
 
-    static Line unnumberedStatement(Statement s)
+    static Line unnumberedStatement(Statement s, sptr<NodeArena> arena)
     {
-        return {LineKind::UnnumberedStatement, 0, s};
+        return {LineKind::UnnumberedStatement, 0, s, "", arena, 0};
     }
 
     static Line empty()
@@ -96,16 +121,76 @@ struct Line
     }
 };
 
+static Line parseLine(const InputLine &input, const sptr<NodeArena> &programArena);
+
+/// Return 64 unpredictable bits, for seeding a RandomGenerator
+static uint64_t randomSeed()
+{
+    return (static_cast<uint64_t>(arc4random()) << 32) | arc4random();
+}
+
 #pragma mark - InterpreterEngine
 
 InterpreterEngine::InterpreterEngine(Interpreter *interp)
     : interpreter{interp}, a(1024)
 {
     clearVariablesAndArray();
+    replaceProgram({});
+
+    // Each engine starts on its own stream, at an unpredictable point,
+    // until RANDOMIZE is used.
+    rng.seed(randomSeed(), randomSeed());
+}
+
+/// Return the RND() stream selector of a fork
+///
+/// The index is scrambled, so that the streams of a parent's forks are
+/// far apart from each other and from the parent's own.
+static uint64_t forkStream(const RandomGenerator &parent, uint64_t forkIndex)
+{
+    return (parent.incrementValue() >> 1) ^ ((forkIndex + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+InterpreterEngine::InterpreterEngine(Interpreter *interp, InterpreterEngine &parent,
+                                     uint64_t forkIndex)
+    : interpreter{interp},
+      st{parent.st},
+      v(parent.v),
+      a(parent.a.fork()),
+      rng(parent.rng.stateValue(), forkStream(parent.rng, forkIndex)),
+      program(parent.program),
+      programIndex{parent.programIndex},
+      programVersion{parent.programVersion},
+      lowestChangedLineNumber{parent.lowestChangedLineNumber},
+      highestChangedLineNumber{parent.highestChangedLineNumber},
+      bytecode{parent.bytecode},
+      bytecodeVersion{parent.bytecodeVersion},
+      evaluationStack(parent.evaluationStack.size()),
+      returnStack(parent.returnStack),
+      isTraceOn{parent.isTraceOn},
+      isProfiling{parent.isProfiling},
+      inputLvalues(parent.inputLvalues),
+      inputLvaluesArena{parent.inputLvaluesArena},
+      stateBeforeInput{parent.stateBeforeInput},
+      inputValues(parent.inputValues),
+      inputValuesIndex{parent.inputValuesIndex}
+{
+    // Neither engine may change the shared program from now on.  As with
+    // the array pages, this is written only if it is set, so that several
+    // threads can fork the parent at once.
+    if (parent.exclusiveProgram != nullptr)
+    {
+        parent.exclusiveProgram = nullptr;
+    }
 }
 
 NSDictionary *InterpreterEngine::stateAsPropertyList()
 {
+    const ScopedSignpost signpost{SignpostName::Archive};
+
+    // Output written before the state is saved should not be lost
+    flushOutput();
+
     auto dict = [NSMutableDictionary dictionary];
 
     // state
@@ -115,12 +200,11 @@ NSDictionary *InterpreterEngine::stateAsPropertyList()
     //
     // We encode only the non-zero values
     auto vValues = [NSMutableDictionary dictionary];
-    for (const auto &i : v)
+    for (VariableName varname = 'A'; varname <= 'Z'; ++varname)
     {
-        auto value = i.second;
+        auto value = v[varname];
         if (value != 0)
         {
-            auto varname = i.first;
             vValues[@(varname)] = @(value);
         }
     }
@@ -129,15 +213,25 @@ NSDictionary *InterpreterEngine::stateAsPropertyList()
     // a
     //
     // To encode the (probably sparse) array, we note the size and then
-    // save only the non-zero values
+    // save only the non-zero values.  Pages that have never been written
+    // are all zeros, so they are skipped without looking at them.
     dict[ArrayCountKey] = @(a.size());
     auto aValues = [NSMutableDictionary dictionary];
-    for (auto i = 0; i < a.size(); ++i)
+    for (size_t pageIndex = 0; pageIndex < a.pageCount(); ++pageIndex)
     {
-        auto value = a[i];
-        if (value != 0)
+        const auto page = a.page(pageIndex);
+        if (!page)
         {
-            aValues[@(i)] = @(value);
+            continue;
+        }
+        const auto first = pageIndex * ArrayStore::PageSize;
+        const auto length = a.pageLength(pageIndex);
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (page[i] != 0)
+            {
+                aValues[@(first + i)] = @(page[i]);
+            }
         }
     }
     dict[ArrayValuesKey] = aValues;
@@ -147,6 +241,11 @@ NSDictionary *InterpreterEngine::stateAsPropertyList()
                                         length:inputLineBuffer.size()];
     dict[InputLineBufferKey] = inputLineData;
 
+    // pendingInput
+    auto pendingInputData = [NSData dataWithBytes:pendingInput.data() + pendingInputStart
+                                           length:pendingInput.size() - pendingInputStart];
+    dict[PendingInputKey] = pendingInputData;
+
     // program
     auto programText = [NSString stringWithUTF8String:programAsString().c_str()];
     dict[ProgramKey] = programText;
@@ -172,11 +271,21 @@ NSDictionary *InterpreterEngine::stateAsPropertyList()
     // stateBeforeInput
     dict[StateBeforeInputKey] = @(stateBeforeInput);
 
+    // inputValues
+    dict[InputValuesKey] = [NSData dataWithBytes:inputValues.data() + inputValuesIndex
+                                          length:inputValues.size() - inputValuesIndex];
+
+    // rng
+    dict[RandomStateKey] = @(rng.stateValue());
+    dict[RandomIncrementKey] = @(rng.incrementValue());
+
     return dict;
 }
 
 void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
 {
+    const ScopedSignpost signpost{SignpostName::Restore};
+
     // Note: The "simple" elements like `state`, `hasReachedEndOfInput`, etc. are restored
     // after restoring the more complex elements, which may themselves make changes
     // to those simple members as part of their restoration process.
@@ -186,8 +295,9 @@ void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
     if ([vValues isKindOfClass:[NSDictionary class]])
     {
         [vValues enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
-            if ([key isKindOfClass:[NSNumber class]] && [value isKindOfClass:[NSNumber class]]) {
-                v[[key unsignedCharValue]] = [value intValue];
+            if ([key isKindOfClass:[NSNumber class]] && [value isKindOfClass:[NSNumber class]]
+                && 'A' <= [key unsignedCharValue] && [key unsignedCharValue] <= 'Z') {
+                v[[key unsignedCharValue]] = static_cast<Number>([value longLongValue]);
             }
             else {
                 assert(false);
@@ -201,17 +311,19 @@ void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
 
     // a
     NSNumber *arraySize = dict[ArrayCountKey];
-    if ([arraySize isKindOfClass:[NSNumber class]])
+    if ([arraySize isKindOfClass:[NSNumber class]]
+        && arraySize.unsignedIntegerValue <= static_cast<NSUInteger>(numeric_limits<Number>::max()))
     {
-        a.resize(arraySize.unsignedIntegerValue);
-        fill(begin(a), end(a), 0);
+        a.reset(arraySize.unsignedIntegerValue);
 
         NSDictionary *aValues = dict[ArrayValuesKey];
         if ([aValues isKindOfClass:[NSDictionary class]])
         {
             [aValues enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
-                if ([key isKindOfClass:[NSNumber class]] && [value isKindOfClass:[NSNumber class]]) {
-                    a[[key unsignedIntegerValue]] = [value intValue];
+                if ([key isKindOfClass:[NSNumber class]] && [value isKindOfClass:[NSNumber class]]
+                    && [key unsignedIntegerValue] < a.size()) {
+                    a.setAt([key unsignedIntegerValue],
+                            static_cast<Number>([value longLongValue]));
                 }
                 else {
                     assert(false);
@@ -237,11 +349,25 @@ void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
         assert(false);
     }
 
+    // pendingInput
+    //
+    // This is optional, as it is not present in state saved by older versions.
+    pendingInput.clear();
+    pendingInputStart = 0;
+    NSData *pendingInputData = dict[PendingInputKey];
+    if ([pendingInputData isKindOfClass:[NSData class]])
+    {
+        const auto length = pendingInputData.length;
+        pendingInput.resize(length);
+        [pendingInputData getBytes:pendingInput.data() length:length];
+    }
+
     // program
     NSString *programText = dict[ProgramKey];
     if ([programText isKindOfClass:[NSString class]])
     {
         interpretString(programText.UTF8String);
+        markProgramChanged();
     }
     else
     {
@@ -263,6 +389,8 @@ void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
     NSArray *lvalues = dict[InputLvaluesKey];
     if ([lvalues isKindOfClass:[NSArray class]])
     {
+        inputLvaluesArena = make_shared<NodeArena>();
+        NodeArena::Scope scope{*inputLvaluesArena};
         for (NSString *lvText in lvalues)
         {
             if ([lvText isKindOfClass:[NSString class]])
@@ -321,6 +449,29 @@ void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
         assert(false);
     }
 
+    // inputValues
+    //
+    // This is optional, as it is not present in state saved by older versions.
+    discardInputValues();
+    NSData *inputValuesData = dict[InputValuesKey];
+    if ([inputValuesData isKindOfClass:[NSData class]])
+    {
+        const auto length = inputValuesData.length;
+        inputValues.resize(length);
+        [inputValuesData getBytes:inputValues.data() length:length];
+    }
+
+    // rng
+    //
+    // Property lists saved by older versions do not have these, and then
+    // the generator keeps its current state.
+    NSNumber *randomState = dict[RandomStateKey];
+    NSNumber *randomIncrement = dict[RandomIncrementKey];
+    if ([randomState isKindOfClass:[NSNumber class]] && [randomIncrement isKindOfClass:[NSNumber class]])
+    {
+        rng.restore(randomState.unsignedLongLongValue, randomIncrement.unsignedLongLongValue);
+    }
+
     // state
     NSNumber *state = dict[StateKey];
     if ([state isKindOfClass:[NSNumber class]])
@@ -333,54 +484,514 @@ void InterpreterEngine::restoreStateFromPropertyList(NSDictionary *dict)
     }
 }
 
+NSData *InterpreterEngine::stateAsData()
+{
+    const ScopedSignpost signpost{SignpostName::Archive};
+
+    // Output written before the state is saved should not be lost
+    flushOutput();
+
+    auto w = SnapshotWriter{};
+    writeSnapshot(w);
+    return [NSData dataWithBytes:w.bytes.data() length:w.bytes.size()];
+}
+
+bool InterpreterEngine::restoreStateFromData(NSData *data)
+{
+    const ScopedSignpost signpost{SignpostName::Restore};
+    auto r = SnapshotReader{data.bytes, data.length};
+    return readSnapshot(r);
+}
+
+void InterpreterEngine::writeSnapshot(SnapshotWriter &w)
+{
+    w.writeBytes(SnapshotMagic, sizeof(SnapshotMagic));
+    w.write(SnapshotVersion);
+    w.write(SnapshotByteOrderMark);
+    w.write(static_cast<uint8_t>(sizeof(Number)));
+
+    w.write(static_cast<int32_t>(st));
+
+    for (VariableName varname = 'A'; varname <= 'Z'; ++varname)
+    {
+        w.write(v[varname]);
+    }
+
+    // Only the pages of the array that have been written are stored
+    w.writeCount(a.size());
+    size_t writtenPages = 0;
+    for (size_t pageIndex = 0; pageIndex < a.pageCount(); ++pageIndex)
+    {
+        writtenPages += a.page(pageIndex) != nullptr;
+    }
+    w.writeCount(writtenPages);
+    for (size_t pageIndex = 0; pageIndex < a.pageCount(); ++pageIndex)
+    {
+        if (const auto page = a.page(pageIndex))
+        {
+            w.writeCount(pageIndex);
+            w.writeBytes(page, a.pageLength(pageIndex) * sizeof(Number));
+        }
+    }
+
+    w.writeChars(inputLineBuffer.data(), inputLineBuffer.size());
+    w.writeChars(pendingInput.data() + pendingInputStart,
+                 pendingInput.size() - pendingInputStart);
+
+    w.writeCount(program->size());
+    for (const auto &line : *program)
+    {
+        w.write(line.lineNumber);
+        line.statement.writeSnapshot(w);
+    }
+    w.write(static_cast<uint64_t>(programIndex));
+
+    w.writeCount(returnStack.size());
+    for (const auto returnIndex : returnStack)
+    {
+        w.write(static_cast<uint64_t>(returnIndex));
+    }
+
+    w.writeCount(inputLvalues.size());
+    for (const auto &lv : inputLvalues)
+    {
+        lv.writeSnapshot(w);
+    }
+
+    w.write(static_cast<uint8_t>(isTraceOn));
+    w.write(static_cast<uint8_t>(hasReachedEndOfInput));
+    w.write(static_cast<int32_t>(stateBeforeInput));
+    w.writeChars(inputValues.data() + inputValuesIndex, inputValues.size() - inputValuesIndex);
+
+    w.write(rng.stateValue());
+    w.write(rng.incrementValue());
+}
+
+/// Return true if the value is one of the InterpreterState values
+static bool isValidState(int32_t value)
+{
+    return InterpreterStateIdle <= value && value <= InterpreterStateReadingInput;
+}
+
+bool InterpreterEngine::readSnapshot(SnapshotReader &r)
+{
+    // Everything is read into local variables, and the interpreter's
+    // members are changed only if the whole snapshot is valid.
+
+    char magic[sizeof(SnapshotMagic)] = {};
+    r.readBytes(magic, sizeof(magic));
+    if (memcmp(magic, SnapshotMagic, sizeof(magic)) != 0 ||
+        r.read<uint32_t>() != SnapshotVersion ||
+        r.read<uint32_t>() != SnapshotByteOrderMark ||
+        r.read<uint8_t>() != sizeof(Number))
+    {
+        return false;
+    }
+
+    const auto newState = r.read<int32_t>();
+
+    auto newV = VariableBindings{};
+    for (VariableName varname = 'A'; varname <= 'Z'; ++varname)
+    {
+        newV[varname] = r.read<Number>();
+    }
+
+    auto newA = ArrayStore{};
+    const auto arrayCount = r.read<uint64_t>();
+    if (arrayCount > static_cast<uint64_t>(numeric_limits<Number>::max()))
+    {
+        return false;
+    }
+    newA.reset(static_cast<size_t>(arrayCount));
+    const auto writtenPages = r.readCount(sizeof(uint64_t));
+    size_t firstUnreadPage = 0;  // pages are stored in ascending order
+    for (size_t i = 0; i < writtenPages && !r.failed(); ++i)
+    {
+        const auto pageIndex = r.read<uint64_t>();
+        if (pageIndex < firstUnreadPage || pageIndex >= newA.pageCount())
+        {
+            return false;
+        }
+        firstUnreadPage = static_cast<size_t>(pageIndex) + 1;
+        r.readBytes(newA.writablePage(static_cast<size_t>(pageIndex)),
+                    newA.pageLength(static_cast<size_t>(pageIndex)) * sizeof(Number));
+    }
+
+    auto newInputLineBuffer = InputLine{};
+    r.readChars(newInputLineBuffer);
+    auto newPendingInput = vec<Char>{};
+    r.readChars(newPendingInput);
+
+    auto newProgram = Program{};
+    const auto newProgramArena = make_shared<NodeArena>();
+    auto newInputLvaluesArena = make_shared<NodeArena>();
+    auto newInputLvalues = Lvalues{};
+
+    // Each line occupies at least a line number and a statement tag
+    const auto lineCount = r.readCount(sizeof(Number) + 1);
+    newProgram.reserve(lineCount);
+    for (size_t i = 0; i < lineCount; ++i)
+    {
+        const auto lineNumber = r.read<Number>();
+        NodeArena::Scope scope{*newProgramArena};
+        const auto bytesBefore = newProgramArena->bytesUsed();
+        const auto statement = Statement::readSnapshot(r);
+
+        // The program must be sorted by line number
+        if (!newProgram.empty() && newProgram.back().lineNumber >= lineNumber)
+        {
+            r.fail();
+        }
+        newProgram.emplace_back(lineNumber, statement, newProgramArena,
+                                newProgramArena->bytesUsed() - bytesBefore);
+    }
+
+    const auto newProgramIndex = r.read<uint64_t>();
+
+    auto newReturnStack = ReturnStack(r.readCount(sizeof(uint64_t)));
+    for (auto &returnIndex : newReturnStack)
+    {
+        returnIndex = static_cast<size_t>(r.read<uint64_t>());
+    }
+
+    {
+        NodeArena::Scope scope{*newInputLvaluesArena};
+
+        // Each lvalue occupies at least two bytes
+        const auto lvalueCount = r.readCount(2);
+        newInputLvalues.reserve(lvalueCount);
+        for (size_t i = 0; i < lvalueCount; ++i)
+        {
+            newInputLvalues.push_back(Lvalue::readSnapshot(r));
+        }
+    }
+
+    const auto newIsTraceOn = r.read<uint8_t>() != 0;
+    const auto newHasReachedEndOfInput = r.read<uint8_t>() != 0;
+    const auto newStateBeforeInput = r.read<int32_t>();
+    auto newInputValues = InputLine{};
+    r.readChars(newInputValues);
+
+    const auto newRandomState = r.read<uint64_t>();
+    const auto newRandomIncrement = r.read<uint64_t>();
+
+    if (r.failed() || !r.atEnd() ||
+        !isValidState(newState) || !isValidState(newStateBeforeInput) ||
+        newProgramIndex > newProgram.size())
+    {
+        return false;
+    }
+
+    st = static_cast<InterpreterState>(newState);
+    v = newV;
+    a.swap(newA);
+    inputLineBuffer.swap(newInputLineBuffer);
+    pendingInput.swap(newPendingInput);
+    pendingInputStart = 0;
+    replaceProgram(std::move(newProgram));
+    ++programVersion;
+    markProgramChanged();
+    programIndex = static_cast<size_t>(newProgramIndex);
+    returnStack.swap(newReturnStack);
+    inputLvalues.swap(newInputLvalues);
+    inputLvaluesArena = newInputLvaluesArena;
+    isTraceOn = newIsTraceOn;
+    hasReachedEndOfInput = newHasReachedEndOfInput;
+    stateBeforeInput = static_cast<InterpreterState>(newStateBeforeInput);
+    inputValues.swap(newInputValues);
+    inputValuesIndex = 0;
+    rng.restore(newRandomState, newRandomIncrement);
+
+    return true;
+}
+
 string InterpreterEngine::programAsString()
 {
-    auto s = ostringstream{};
-    for (const auto &line : program)
+    auto s = string{};
+    appendProgramText(s);
+    return s;
+}
+
+void InterpreterEngine::appendProgramText(string &s,
+                                          Number lowLineNumber,
+                                          Number highLineNumber)
+{
+    for (auto it = programLineAtOrAfter(lowLineNumber);
+         it != program->end() && it->lineNumber <= highLineNumber;
+         ++it)
+    {
+        s += it->lineText();
+    }
+}
+
+bool InterpreterEngine::takeProgramChanges(Number &lowLineNumber,
+                                           Number &highLineNumber,
+                                           string &text)
+{
+    if (lowestChangedLineNumber > highestChangedLineNumber)
     {
-        s << line.lineNumber << " " << line.statement.listText() << "\n";
+        return false;
     }
 
-    return s.str();
+    lowLineNumber = lowestChangedLineNumber;
+    highLineNumber = highestChangedLineNumber;
+    text.clear();
+    appendProgramText(text, lowLineNumber, highLineNumber);
+
+    lowestChangedLineNumber = numeric_limits<Number>::max();
+    highestChangedLineNumber = numeric_limits<Number>::min();
+    return true;
+}
+
+void InterpreterEngine::markProgramChanged(Number lowLineNumber,
+                                           Number highLineNumber)
+{
+    lowestChangedLineNumber = std::min(lowestChangedLineNumber, lowLineNumber);
+    highestChangedLineNumber = std::max(highestChangedLineNumber, highLineNumber);
+}
+
+void InterpreterEngine::markProgramChanged()
+{
+    markProgramChanged(numeric_limits<Number>::min(), numeric_limits<Number>::max());
 }
 
 void InterpreterEngine::interpretString(const string &s)
 {
-    auto index = size_t{0};
+    interpretText(s.data(), s.size());
+}
 
-    // Read lines until end-of-stream or error
-    auto keepGoing = bool{true};
-    do
+/// Return the end of the run of graphic characters (' ' through '~') that
+/// starts at `p`
+///
+/// Eight characters are tested at a time, using the carries of 64-bit
+/// arithmetic to find any byte of a word that is below ' ' or above '~'.
+/// The characters of a word that has one are then tested one at a time.
+static const Char *graphicRunEnd(const Char *p, const Char *end)
+{
+    const uint64_t ones = 0x0101010101010101;
+    const uint64_t highBits = 0x8080808080808080;
+    while (end - p >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        const auto below = (word - ones * ' ') & ~word & highBits;
+        const auto above = ((word + ones * (0x7f - '~')) | word) & highBits;
+        if ((below | above) != 0)
+        {
+            break;
+        }
+        p += 8;
+    }
+    while (p < end && ' ' <= *p && *p <= '~')
+    {
+        ++p;
+    }
+    return p;
+}
+
+/// Append characters to an input line, applying the same conversions as
+/// getInputLine()
+static void appendGraphicChars(InputLine &inputLine, const Char *begin, const Char *end)
+{
+    auto p = begin;
+    while (p < end)
     {
-        const auto inputLineResult = getInputLine([&]() -> InputCharResult
-                                                  {
-                                                          if (index >= s.length()) {
-                                                              return InputCharResult_EndOfStream();
-                                                          }
-                                                          else {
-                                                              return InputCharResult_Value(s[index++]);
-                                                          }
-        });
-
-        switch (inputLineResult.kind)
+        // Copy the run of graphic characters starting here in one step
+        const auto runEnd = graphicRunEnd(p, end);
+        inputLine.insert(inputLine.end(), p, runEnd);
+        if (runEnd == end)
         {
-            case InputResultKindValue:
-                processInput(inputLineResult.value);
-                break;
+            break;
+        }
 
-            case InputResultKindEndOfStream:
-                keepGoing = false;
-                break;
+        // Convert tabs to spaces, and drop other non-graphic characters
+        if (*runEnd == '\t')
+        {
+            inputLine.push_back(' ');
+        }
+        p = runEnd + 1;
+    }
+}
 
-            default:
-                // getInputLine() for file should only return Value or EndOfStream
-                assert(false);
-                keepGoing = false;
-                break;
+/// Append the characters of a line of text to an input line, applying the
+/// same conversions as getInputLine()
+static void appendInputLineChars(InputLine &inputLine, const char *begin, const char *end)
+{
+    appendGraphicChars(inputLine, reinterpret_cast<const Char *>(begin),
+                       reinterpret_cast<const Char *>(end));
+}
+
+// Text at least this long is parsed in parallel
+static const size_t ParallelParseMinimumLength = 64 * 1024;
+
+// Number of lines parsed by each task of a parallel parse
+static const size_t ParallelParseChunkLines = 1024;
+
+/// Lines parsed by one task of a parallel parse
+struct ParsedChunk
+{
+    /// The parsed lines, in source order
+    vec<Line> lines;
+
+    /// Arena holding the nodes of the numbered lines
+    sptr<NodeArena> arena;
+
+    /// Time taken to parse each line
+    DurationCounts parseTimes;
+};
+
+/// Return true if a line of text is empty or starts with a line number,
+/// ignoring the characters that appendInputLineChars() discards
+static bool isEmptyOrNumberedLineText(const char *begin, const char *end)
+{
+    for (auto p = begin; p < end; ++p)
+    {
+        const auto c = static_cast<Char>(*p);
+        if (c == ' ' || c == '\t' || c < ' ' || c > '~')
+        {
+            continue;
         }
-    } while (keepGoing);
+        return '0' <= c && c <= '9';
+    }
+    return true;
 }
 
+/// Input and results of a parallel parse, shared by its tasks
+struct ParallelParse
+{
+    /// Start and end of each line of text
+    vec<pair<const char *, const char *>> lineBounds;
+
+    /// Results, one element per task
+    vec<ParsedChunk> chunks;
+};
+
+/// Parse the lines of one chunk of a ParallelParse
+static void parseChunk(void *context, size_t chunkIndex)
+{
+    auto &parse = *static_cast<ParallelParse *>(context);
+    auto &chunk = parse.chunks[chunkIndex];
+    const auto first = chunkIndex * ParallelParseChunkLines;
+    const auto last = std::min(first + ParallelParseChunkLines, parse.lineBounds.size());
+
+    chunk.lines.reserve(last - first);
+    chunk.arena = make_shared<NodeArena>();
+    auto inputLine = InputLine{};
+    for (auto i = first; i < last; ++i)
+    {
+        inputLine.clear();
+        appendInputLineChars(inputLine, parse.lineBounds[i].first, parse.lineBounds[i].second);
+        const auto start = std::chrono::steady_clock::now();
+        chunk.lines.push_back(parseLine(inputLine, chunk.arena));
+        chunk.parseTimes.record(nanosecondsBetween(start, std::chrono::steady_clock::now()));
+    }
+}
+
+void InterpreterEngine::interpretText(const char *text, size_t length)
+{
+    if (length >= ParallelParseMinimumLength && interpretTextInParallel(text, length))
+    {
+        return;
+    }
+
+    vec<NumberedStatement> numberedLines;
+
+    // The numbered lines share an arena
+    const auto arena = make_shared<NodeArena>();
+    auto inputLine = InputLine{};
+    const auto end = text + length;
+    auto lineStart = text;
+    while (lineStart < end)
+    {
+        auto lineEnd = static_cast<const char *>(memchr(lineStart, '\n', end - lineStart));
+        if (lineEnd == nullptr)
+        {
+            lineEnd = end;
+        }
+
+        inputLine.clear();
+        appendInputLineChars(inputLine, lineStart, lineEnd);
+        lineStart = lineEnd + 1;
+
+        interpretLine(parseInputLine(inputLine, arena), numberedLines);
+    }
+
+    mergeLinesIntoProgram(numberedLines);
+}
+
+bool InterpreterEngine::interpretTextInParallel(const char *text, size_t length)
+{
+    // An immediate statement could depend on or change the program (as
+    // LIST and CLEAR do), so text containing one is interpreted one line at
+    // a time.  That is checked before any parsing is done.
+    auto parse = ParallelParse{};
+    const auto end = text + length;
+    auto lineStart = text;
+    while (lineStart < end)
+    {
+        auto lineEnd = static_cast<const char *>(memchr(lineStart, '\n', end - lineStart));
+        if (lineEnd == nullptr)
+        {
+            lineEnd = end;
+        }
+        if (!isEmptyOrNumberedLineText(lineStart, lineEnd))
+        {
+            return false;
+        }
+        parse.lineBounds.push_back({lineStart, lineEnd});
+        lineStart = lineEnd + 1;
+    }
+
+    const auto chunkCount =
+        (parse.lineBounds.size() + ParallelParseChunkLines - 1) / ParallelParseChunkLines;
+    parse.chunks.resize(chunkCount);
+
+    dispatch_apply_f(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                     &parse, parseChunk);
+
+    for (const auto &chunk : parse.chunks)
+    {
+        metrics.parseTimes.add(chunk.parseTimes);
+    }
+
+    // Lines are processed in source order, so errors are reported in order
+    // and the last definition of a line number wins
+    vec<NumberedStatement> numberedLines;
+    for (const auto &chunk : parse.chunks)
+    {
+        for (const auto &line : chunk.lines)
+        {
+            interpretLine(line, numberedLines);
+        }
+    }
+    mergeLinesIntoProgram(numberedLines);
+
+    return true;
+}
+
+void InterpreterEngine::interpretLine(const Line &line, vec<NumberedStatement> &numberedLines)
+{
+    // Numbered lines are collected and merged into the program together.
+    // Any other line could depend on or change the program, so the
+    // collected lines are merged before it is processed.
+    switch (line.kind)
+    {
+        case LineKind::NumberedStatement:
+            st = InterpreterStateIdle;
+            numberedLines.push_back({line.lineNumber, line.statement, line.arena, line.nodeBytes});
+            break;
+
+        case LineKind::Empty:
+        case LineKind::Error:
+            processLine(line);
+            break;
+
+        default:
+            mergeLinesIntoProgram(numberedLines);
+            processLine(line);
+            break;
+    }
+}
 
 /// Return interpreter state
 InterpreterState InterpreterEngine::state()
@@ -392,9 +1003,9 @@ InterpreterState InterpreterEngine::state()
 void InterpreterEngine::breakExecution()
 {
     if ((st == InterpreterStateRunning || st == InterpreterStateReadingInput)
-        && (programIndex < program.size()))
+        && (programIndex < program->size()))
     {
-        const auto &currentLine = program[programIndex];
+        const auto &currentLine = (*program)[programIndex];
         const auto lineNumber = currentLine.lineNumber;
         auto msg = ostringstream{};
         msg << "BREAK at line " << lineNumber;
@@ -406,23 +1017,23 @@ void InterpreterEngine::breakExecution()
     }
 
     st = InterpreterStateIdle;
+    hasBreakOccurred = true;
 }
 
 /// Set values of all variables and array elements to zero
 void InterpreterEngine::clearVariablesAndArray()
 {
-    for (auto varname = 'A'; varname <= 'Z'; ++varname)
-    {
-        v[varname] = 0;
-    }
+    v.clear();
 
-    fill(begin(a), end(a), 0);
+    a.clear();
 }
 
 /// Remove program from memory
 void InterpreterEngine::clearProgram()
 {
-    program.resize(0);
+    replaceProgram({});
+    ++programVersion;
+    markProgramChanged();
     programIndex = 0;
     st = InterpreterStateIdle;
 }
@@ -446,7 +1057,9 @@ void InterpreterEngine::runUntilEndOfInput()
     hasReachedEndOfInput = false;
     do
     {
-        next();
+        // Nothing can interrupt us, so a running program can run until it
+        // stops or needs input
+        advance(std::numeric_limits<size_t>::max());
     } while (!hasReachedEndOfInput);
 }
 
@@ -456,9 +1069,27 @@ void InterpreterEngine::runUntilEndOfInput()
 /// in a loop.
 void InterpreterEngine::next()
 {
+    advance(1);
+}
+
+size_t InterpreterEngine::advance(size_t maxProgramLines)
+{
+    auto count = size_t{1};
+
+    // A break requested by another thread is taken between operations, so
+    // that it never interrupts a statement
+    if (isBreakRequested.load(std::memory_order_relaxed) &&
+        isBreakRequested.exchange(false, std::memory_order_relaxed))
+    {
+        breakExecution();
+        flushOutput();
+        return count;
+    }
+
     switch (st)
     {
         case InterpreterStateIdle:
+            flushOutput();
             [interpreter.io showCommandPromptForInterpreter:interpreter];
             st = InterpreterStateReadingStatement;
             break;
@@ -477,7 +1108,7 @@ void InterpreterEngine::next()
                     break;
 
                 case InputResultKindWaiting:
-                    // do nothing
+                    isWaitingForInput = true;
                     break;
 
                 default:
@@ -488,7 +1119,7 @@ void InterpreterEngine::next()
         break;
 
         case InterpreterStateRunning:
-            executeNextProgramStatement();
+            count = executeProgramLines(maxProgramLines);
             break;
 
         case InterpreterStateReadingInput:
@@ -499,23 +1130,120 @@ void InterpreterEngine::next()
             // Should be no other cases
             assert(false);
     }
+
+    // While a program is running, output is only flushed at the end of
+    // each line or when the buffer is full.  Otherwise, make sure that
+    // the host has everything before it next calls us.
+    if (st != InterpreterStateRunning)
+    {
+        flushOutput();
+
+        // A program waiting for INPUT is still running
+        if (runSignpost.isActive() && st != InterpreterStateReadingInput)
+        {
+            runSignpost.end();
+        }
+    }
+
+    return count;
+}
+
+InterpreterStopReason InterpreterEngine::runForStatementBudget(size_t maxStatements)
+{
+    return runWithBudget(maxStatements, nullptr);
+}
+
+InterpreterStopReason InterpreterEngine::runForTimeBudget(NSTimeInterval seconds)
+{
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>{seconds});
+    return runWithBudget(std::numeric_limits<size_t>::max(), &deadline);
+}
+
+// Number of operations performed between checks of the clock
+static const size_t DeadlineCheckInterval = 64;
+
+InterpreterStopReason
+InterpreterEngine::runWithBudget(size_t maxSteps,
+                                 const std::chrono::steady_clock::time_point *deadline)
+{
+    hasReachedEndOfInput = false;
+    hasBreakOccurred = false;
+
+    auto step = size_t{0};
+    auto nextDeadlineCheck = DeadlineCheckInterval;
+    while (step < maxSteps)
+    {
+        auto maxProgramLines = maxSteps - step;
+        if (deadline != nullptr)
+        {
+            if (step >= nextDeadlineCheck)
+            {
+                if (std::chrono::steady_clock::now() >= *deadline)
+                {
+                    break;
+                }
+                nextDeadlineCheck = step + DeadlineCheckInterval;
+            }
+            maxProgramLines = std::min(maxProgramLines, nextDeadlineCheck - step);
+        }
+
+        const auto wasRunning = st == InterpreterStateRunning;
+        isWaitingForInput = false;
+
+        step += advance(maxProgramLines);
+
+        if (hasBreakOccurred)
+        {
+            return InterpreterStopReasonBreak;
+        }
+        if (isWaitingForInput)
+        {
+            return InterpreterStopReasonWaitingForInput;
+        }
+        if (hasReachedEndOfInput)
+        {
+            return InterpreterStopReasonEndOfInput;
+        }
+        if (wasRunning && (st == InterpreterStateIdle || st == InterpreterStateReadingStatement))
+        {
+            return InterpreterStopReasonProgramEnded;
+        }
+    }
+
+    // Output is not flushed by next() while running, but the host may not
+    // call us again for a while.
+    flushOutput();
+    return InterpreterStopReasonBudgetExhausted;
 }
 
 /// Parse an input line and execute it or add it to the program
 void InterpreterEngine::processInput(const InputLine &input)
 {
-    st = InterpreterStateIdle;
+    processLine(parseInputLine(input, nullptr));
+}
 
-    const auto line = parseInputLine(input);
+/// Execute a parsed line or add it to the program
+void InterpreterEngine::processLine(const Line &line)
+{
+    st = InterpreterStateIdle;
 
     switch (line.kind)
     {
         case LineKind::UnnumberedStatement:
+            metrics.statementsExecuted.add(1);
             execute(line.statement);
+            if (st == InterpreterStateReadingInput)
+            {
+                // An INPUT statement is waiting for input, so its lvalues
+                // must outlive this line
+                inputLvaluesArena = line.arena;
+            }
             break;
 
         case LineKind::NumberedStatement:
-            insertLineIntoProgram(line.lineNumber, line.statement);
+            insertLineIntoProgram({line.lineNumber, line.statement, line.arena, line.nodeBytes});
             break;
 
         case LineKind::EmptyNumberedLine:
@@ -538,7 +1266,27 @@ void InterpreterEngine::processInput(const InputLine &input)
 
 #pragma mark - Parsing
 
-Line InterpreterEngine::parseInputLine(const InputLine &input)
+/// Return the size of the first block of an arena for the nodes of one line
+///
+/// The nodes of a line rarely need more than 12 bytes per character of its
+/// text, so most lines fit in one block.
+static size_t lineArenaSize(const InputLine &input)
+{
+    return std::max(size_t{64}, input.size() * 12);
+}
+
+/// Parse an input line
+///
+/// The nodes of a numbered statement are allocated from `programArena`,
+/// which is shared by lines that are parsed together.  If that is null, the
+/// line gets an arena of its own, sized to fit it.  The nodes of an
+/// immediate statement always go in an arena of their own, so they are
+/// released after the statement has been executed.  If the line can't be
+/// parsed, the nodes that were made for it are released.
+///
+/// This does not use or change the state of an engine, so lines may be
+/// parsed on several threads at once, as long as they use different arenas.
+static Line parseLine(const InputLine &input, const sptr<NodeArena> &programArena)
 {
     const auto start = InputPos{input, 0};
     const auto afterSpaces = start.afterSpaces();
@@ -558,38 +1306,40 @@ Line InterpreterEngine::parseInputLine(const InputLine &input)
             return Line::emptyNumberedLine(parsedNumber.value());
         }
 
+        // Nodes of a numbered statement belong to its program line
+        const auto arena = programArena != nullptr
+                               ? programArena
+                               : make_shared<NodeArena>(lineArenaSize(input));
+        const auto mark = arena->mark();
+        const auto bytesBefore = arena->bytesUsed();
+        NodeArena::Scope scope{*arena};
+
         const auto parsedStatement = statement(parsedNumber.nextPos());
-        if (parsedStatement.wasParsed())
+        if (parsedStatement.wasParsed() &&
+            parsedStatement.nextPos().isRemainingLineEmpty())
         {
-            if (parsedStatement.nextPos().isRemainingLineEmpty())
-            {
-                return Line::numberedStatement(parsedNumber.value(),
-                                               parsedStatement.value());
-            }
-            else
-            {
-                ostringstream msg;
-                msg << "line " << parsedNumber.value()
-                    << ": error: not a valid statement";
-                return Line::error(msg.str());
-            }
-        }
-        else
-        {
-            ostringstream msg;
-            msg << "line " << parsedNumber.value()
-                << ": error: not a valid statement";
-            return Line::error(msg.str());
+            return Line::numberedStatement(parsedNumber.value(),
+                                           parsedStatement.value(), arena,
+                                           arena->bytesUsed() - bytesBefore);
         }
+
+        arena->rollBack(mark);
+        ostringstream msg;
+        msg << "line " << parsedNumber.value()
+            << ": error: not a valid statement";
+        return Line::error(msg.str());
     }
 
-    // Otherwise, try to execute statement immediately
+    // Otherwise, try to execute statement immediately.  Its nodes
+    // are released after it has been executed.
+    const auto arena = make_shared<NodeArena>(lineArenaSize(input));
+    NodeArena::Scope scope{*arena};
     const auto parsedStatement = statement(afterSpaces);
     if (parsedStatement.wasParsed())
     {
         if (parsedStatement.nextPos().isRemainingLineEmpty())
         {
-            return Line::unnumberedStatement(parsedStatement.value());
+            return Line::unnumberedStatement(parsedStatement.value(), arena);
         }
         else
         {
@@ -602,34 +1352,159 @@ Line InterpreterEngine::parseInputLine(const InputLine &input)
     }
 }
 
+Line InterpreterEngine::parseInputLine(const InputLine &input,
+                                       const sptr<NodeArena> &programArena)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto line = parseLine(input, programArena);
+    metrics.parseTimes.record(nanosecondsBetween(start, std::chrono::steady_clock::now()));
+    return line;
+}
+
 #pragma mark - Program editing
 
-void InterpreterEngine::insertLineIntoProgram(Number lineNumber,
-                                              Statement statement)
+void InterpreterEngine::insertLineIntoProgram(NumberedStatement line)
 {
-    NumberedStatement line{lineNumber, statement};
+    const auto lineNumber = line.lineNumber;
+    ++programVersion;
+    markProgramChanged(lineNumber, lineNumber);
 
-    const auto existing = programLineWithNumber(lineNumber);
-    if (existing != program.end())
+    const auto index = programLineAtOrAfter(lineNumber) - program->begin();
+    auto &lines = writableProgram();
+    const auto it = lines.begin() + index;
+    if (it != lines.end() && it->lineNumber == lineNumber)
     {
-        *existing = line;
+        *it = std::move(line);
     }
-    else if (lineNumber > getLastProgramLineNumber())
+    else
     {
-        program.push_back(line);
+        lines.insert(it, std::move(line));
     }
-    else
+}
+
+/// Add lines to the program, replacing any existing lines with the same
+/// numbers.
+///
+/// If more than one of the new lines has the same number, the last one wins,
+/// as if they had been inserted one at a time.  `lines` is left empty.
+void InterpreterEngine::mergeLinesIntoProgram(vec<NumberedStatement> &lines)
+{
+    if (lines.empty())
+    {
+        return;
+    }
+
+    const auto lessByNumber = [](const NumberedStatement &lhs,
+                                 const NumberedStatement &rhs) -> bool
+    { return lhs.lineNumber < rhs.lineNumber; };
+
+    // Sort the new lines, keeping only the last of each number.  (After
+    // a stable sort, that is the last of each run of equal numbers.)
+    stable_sort(lines.begin(), lines.end(), lessByNumber);
+    auto unique = size_t{0};
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        if (i + 1 < lines.size() && lines[i + 1].lineNumber == lines[i].lineNumber)
+        {
+            continue;
+        }
+        if (unique != i)
+        {
+            lines[unique] = std::move(lines[i]);
+        }
+        ++unique;
+    }
+    lines.resize(unique);
+    const auto lowestLineNumber = lines.front().lineNumber;
+    const auto highestLineNumber = lines.back().lineNumber;
+
+    // Merge with the existing program, preferring the new lines.  Lines are
+    // moved, so that their cached text is not copied.  (A program shared
+    // with a fork is copied once by writableProgram().)
+    auto &current = writableProgram();
+    auto merged = Program{};
+    merged.reserve(current.size() + lines.size());
+    auto existing = current.begin();
+    for (auto &line : lines)
+    {
+        while (existing != current.end() && existing->lineNumber < line.lineNumber)
+        {
+            merged.push_back(std::move(*existing++));
+        }
+        if (existing != current.end() && existing->lineNumber == line.lineNumber)
+        {
+            ++existing;
+        }
+        merged.push_back(std::move(line));
+    }
+    merged.insert(merged.end(), std::make_move_iterator(existing),
+                  std::make_move_iterator(current.end()));
+
+    current.swap(merged);
+    ++programVersion;
+    markProgramChanged(lowestLineNumber, highestLineNumber);
+    lines.clear();
+
+    compactProgramArenas();
+}
+
+// The arenas of a program are compacted when they use at least this many
+// bytes, and more than twice as many as the nodes of the program's lines
+static const size_t ArenaCompactionMinimumBytes = 64 * 1024;
+
+void InterpreterEngine::compactProgramArenas()
+{
+    auto &lines = *exclusiveProgram;
+    auto lineBytes = size_t{0};
+    auto arenaBytes = size_t{0};
+    auto arenas = std::unordered_set<const NodeArena *>{};
+    for (const auto &line : lines)
+    {
+        lineBytes += line.nodeBytes;
+        if (arenas.insert(line.arena.get()).second)
+        {
+            arenaBytes += line.arena->bytesUsed();
+        }
+    }
+    if (arenaBytes < ArenaCompactionMinimumBytes || arenaBytes <= 2 * lineBytes)
     {
-        // TODO: Rather than appending element and re-sorting, it would
-        // probably be more efficient to find the correct insertion location
-        // and do an insert operation.
+        return;
+    }
 
-        program.push_back(line);
-        sort(program.begin(), program.end(),
-             [](const NumberedStatement &lhs, const NumberedStatement &rhs)
-                 -> bool
-             { return lhs.lineNumber < rhs.lineNumber; });
+    // The statements are copied by writing them as they are written to a
+    // snapshot, and reading them back into the new arena
+    auto w = SnapshotWriter{};
+    for (const auto &line : lines)
+    {
+        line.statement.writeSnapshot(w);
     }
+
+    auto r = SnapshotReader{w.bytes.data(), w.bytes.size()};
+    const auto arena = make_shared<NodeArena>(lineBytes);
+    NodeArena::Scope scope{*arena};
+    for (auto &line : lines)
+    {
+        const auto bytesBefore = arena->bytesUsed();
+        const auto statement = Statement::readSnapshot(r);
+        line = {line.lineNumber, statement, arena, arena->bytesUsed() - bytesBefore};
+    }
+    assert(!r.failed() && r.atEnd());
+}
+
+Program &InterpreterEngine::writableProgram()
+{
+    if (exclusiveProgram == nullptr)
+    {
+        replaceProgram(*program);
+    }
+    return *exclusiveProgram;
+}
+
+void InterpreterEngine::replaceProgram(Program lines)
+{
+    auto replacement = make_shared<Program>(std::move(lines));
+    exclusiveProgram = replacement.get();
+    program = std::move(replacement);
 }
 
 /// Delete the line with the specified number from the program.
@@ -637,65 +1512,356 @@ void InterpreterEngine::insertLineIntoProgram(Number lineNumber,
 /// No effect if there is no such line.
 void InterpreterEngine::deleteLineFromProgram(Number lineNumber)
 {
-    const auto it = programLineWithNumber(lineNumber);
-    if (it != program.end())
+    const auto it = programLineAtOrAfter(lineNumber);
+    if (it != program->end() && it->lineNumber == lineNumber)
     {
-        program.erase(it);
+        const auto index = it - program->begin();
+        auto &lines = writableProgram();
+        lines.erase(lines.begin() + index);
+        ++programVersion;
+        markProgramChanged(lineNumber, lineNumber);
     }
 }
 
 /// Find program line with specified line number.
 ///
-/// Returns iterator to the element if found, or `program.cend()` if not found.
-Program::iterator InterpreterEngine::programLineWithNumber(Number lineNumber)
+/// Returns iterator to the element if found, or `program->cend()` if not found.
+Program::const_iterator InterpreterEngine::programLineWithNumber(Number lineNumber)
 {
-    return find_if(program.begin(), program.end(),
-                   [lineNumber](const NumberedStatement &s)
-                       -> bool
-                   { return s.lineNumber == lineNumber; });
+    // The index is rebuilt on the first lookup after the program changes,
+    // so a series of edits (such as a LOAD) doesn't rebuild it for each line.
+    if (lineIndexesVersion != programVersion)
+    {
+        lineIndexes.clear();
+        lineIndexes.reserve(program->size());
+        for (size_t i = 0; i < program->size(); ++i)
+        {
+            lineIndexes[(*program)[i].lineNumber] = i;
+        }
+        lineIndexesVersion = programVersion;
+    }
+
+    const auto it = lineIndexes.find(lineNumber);
+    if (it == lineIndexes.end())
+    {
+        return program->end();
+    }
+    return program->begin() + it->second;
 }
 
-/// Return line number of the last line in the program.
-///
-/// Returns 0 if there is no program.
-Number InterpreterEngine::getLastProgramLineNumber()
-{
-    if (program.size() > 0)
-    {
-        return program.back().lineNumber;
-    }
+/// Return iterator to the first program line whose number is not less than
+/// the specified line number, or `program->end()` if there is no such line.
+Program::const_iterator InterpreterEngine::programLineAtOrAfter(Number lineNumber)
+{
+    return lower_bound(program->begin(), program->end(), lineNumber,
+                       [](const NumberedStatement &s, Number n)
+                           -> bool
+                       { return s.lineNumber < n; });
+}
+
+#pragma mark - Execution
+
+void InterpreterEngine::execute(Statement statement)
+{
+    statement.execute(*this);
+}
+
+size_t InterpreterEngine::executeProgramLines(size_t maxLines)
+{
+    // The first line takes care of tracing, recompiling, and running off the
+    // end of the program.  Following lines are executed directly, as long as
+    // none of those things need to happen for them, and hot runs of them
+    // by native code if that is enabled.
+    executeNextProgramStatement();
+    auto count = size_t{1};
+    while (count < maxLines && st == InterpreterStateRunning &&
+           !isBreakRequested.load(std::memory_order_relaxed) &&
+           !isTraceOn && !isProfiling &&
+           bytecodeVersion == programVersion &&
+           programIndex < bytecode->lineStart.size())
+    {
+#if FINCHLIB_JIT
+        auto native = NativeState{v.data(), &a, &rng, &returnStack,
+                                  &metrics.maxGosubDepth, &isBreakRequested,
+                                  maxLines - count, programIndex};
+        if (const auto nativeCount = nativeTier.run(bytecode, native))
+        {
+            programIndex = native.lineIndex;
+            count += nativeCount;
+            metrics.nativeLinesExecuted.add(nativeCount);
+            continue;
+        }
+#endif
+
+        const auto lineIndex = programIndex;
+        ++programIndex;
+        executeCompiledLine(lineIndex);
+        ++count;
+    }
+
+    // executeNextProgramStatement() counted the first line
+    metrics.statementsExecuted.add(count - 1);
+    return count;
+}
+
+void InterpreterEngine::executeNextProgramStatement()
+{
+    assert(st == InterpreterStateRunning);
+
+    if (programIndex >= program->size())
+    {
+        showError("error: RUN - program does not terminate with END");
+        st = InterpreterStateIdle;
+        return;
+    }
+
+    if (isTraceOn)
+    {
+        auto msg = ostringstream{};
+        msg << "[" << (*program)[programIndex].lineNumber << "]";
+        NSString *message = [NSString stringWithUTF8String:msg.str().c_str()];
+        flushOutput();
+        [interpreter.io showDebugTraceMessage:message forInterpreter:interpreter];
+    }
+
+    // Recompile if the program has changed since the last time we compiled
+    // it.  This is done only here, between lines, so that a statement that
+    // modifies the program can't destroy the code that is executing it.
+    if (bytecodeVersion != programVersion)
+    {
+        bytecode = make_shared<const Bytecode>(Bytecode::compile(*program));
+        bytecodeVersion = programVersion;
+        evaluationStack.resize(bytecode->maxStackDepth);
+    }
+
+    metrics.statementsExecuted.add(1);
+    const auto lineIndex = programIndex;
+    ++programIndex;
+    if (isProfiling)
+    {
+        executeProfiledLine(lineIndex);
+    }
+    else
+    {
+        executeCompiledLine(lineIndex);
+    }
+}
+
+void InterpreterEngine::executeProfiledLine(size_t lineIndex)
+{
+    if (lineProfilesVersion != programVersion)
+    {
+        updateLineProfiles();
+    }
+
+    // Only updateLineProfiles() reallocates lineProfiles, so this reference
+    // remains valid even if the statement modifies the program.
+    auto &profile = lineProfiles[lineIndex];
+    const auto returnStackSize = returnStack.size();
+
+    const auto start = std::chrono::steady_clock::now();
+    executeCompiledLine(lineIndex);
+    profile.time += std::chrono::steady_clock::now() - start;
+    ++profile.hits;
+
+    // A GOSUB leaves its return address on the stack and programIndex at the
+    // start of the subroutine
+    if (returnStack.size() > returnStackSize &&
+        lineProfilesVersion == programVersion &&
+        programIndex < lineProfiles.size())
+    {
+        ++lineProfiles[programIndex].gosubCalls;
+    }
+}
+
+void InterpreterEngine::updateLineProfiles()
+{
+    // Both the program and lineProfiles are sorted by line number
+    auto updated = vec<LineProfile>{};
+    updated.reserve(program->size());
+    auto old = lineProfiles.cbegin();
+    for (const auto &line : *program)
+    {
+        while (old != lineProfiles.cend() && old->lineNumber < line.lineNumber)
+        {
+            ++old;
+        }
+
+        if (old != lineProfiles.cend() && old->lineNumber == line.lineNumber)
+        {
+            updated.push_back(*old);
+        }
+        else
+        {
+            updated.push_back({line.lineNumber, 0, 0, {}});
+        }
+    }
+
+    lineProfiles.swap(updated);
+    lineProfilesVersion = programVersion;
+}
+
+vec<LineProfile> InterpreterEngine::sortedLineProfiles()
+{
+    auto result = vec<LineProfile>{};
+    for (const auto &profile : lineProfiles)
+    {
+        if (profile.hits > 0)
+        {
+            result.push_back(profile);
+        }
+    }
+
+    stable_sort(result.begin(), result.end(),
+                [](const LineProfile &lhs, const LineProfile &rhs) -> bool
+                { return lhs.time > rhs.time; });
+    return result;
+}
+
+void InterpreterEngine::executeCompiledLine(size_t lineIndex)
+{
+    // The bytecode is only replaced between lines, so this reference stays
+    // valid while the line executes.
+    const auto &code = *bytecode;
+    auto pc = code.code.data() + code.lineStart[lineIndex];
+    auto sp = evaluationStack.data();
+
+    for (;;)
+    {
+        const auto &instruction = *pc++;
+        switch (instruction.opcode)
+        {
+            case Opcode::PushNumber:
+                *sp++ = instruction.operand;
+                break;
+
+            case Opcode::PushVariable:
+                *sp++ = getVariableValue(instruction.operand);
+                break;
+
+            case Opcode::PushArrayElement:
+                sp[-1] = getArrayElementValue(sp[-1]);
+                break;
+
+            case Opcode::Rnd:
+                sp[-1] = randomNumber(rng, sp[-1]);
+                break;
+
+            case Opcode::ArraySum:
+                --sp;
+                sp[-1] = a.sum(sp[-1], sp[0]);
+                break;
+
+            case Opcode::ArrayMin:
+                --sp;
+                sp[-1] = a.minimum(sp[-1], sp[0]);
+                break;
+
+            case Opcode::ArrayMax:
+                --sp;
+                sp[-1] = a.maximum(sp[-1], sp[0]);
+                break;
+
+            case Opcode::ArrayFind:
+                sp -= 2;
+                sp[-1] = a.find(sp[-1], sp[0], sp[1]);
+                break;
+
+            case Opcode::Add:
+                --sp;
+                sp[-1] = sp[-1] + sp[0];
+                break;
+
+            case Opcode::Subtract:
+                --sp;
+                sp[-1] = sp[-1] - sp[0];
+                break;
+
+            case Opcode::Multiply:
+                --sp;
+                sp[-1] = sp[-1] * sp[0];
+                break;
+
+            case Opcode::Divide:
+                --sp;
+                sp[-1] = ArithOp{ArithOp::Kind::Divide}.apply(sp[-1], sp[0]);
+                break;
+
+            case Opcode::Negate:
+                sp[-1] = -sp[-1];
+                break;
+
+            case Opcode::StoreVariable:
+                setVariableValue(instruction.operand, *--sp);
+                break;
+
+            case Opcode::StoreArrayElement:
+                sp -= 2;
+                setArrayElementValue(sp[1], sp[0]);
+                break;
+
+            case Opcode::AddToVariable:
+                setVariableValue(instruction.variable,
+                                 getVariableValue(instruction.variable) + instruction.operand);
+                break;
+
+            case Opcode::JumpUnless:
+                sp -= 2;
+                if (!RelOp{instruction.relation}.isTrueForNumbers(sp[0], sp[1]))
+                {
+                    pc += instruction.operand;
+                }
+                break;
+
+            case Opcode::Goto:
+                programIndex = instruction.operand;
+                st = InterpreterStateRunning;
+                return;
+
+            case Opcode::GotoIf:
+                sp -= 2;
+                if (RelOp{instruction.relation}.isTrueForNumbers(sp[0], sp[1]))
+                {
+                    programIndex = instruction.operand;
+                    st = InterpreterStateRunning;
+                    return;
+                }
+                break;
+
+            case Opcode::GotoLineNumber:
+                gotoLineNumber(*--sp);
+                return;
 
-    return 0;
-}
+            case Opcode::Gosub:
+                returnStack.push_back(programIndex);
+                metrics.maxGosubDepth.raiseTo(returnStack.size());
+                programIndex = instruction.operand;
+                st = InterpreterStateRunning;
+                return;
 
-#pragma mark - Execution
+            case Opcode::GosubLineNumber:
+                gosubLineNumber(*--sp);
+                return;
 
-void InterpreterEngine::execute(Statement statement)
-{
-    statement.execute(*this);
-}
+            case Opcode::Return:
+                RETURN();
+                return;
 
-void InterpreterEngine::executeNextProgramStatement()
-{
-    assert(st == InterpreterStateRunning);
+            case Opcode::End:
+                END();
+                return;
 
-    if (programIndex >= program.size())
-    {
-        showError("error: RUN - program does not terminate with END");
-        st = InterpreterStateIdle;
-        return;
-    }
+            case Opcode::Execute:
+                // A fallback statement is always the last thing on its line,
+                // and it may change the state of the interpreter, so don't
+                // execute anything after it.
+                code.statements[instruction.operand].execute(*this);
+                return;
 
-    const auto numberedStatement = program.at(programIndex);
-    if (isTraceOn)
-    {
-        auto msg = ostringstream{};
-        msg << "[" << numberedStatement.lineNumber << "]";
-        NSString *message = [NSString stringWithUTF8String:msg.str().c_str()];
-        [interpreter.io showDebugTraceMessage:message forInterpreter:interpreter];
+            case Opcode::EndLine:
+                return;
+        }
     }
-    ++programIndex;
-    execute(numberedStatement.statement);
 }
 
 /// Display error message and stop running
@@ -714,39 +1880,89 @@ void InterpreterEngine::abortRunWithErrorMessage(string message)
 
 #pragma mark - I/O
 
+// Output is collected in a buffer, which is flushed when it holds a
+// complete line or reaches this size, and before any other message is
+// sent to the InterpreterIO object.
+static const size_t OutputBufferSize = 4096;
+
 /// Send a single character to the output stream
 void InterpreterEngine::writeOutput(Char c)
 {
-    [interpreter.io putOutputChar:c forInterpreter:interpreter];
+    outputBuffer.push_back(c);
+    if (c == '\n' || outputBuffer.size() >= OutputBufferSize)
+    {
+        flushOutput();
+    }
 }
 
 /// Send characters to the output stream
 void InterpreterEngine::writeOutput(const vec<Char> &chars)
 {
-    for (const auto c : chars)
-    {
-        [interpreter.io putOutputChar:c forInterpreter:interpreter];
-    }
+    writeOutput(chars.data(), chars.size());
 }
 
 /// Send string to the output stream
 void InterpreterEngine::writeOutput(const string &s)
 {
-    for (const auto c : s)
+    writeOutput(reinterpret_cast<const Char *>(s.data()), s.size());
+}
+
+/// Send characters to the output stream
+void InterpreterEngine::writeOutput(const Char *chars, size_t count)
+{
+    outputBuffer.insert(outputBuffer.end(), chars, chars + count);
+    if (outputBuffer.size() >= OutputBufferSize ||
+        (count > 0 && memchr(chars, '\n', count) != nullptr))
     {
-        [interpreter.io putOutputChar:c forInterpreter:interpreter];
+        flushOutput();
     }
 }
 
 /// Print an object that conforms to the PrintTextProvider protocol
 void InterpreterEngine::writeOutput(const PrintTextProvider &p)
 {
-    writeOutput(p.printText(v, a));
+    // The text is appended directly to the output buffer
+    const auto start = outputBuffer.size();
+    p.appendPrintText(outputBuffer, v, a, rng);
+    const auto count = outputBuffer.size() - start;
+    if (outputBuffer.size() >= OutputBufferSize ||
+        (count > 0 && memchr(outputBuffer.data() + start, '\n', count) != nullptr))
+    {
+        flushOutput();
+    }
+}
+
+/// Send any buffered output to the InterpreterIO object
+void InterpreterEngine::flushOutput()
+{
+    if (outputBuffer.empty())
+    {
+        return;
+    }
+
+    metrics.outputChars.add(outputBuffer.size());
+
+    const auto io = interpreter.io;
+    if ([io respondsToSelector:@selector(putOutputChars:length:forInterpreter:)])
+    {
+        [io putOutputChars:outputBuffer.data()
+                    length:outputBuffer.size()
+            forInterpreter:interpreter];
+    }
+    else
+    {
+        for (const auto c : outputBuffer)
+        {
+            [io putOutputChar:c forInterpreter:interpreter];
+        }
+    }
+    outputBuffer.clear();
 }
 
 /// Display error message
 void InterpreterEngine::showError(const string &message)
 {
+    flushOutput();
     auto str = [NSString stringWithUTF8String:message.c_str()];
     [interpreter.io showErrorMessage:str forInterpreter:interpreter];
 }
@@ -763,10 +1979,113 @@ void InterpreterEngine::showError(const string &message)
 /// input.
 InputLineResult InterpreterEngine::readInputLine()
 {
+    flushOutput();
+
     const auto io = interpreter.io;
     const auto interpreter = this->interpreter;
-    return getInputLine([=]() -> InputCharResult
-                        { return [io getInputCharForInterpreter:interpreter]; });
+    for (;;)
+    {
+        const auto isBuffered =
+            pushedInput.hasBeenUsed() ||
+            [io respondsToSelector:@selector(getInputChars:maxLength:count:forInterpreter:)];
+        const auto result =
+            isBuffered ? readBufferedInputLine()
+                       : getInputLine([=]() -> InputCharResult
+                                      { return [io getInputCharForInterpreter:interpreter]; });
+
+        // If input was pushed after we looked, look again rather than
+        // telling the host that we are waiting
+        if (result.kind != InputResultKindWaiting)
+        {
+            return result;
+        }
+        if (pushedInput.markEngineWaiting())
+        {
+            metrics.inputWaits.add(1);
+            return result;
+        }
+    }
+}
+
+// Number of characters requested from getInputChars:maxLength:count:forInterpreter:
+static const size_t InputBufferSize = 4096;
+
+/// Read a line using the bulk-input method of the InterpreterIO interface,
+/// or from the pushed input once the host has used it.
+///
+/// Characters following the end of the line are kept in `pendingInput` for
+/// the next call.
+InputLineResult InterpreterEngine::readBufferedInputLine()
+{
+    for (;;)
+    {
+        const auto begin = pendingInput.data() + pendingInputStart;
+        const auto end = pendingInput.data() + pendingInput.size();
+        const auto newline = begin < end
+                                 ? static_cast<const Char *>(memchr(begin, '\n', end - begin))
+                                 : nullptr;
+        if (newline != nullptr)
+        {
+            appendToInputLineBuffer(begin, newline);
+            pendingInputStart += newline + 1 - begin;
+            const auto result = InputLineResult::inputLine(inputLineBuffer);
+            inputLineBuffer.clear();
+            return result;
+        }
+
+        // No complete line, so hold on to what we have and ask for more
+        appendToInputLineBuffer(begin, end);
+        pendingInputStart = 0;
+
+        auto kind = InputResultKindWaiting;
+        if (pushedInput.hasBeenUsed())
+        {
+            pendingInput.clear();
+            kind = pushedInput.take(pendingInput);
+        }
+        else
+        {
+            pendingInput.resize(InputBufferSize);
+            auto count = NSUInteger{0};
+            kind = [interpreter.io getInputChars:pendingInput.data()
+                                       maxLength:pendingInput.size()
+                                           count:&count
+                                  forInterpreter:interpreter];
+            pendingInput.resize(kind == InputResultKindValue ? count : 0);
+        }
+
+        // A value of no characters would have us ask again forever, so the
+        // host must not have any input yet
+        if (kind == InputResultKindValue && pendingInput.empty())
+        {
+            kind = InputResultKindWaiting;
+        }
+
+        switch (kind)
+        {
+            case InputResultKindValue:
+                break;
+
+            case InputResultKindEndOfStream:
+                if (inputLineBuffer.size() > 0)
+                {
+                    const auto result = InputLineResult::inputLine(inputLineBuffer);
+                    inputLineBuffer.clear();
+                    return result;
+                }
+                return InputLineResult::endOfStream();
+
+            case InputResultKindWaiting:
+                return InputLineResult::waiting();
+        }
+    }
+}
+
+/// Add input characters to `inputLineBuffer`, applying the same conversions
+/// as `getInputLine()`
+void InterpreterEngine::appendToInputLineBuffer(const Char *begin, const Char *end)
+{
+    appendGraphicChars(inputLineBuffer, begin, end);
 }
 
 /// Get a line of input, using specified function to retrieve characters.
@@ -822,13 +2141,12 @@ InterpreterEngine::getInputLine(function<InputCharResult()> getChar)
 
 Number InterpreterEngine::evaluate(const Expression &expr)
 {
-    return expr.evaluate(v, a);
+    return expr.evaluate(v, a, rng);
 }
 
 Number InterpreterEngine::getVariableValue(VariableName variableName) const
 {
-    auto it = v.find(variableName);
-    return (it == v.end()) ? 0 : it->second;
+    return v[variableName];
 }
 
 void InterpreterEngine::setVariableValue(VariableName variableName,
@@ -840,28 +2158,12 @@ void InterpreterEngine::setVariableValue(VariableName variableName,
 
 Number InterpreterEngine::getArrayElementValue(Number index)
 {
-    if (index >= 0)
-    {
-        return a[index % a.size()];
-    }
-    else
-    {
-        auto fromEnd = -index % a.size();
-        return a[a.size() - fromEnd];
-    }
+    return a.get(index);
 }
 
 void InterpreterEngine::setArrayElementValue(Number index, Number value)
 {
-    if (index >= 0)
-    {
-        a[index % a.size()] = value;
-    }
-    else
-    {
-        auto fromEnd = -index % a.size();
-        a[a.size() - fromEnd] = value;
-    }
+    a.set(index, value);
 }
 
 void InterpreterEngine::setArrayElementValue(const Expression &indexExpression,
@@ -876,8 +2178,7 @@ void InterpreterEngine::setArrayElementValue(const Expression &indexExpression,
 /// Execute PRINT statement with arguments
 void InterpreterEngine::PRINT(const PrintList &printList)
 {
-    const auto output = printList.printText(v, a);
-    writeOutput(output);
+    writeOutput(printList);
 }
 
 /// Execute PRINT statement with no arguments
@@ -889,17 +2190,11 @@ void InterpreterEngine::LIST(const Expression &lowExpr,
 {
     const auto rangeLow = evaluate(lowExpr);
     const auto rangeHigh = evaluate(highExpr);
-    for (const auto &line : program)
+    for (auto it = programLineAtOrAfter(rangeLow);
+         it != program->end() && it->lineNumber <= rangeHigh;
+         ++it)
     {
-        if (line.lineNumber < rangeLow)
-            continue;
-
-        if (line.lineNumber > rangeHigh)
-            break;
-
-        ostringstream s;
-        s << line.lineNumber << " " << line.statement.listText() << "\n";
-        writeOutput(s.str());
+        writeOutput(it->lineText());
     }
 }
 
@@ -920,7 +2215,7 @@ void InterpreterEngine::IF(const Expression &lhs,
 /// Execute RUN statement
 void InterpreterEngine::RUN()
 {
-    if (program.size() == 0)
+    if (program->size() == 0)
     {
         showError("error: RUN - no program in memory");
         return;
@@ -929,21 +2224,32 @@ void InterpreterEngine::RUN()
     programIndex = 0;
     clearVariablesAndArray();
     clearReturnStack();
+    discardInputValues();
     st = InterpreterStateRunning;
+
+    if (!runSignpost.isActive())
+    {
+        runSignpost.begin(SignpostName::Run);
+    }
 }
 
 /// Execute END statement
 void InterpreterEngine::END()
 {
     st = InterpreterStateIdle;
+    flushOutput();
 }
 
 /// Execute GOTO statement
 void InterpreterEngine::GOTO(const Expression &expr)
 {
-    const auto lineNumber = evaluate(expr);
+    gotoLineNumber(evaluate(expr));
+}
+
+void InterpreterEngine::gotoLineNumber(Number lineNumber)
+{
     const auto it = programLineWithNumber(lineNumber);
-    if (it == program.end())
+    if (it == program->end())
     {
         ostringstream s;
         s << "error: GOTO " << lineNumber << " - no line with that number";
@@ -951,16 +2257,20 @@ void InterpreterEngine::GOTO(const Expression &expr)
         return;
     }
 
-    programIndex = distance(program.begin(), it);
+    programIndex = distance(program->begin(), it);
     st = InterpreterStateRunning;
 }
 
 /// Execute GOSUB statement
 void InterpreterEngine::GOSUB(const Expression &expr)
 {
-    const auto lineNumber = evaluate(expr);
+    gosubLineNumber(evaluate(expr));
+}
+
+void InterpreterEngine::gosubLineNumber(Number lineNumber)
+{
     const auto it = programLineWithNumber(lineNumber);
-    if (it == program.end())
+    if (it == program->end())
     {
         ostringstream s;
         s << "error: GOSUB " << lineNumber << " - no line with that number";
@@ -969,7 +2279,8 @@ void InterpreterEngine::GOSUB(const Expression &expr)
     }
 
     returnStack.push_back(programIndex);
-    programIndex = distance(program.begin(), it);
+    metrics.maxGosubDepth.raiseTo(returnStack.size());
+    programIndex = distance(program->begin(), it);
     st = InterpreterStateRunning;
 }
 
@@ -999,6 +2310,7 @@ void InterpreterEngine::CLEAR()
 void InterpreterEngine::BYE()
 {
     st = InterpreterStateIdle;
+    flushOutput();
     [interpreter.io byeForInterpreter:interpreter];
 }
 
@@ -1014,8 +2326,10 @@ void InterpreterEngine::HELP()
         "  CLEAR",
         "  CLIPLOAD",
         "  CLIPSAVE",
+        "  COPY source, destination, count",
         "  END",
         "  FILES",
+        "  FILL first, count, value",
         "  GOSUB expression",
         "  GOTO expression",
         "  HELP",
@@ -1025,11 +2339,18 @@ void InterpreterEngine::HELP()
         "  LIST [firstLine [, lastLine]]",
         "  LOAD \"filename\"",
         "  PRINT expr-list",
+        "  RANDOMIZE seed",
         "  REM comment",
         "  RETURN",
         "  RUN",
         "  SAVE \"filename\"",
         "  TRON | TROFF",
+        "  PROFILE | UNPROFILE",
+        "",
+        "Array functions:",
+        "  SUM(first, count)",
+        "  MIN(first, count) | MAX(first, count)",
+        "  FIND(value, first, count)",
         "",
         "Example:",
         "  10 print \"Hello, world!\"", "  20 end", "  list", "  run"};
@@ -1046,7 +2367,18 @@ void InterpreterEngine::INPUT(const Lvalues &lvalues)
 {
     inputLvalues = lvalues;
     stateBeforeInput = st;
-    [interpreter.io showInputPromptForInterpreter:interpreter];
+
+    // Only a running program carries values over from one INPUT to the next,
+    // and there is no need to prompt for values that are already there
+    if (stateBeforeInput != InterpreterStateRunning)
+    {
+        discardInputValues();
+    }
+    if (!hasInputValues())
+    {
+        flushOutput();
+        [interpreter.io showInputPromptForInterpreter:interpreter];
+    }
     continueInput();
 }
 
@@ -1065,6 +2397,7 @@ void InterpreterEngine::showInputHelpMessage()
         showError("You must enter a value.");
     }
 
+    flushOutput();
     [interpreter.io showInputPromptForInterpreter:interpreter];
 }
 
@@ -1072,86 +2405,142 @@ void InterpreterEngine::showInputHelpMessage()
 ///
 /// This may be called by INPUT(), or by next() if resuming an operation
 /// following a .Waiting result from readInputLine()
+///
+/// Values are taken first from what is left of the line read by a previous
+/// INPUT, and then from a new line, which must supply all of the values still
+/// needed.  Plain integers are scanned directly, and only other entries go
+/// through the parser.
 void InterpreterEngine::continueInput()
 {
     // Loop until successful or we hit end-of-input or a wait condition
     for (;;)
     {
-    inputLoop:
-        const auto inputLineResult = readInputLine();
-        switch (inputLineResult.kind)
+        const auto isContinuingLine = hasInputValues();
+        if (!isContinuingLine)
         {
-            case InputResultKindValue:
+            auto inputLineResult = readInputLine();
+            switch (inputLineResult.kind)
             {
-                auto pos = InputPos{inputLineResult.value, 0};
+                case InputResultKindValue:
+                    inputValues.swap(inputLineResult.value);
+                    inputValuesIndex = 0;
+                    break;
+
+                case InputResultKindWaiting:
+                    st = InterpreterStateReadingInput;
+                    isWaitingForInput = true;
+                    return;
+
+                case InputResultKindEndOfStream:
+                    finishInput();
+                    abortRunWithErrorMessage("error: INPUT - end of input stream");
+                    return;
+
+                default:
+                    // Should be no other cases
+                    assert(false);
+                    abortRunWithErrorMessage("error: INPUT - invalid internal state");
+                    return;
+            }
+        }
 
-                auto first = bool{true};
-                for (const auto &lv : inputLvalues)
+        auto pos = InputPos{inputValues, inputValuesIndex};
+        auto assignedCount = size_t{0};
+        auto isValid = bool{true};
+        for (const auto &lv : inputLvalues)
+        {
+            // If this is not the first value, need to see a comma
+            if (assignedCount > 0)
+            {
+                pos = pos.afterSpaces();
+                if (pos.isAtEndOfLine() && isContinuingLine)
                 {
-                    // If this is not the first value, need to see a comma
-                    if (first)
-                    {
-                        first = false;
-                    }
-                    else
-                    {
-                        const auto comma = literal(",", pos);
-                        if (comma.wasParsed())
-                        {
-                            pos = comma.nextPos();
-                        }
-                        else
-                        {
-                            showInputHelpMessage();
-                            goto inputLoop;
-                        }
-                    }
-
-                    const auto num = inputExpression(pos, *this);
-                    if (num.wasParsed())
-                    {
-                        lv.setValue(num.value(), *this);
-                        pos = num.nextPos();
-                    }
-                    else
-                    {
-                        showInputHelpMessage();
-                        goto inputLoop;
-                    }
+                    // The rest of the values come from the next line
+                    break;
                 }
-
-                // If we get here, we've read input for all the variables
-                switch (stateBeforeInput)
+                if (pos.isAtEndOfLine() || pos.at() != ',')
                 {
-                    case InterpreterStateRunning:
-                        st = InterpreterStateRunning;
-                        break;
-                    default:
-                        st = InterpreterStateIdle;
-                        break;
+                    isValid = false;
+                    break;
                 }
+                pos = pos.next();
+            }
 
-                return;
+            const auto integer = inputInteger(pos);
+            const auto num = integer.wasParsed() ? integer : inputExpression(pos, *this);
+            if (!num.wasParsed())
+            {
+                isValid = false;
+                break;
             }
-            break;
 
-            case InputResultKindWaiting:
-                st = InterpreterStateReadingInput;
-                return;
+            lv.setValue(num.value(), *this);
+            pos = num.nextPos();
+            ++assignedCount;
+        }
 
-            case InputResultKindEndOfStream:
-                abortRunWithErrorMessage("error: INPUT - end of input stream");
-                return;
+        if (!isValid)
+        {
+            discardInputValues();
+            showInputHelpMessage();
+            continue;
+        }
+
+        if (assignedCount < inputLvalues.size())
+        {
+            inputLvalues.erase(inputLvalues.begin(), inputLvalues.begin() + assignedCount);
+            discardInputValues();
+            flushOutput();
+            [interpreter.io showInputPromptForInterpreter:interpreter];
+            continue;
+        }
 
+        // If we get here, we've read input for all the variables.  Any
+        // values following a comma are kept for the next INPUT.
+        const auto rest = pos.afterSpaces();
+        if (stateBeforeInput == InterpreterStateRunning && !rest.isAtEndOfLine() &&
+            rest.at() == ',')
+        {
+            inputValuesIndex = rest.index + 1;
+        }
+        else
+        {
+            discardInputValues();
+        }
+
+        finishInput();
+        switch (stateBeforeInput)
+        {
+            case InterpreterStateRunning:
+                st = InterpreterStateRunning;
+                break;
             default:
-                // Should be no other cases
-                assert(false);
-                abortRunWithErrorMessage("error: INPUT - invalid internal state");
-                return;
+                st = InterpreterStateIdle;
+                break;
         }
+
+        return;
     }
 }
 
+/// Discard the lvalues of a completed or aborted INPUT operation
+void InterpreterEngine::finishInput()
+{
+    inputLvalues.clear();
+    inputLvaluesArena = nullptr;
+}
+
+bool InterpreterEngine::hasInputValues() const
+{
+    return !InputPos{inputValues, inputValuesIndex}.isRemainingLineEmpty();
+}
+
+void InterpreterEngine::discardInputValues()
+{
+    inputValues.clear();
+    inputValuesIndex = 0;
+}
+
 /// Execute a DIM statement
 void InterpreterEngine::DIM(const Expression &expr)
 {
@@ -1162,26 +2551,65 @@ void InterpreterEngine::DIM(const Expression &expr)
         return;
     }
 
-    a.clear();
-    a.resize(newCount, 0);
+    a.reset(newCount);
+}
+
+/// Execute a RANDOMIZE statement
+void InterpreterEngine::RANDOMIZE(const Expression &expr)
+{
+    // Every engine given the same seed produces the same sequence, so
+    // the stream is fixed.
+    const auto seed = evaluate(expr);
+    rng.seed(static_cast<uint64_t>(static_cast<int64_t>(seed)), 0);
+}
+
+/// Execute a FILL statement
+void InterpreterEngine::FILL(const Expression &first, const Expression &count,
+                             const Expression &value)
+{
+    const auto firstValue = evaluate(first);
+    const auto countValue = evaluate(count);
+    a.fill(firstValue, countValue, evaluate(value));
+}
+
+/// Execute a COPY statement
+void InterpreterEngine::COPY(const Expression &source, const Expression &destination,
+                             const Expression &count)
+{
+    const auto sourceValue = evaluate(source);
+    const auto destinationValue = evaluate(destination);
+    a.copy(sourceValue, destinationValue, evaluate(count));
 }
 
 /// Execute a SAVE statement
 void InterpreterEngine::SAVE(const string &filename)
 {
+    const ScopedSignpost signpost{SignpostName::Save};
+    const auto start = std::chrono::steady_clock::now();
+
     const auto file = fopen(filename.c_str(), "w");
     if (file)
     {
-        for (const auto &line : program)
+        // The listing is built in a buffer that is kept between SAVEs,
+        // and written with a single call.
+        saveBuffer.clear();
+        appendProgramText(saveBuffer);
+        const auto written = fwrite(saveBuffer.data(), 1, saveBuffer.size(), file);
+        const auto writeFailed = written != saveBuffer.size();
+        const auto closeFailed = fclose(file) != 0;
+        if (writeFailed || closeFailed)
         {
             auto s = ostringstream{};
-            s << line.lineNumber << " " << line.statement.listText() << "\n";
-            const auto outputString = s.str();
-            const char *outputChars = outputString.c_str();
-            const auto outputLength = strlen(outputChars);
-            fwrite(outputChars, 1, outputLength, file);
+            s << "error: SAVE - write error for file \"" << filename << ": "
+              << strerror(errno);
+            abortRunWithErrorMessage(s.str());
+            return;
         }
-        fclose(file);
+
+        metrics.saveCount.add(1);
+        metrics.saveBytes.add(saveBuffer.size());
+        metrics.saveNanoseconds.add(
+            nanosecondsBetween(start, std::chrono::steady_clock::now()));
     }
     else
     {
@@ -1195,36 +2623,26 @@ void InterpreterEngine::SAVE(const string &filename)
 /// Execute a LOAD statement
 void InterpreterEngine::LOAD(const string &filename)
 {
+    const ScopedSignpost signpost{SignpostName::Load};
+    const auto start = std::chrono::steady_clock::now();
+
     auto file = fopen(filename.c_str(), "r");
     if (file)
     {
-        // Read lines until end-of-stream or error
-        auto keepGoing = bool{true};
-        do
+        // Read the whole file, then interpret it
+        vec<char> contents;
+        const size_t chunkSize = 64 * 1024;
+        auto length = size_t{0};
+        for (;;)
         {
-            const auto inputLineResult = getInputLine([file]() -> InputCharResult
-                                                      {
-                const auto c = fgetc(file);
-                return c == EOF ? InputCharResult_EndOfStream() : InputCharResult_Value(c);
-            });
-
-            switch (inputLineResult.kind)
+            contents.resize(length + chunkSize);
+            const auto count = fread(contents.data() + length, 1, chunkSize, file);
+            length += count;
+            if (count < chunkSize)
             {
-                case InputResultKindValue:
-                    processInput(inputLineResult.value);
-                    break;
-
-                case InputResultKindEndOfStream:
-                    keepGoing = false;
-                    break;
-
-                default:
-                    // getInputLine() for file should only return Value or EndOfStream
-                    assert(false);
-                    keepGoing = false;
-                    break;
+                break;
             }
-        } while (keepGoing);
+        }
 
         // If we got an error, report it
         if (ferror(file) != 0)
@@ -1232,10 +2650,17 @@ void InterpreterEngine::LOAD(const string &filename)
             auto s = ostringstream{};
             s << "error: LOAD - read error for file \"" << filename << ": "
               << strerror(errno);
+            fclose(file);
             abortRunWithErrorMessage(s.str());
+            return;
         }
 
         fclose(file);
+        interpretText(contents.data(), length);
+
+        metrics.loadCount.add(1);
+        metrics.loadBytes.add(length);
+        metrics.loadNanoseconds.add(nanosecondsBetween(start, std::chrono::steady_clock::now()));
     }
     else
     {
@@ -1312,4 +2737,100 @@ void InterpreterEngine::TROFF()
     isTraceOn = false;
 }
 
+/// Execute a PROFILE statement
+void InterpreterEngine::PROFILE()
+{
+    // Reset the statistics in place, as a running line may hold a reference
+    // to one of them
+    for (auto &profile : lineProfiles)
+    {
+        profile.hits = 0;
+        profile.gosubCalls = 0;
+        profile.time = {};
+    }
+    isProfiling = true;
+}
+
+/// Execute an UNPROFILE statement
+///
+/// Stops profiling and lists the lines that were executed, with the
+/// number of times each was executed, the total time spent executing it,
+/// and the number of GOSUBs to it, in order of descending time.
+void InterpreterEngine::UNPROFILE()
+{
+    isProfiling = false;
+
+    writeOutput("    HITS     USEC  GOSUBS  LINE\n");
+    for (const auto &profile : sortedLineProfiles())
+    {
+        const auto usec =
+            std::chrono::duration_cast<std::chrono::microseconds>(profile.time).count();
+
+        ostringstream s;
+        s << std::setw(8) << profile.hits << " "
+          << std::setw(8) << usec << " "
+          << std::setw(7) << profile.gosubCalls << "  "
+          << profile.lineNumber;
+        const auto it = programLineWithNumber(profile.lineNumber);
+        if (it != program->end())
+        {
+            s << " " << it->statement.listText();
+        }
+        s << "\n";
+        writeOutput(s.str());
+    }
+}
+
+NSArray *InterpreterEngine::profileReport()
+{
+    const auto profiles = sortedLineProfiles();
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:profiles.size()];
+    for (const auto &profile : profiles)
+    {
+        const auto seconds =
+            std::chrono::duration_cast<std::chrono::duration<double>>(profile.time).count();
+        [result addObject:@{
+            InterpreterProfileLineNumberKey : @(static_cast<long long>(profile.lineNumber)),
+            InterpreterProfileHitsKey : @(profile.hits),
+            InterpreterProfileSecondsKey : @(seconds),
+            InterpreterProfileGosubCallsKey : @(profile.gosubCalls)
+        }];
+    }
+    return result;
+}
+
+/// Convert nanoseconds to seconds
+static double secondsFromNanoseconds(uint64_t nanoseconds)
+{
+    return static_cast<double>(nanoseconds) / 1e9;
+}
+
+NSDictionary *InterpreterEngine::metricsReport() const
+{
+    const auto &m = metrics;
+
+    NSMutableArray *histogram = [NSMutableArray arrayWithCapacity:DurationBucketCount];
+    for (auto i = size_t{0}; i < DurationBucketCount; ++i)
+    {
+        [histogram addObject:@(m.parseTimes.bucketCount(i))];
+    }
+
+    return @{
+        InterpreterMetricsStatementsExecutedKey : @(m.statementsExecuted.get()),
+        InterpreterMetricsMaxGosubDepthKey : @(m.maxGosubDepth.get()),
+        InterpreterMetricsLinesParsedKey : @(m.parseTimes.durationCount()),
+        InterpreterMetricsParseSecondsKey : @(secondsFromNanoseconds(m.parseTimes.nanoseconds())),
+        InterpreterMetricsParseTimeHistogramKey : histogram,
+        InterpreterMetricsLoadCountKey : @(m.loadCount.get()),
+        InterpreterMetricsLoadBytesKey : @(m.loadBytes.get()),
+        InterpreterMetricsLoadSecondsKey : @(secondsFromNanoseconds(m.loadNanoseconds.get())),
+        InterpreterMetricsSaveCountKey : @(m.saveCount.get()),
+        InterpreterMetricsSaveBytesKey : @(m.saveBytes.get()),
+        InterpreterMetricsSaveSecondsKey : @(secondsFromNanoseconds(m.saveNanoseconds.get())),
+        InterpreterMetricsOutputCharsKey : @(m.outputChars.get()),
+        InterpreterMetricsInputWaitsKey : @(m.inputWaits.get()),
+        InterpreterMetricsNativeLinesExecutedKey : @(m.nativeLinesExecuted.get())
+    };
+}
+
 }  // namespace finchlib_cpp
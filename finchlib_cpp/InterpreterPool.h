@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#import <Foundation/Foundation.h>
+
+@class Interpreter;
+
+// Note: This file is included by Objective-C and Swift code,
+// so it must not contain any C++ declarations.
+
+/// Output of a program run by an InterpreterPool
+@interface InterpreterPoolResult : NSObject
+
+/// Characters written by the program, decoded as UTF-8
+@property (nonatomic, readonly, copy) NSString *output;
+
+/// Messages passed to `showErrorMessage:forInterpreter:`, in order
+@property (nonatomic, readonly, copy) NSArray *errorMessages;
+
+/// YES if the program was stopped because it reached the pool's
+/// `statementLimit`
+@property (nonatomic, readonly) BOOL didReachStatementLimit;
+
+@end
+
+/// Runs a batch of programs concurrently, each in its own Interpreter
+///
+/// Each job is given to the interpreter as if it were typed: the program
+/// text, then a `RUN` command, then the input deck, which supplies the data
+/// read by INPUT statements.  The job ends when all of that has been read,
+/// or when BYE is executed.
+///
+/// Jobs are handed out to worker threads one at a time as the workers
+/// become free, so a few long-running jobs do not hold up the rest.
+@interface InterpreterPool : NSObject
+
+/// Initialize with one worker per active processor
+- (instancetype)init;
+
+/// Initialize with the given number of workers
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount;
+
+/// Number of jobs that may run at the same time
+@property (nonatomic, readonly) NSUInteger workerCount;
+
+/// Maximum number of interpreter operations for each job, or 0 for no limit
+///
+/// A limit keeps a program that never ends from occupying a worker forever.
+@property (nonatomic) NSUInteger statementLimit;
+
+/// Run programs and return their results
+///
+/// `programs` and `inputDecks` are arrays of NSString.  `inputDecks` may
+/// be nil, or shorter than `programs`, in which case the remaining
+/// programs get no input.  The result has an InterpreterPoolResult for
+/// each program, in the same order as `programs`.
+///
+/// Blocks until all the programs have finished.  Programs must not use
+/// CLIPSAVE or CLIPLOAD, which require the main thread.
+- (NSArray *)runPrograms:(NSArray *)programs inputDecks:(NSArray *)inputDecks;
+
+/// Run forks of an interpreter and return their results
+///
+/// Each element of `inputs` is an NSString that is given to its own fork of
+/// `interpreter` as if it were typed.  Typically it sets a few variables or
+/// array elements and then uses `GOTO` to start the program, as `RUN` would
+/// set them all to zero.  The result has an InterpreterPoolResult for each
+/// input, in the same order as `inputs`.
+///
+/// The forks share the program and array of `interpreter`, so unlike
+/// `runPrograms:inputDecks:`, the program is not parsed and compiled again
+/// for each job.  Each fork's `RND()` numbers depend on its position in
+/// `inputs`, so running the same inputs again gives the same results.
+/// `interpreter` must not be used until this returns.  See
+/// `-[Interpreter forkWithInterpreterIO:forkIndex:]`.
+- (NSArray *)runForksOfInterpreter:(Interpreter *)interpreter inputs:(NSArray *)inputs;
+
+@end
@@ -0,0 +1,324 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#import "InterpreterPool.h"
+#import "Interpreter.h"
+#include "cppdefs.h"
+
+#include <atomic>
+#include <cstring>
+
+using namespace finchlib_cpp;
+
+
+#pragma mark - InterpreterPoolResult
+
+@interface InterpreterPoolResult ()
+
+- (instancetype)initWithOutput:(NSString *)output
+                 errorMessages:(NSArray *)errorMessages
+        didReachStatementLimit:(BOOL)didReachStatementLimit;
+
+@end
+
+@implementation InterpreterPoolResult
+
+- (instancetype)initWithOutput:(NSString *)output
+                 errorMessages:(NSArray *)errorMessages
+        didReachStatementLimit:(BOOL)didReachStatementLimit
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    _output = [output copy];
+    _errorMessages = [errorMessages copy];
+    _didReachStatementLimit = didReachStatementLimit;
+
+    return self;
+}
+
+@end
+
+
+#pragma mark - InterpreterPoolIO
+
+/// InterpreterIO for one job of an InterpreterPool
+///
+/// Reads from a buffer holding the job's input, and collects the output
+/// and error messages.  All calls come from the worker running the job.
+@interface InterpreterPoolIO : NSObject <InterpreterIO>
+
+- (instancetype)initWithInput:(NSData *)input;
+
+@property (nonatomic, readonly) NSMutableData *output;
+@property (nonatomic, readonly) NSMutableArray *errorMessages;
+
+@end
+
+@implementation InterpreterPoolIO
+{
+    NSData *_input;
+    NSUInteger _inputIndex;
+    BOOL _hasExecutedBye;
+}
+
+- (instancetype)initWithInput:(NSData *)input
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    _input = input;
+    _output = [NSMutableData data];
+    _errorMessages = [NSMutableArray array];
+
+    return self;
+}
+
+- (InputCharResult)getInputCharForInterpreter:(Interpreter *)interpreter
+{
+    if (_hasExecutedBye || _inputIndex >= _input.length)
+    {
+        return InputCharResult_EndOfStream();
+    }
+    const Char c = static_cast<const Char *>(_input.bytes)[_inputIndex++];
+    return InputCharResult_Value(c);
+}
+
+- (InputResultKind)getInputChars:(Char *)buffer
+                       maxLength:(NSUInteger)maxLength
+                           count:(NSUInteger *)count
+                  forInterpreter:(Interpreter *)interpreter
+{
+    if (_hasExecutedBye || _inputIndex >= _input.length)
+    {
+        *count = 0;
+        return InputResultKindEndOfStream;
+    }
+    const NSUInteger n = MIN(maxLength, _input.length - _inputIndex);
+    std::memcpy(buffer, static_cast<const Char *>(_input.bytes) + _inputIndex, n);
+    _inputIndex += n;
+    *count = n;
+    return InputResultKindValue;
+}
+
+- (void)putOutputChar:(Char)c forInterpreter:(Interpreter *)interpreter
+{
+    [_output appendBytes:&c length:1];
+}
+
+- (void)putOutputChars:(const Char *)chars
+                length:(NSUInteger)length
+        forInterpreter:(Interpreter *)interpreter
+{
+    [_output appendBytes:chars length:length];
+}
+
+- (void)showCommandPromptForInterpreter:(Interpreter *)interpreter
+{
+    // no prompts
+}
+
+- (void)showInputPromptForInterpreter:(Interpreter *)interpreter
+{
+    // no prompts
+}
+
+- (void)showErrorMessage:(NSString *)message
+          forInterpreter:(Interpreter *)interpreter
+{
+    [_errorMessages addObject:message];
+}
+
+- (void)showDebugTraceMessage:(NSString *)message
+               forInterpreter:(Interpreter *)interpreter
+{
+    // trace output is discarded
+}
+
+- (void)byeForInterpreter:(Interpreter *)interpreter
+{
+    // Ignore the rest of the input, so that the job ends
+    _hasExecutedBye = YES;
+}
+
+@end
+
+
+#pragma mark - InterpreterPool
+
+@implementation InterpreterPool
+
+- (instancetype)init
+{
+    return [self initWithWorkerCount:[NSProcessInfo processInfo].activeProcessorCount];
+}
+
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount
+{
+    self = [super init];
+    if (!self)
+        return nil;
+
+    _workerCount = workerCount > 0 ? workerCount : 1;
+
+    return self;
+}
+
+/// Return the characters to be read by the interpreter for a job
+static NSData *inputForJob(NSString *program, NSString *inputDeck)
+{
+    NSMutableData *input = [[program dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    if (input.length > 0 && static_cast<const char *>(input.bytes)[input.length - 1] != '\n')
+    {
+        [input appendBytes:"\n" length:1];
+    }
+    [input appendBytes:"RUN\n" length:4];
+    if (inputDeck)
+    {
+        [input appendData:[inputDeck dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    return input;
+}
+
+/// Run an interpreter until it has read all of its input, on the calling
+/// thread
+static InterpreterPoolResult *runInterpreter(Interpreter *interpreter, InterpreterPoolIO *io,
+                                             NSUInteger statementLimit)
+{
+    BOOL didReachStatementLimit = NO;
+    if (statementLimit == 0)
+    {
+        [interpreter runUntilEndOfInput];
+    }
+    else
+    {
+        // The budget starts again each time a program ends, so that
+        // the limit applies to each RUN rather than to the whole job.
+        for (;;)
+        {
+            const auto reason = [interpreter runForStatementBudget:statementLimit];
+            if (reason == InterpreterStopReasonBudgetExhausted)
+            {
+                didReachStatementLimit = YES;
+                break;
+            }
+            if (reason == InterpreterStopReasonEndOfInput)
+            {
+                break;
+            }
+        }
+    }
+
+    NSString *output = [[NSString alloc] initWithData:io.output encoding:NSUTF8StringEncoding];
+    if (!output)
+    {
+        // Programs can print characters that are not valid UTF-8
+        output = [[NSString alloc] initWithData:io.output encoding:NSISOLatin1StringEncoding];
+    }
+
+    return [[InterpreterPoolResult alloc] initWithOutput:output
+                                           errorMessages:io.errorMessages
+                                  didReachStatementLimit:didReachStatementLimit];
+}
+
+/// Run one job on the calling thread
+static InterpreterPoolResult *runJob(NSString *program, NSString *inputDeck,
+                                     NSUInteger statementLimit)
+{
+    InterpreterPoolIO *io = [[InterpreterPoolIO alloc] initWithInput:inputForJob(program, inputDeck)];
+    Interpreter *interpreter = [[Interpreter alloc] initWithInterpreterIO:io];
+    return runInterpreter(interpreter, io, statementLimit);
+}
+
+/// Run one fork of an interpreter on the calling thread
+static InterpreterPoolResult *runFork(Interpreter *prototype, NSString *input,
+                                      NSUInteger job, NSUInteger statementLimit)
+{
+    InterpreterPoolIO *io =
+        [[InterpreterPoolIO alloc] initWithInput:[input dataUsingEncoding:NSUTF8StringEncoding]];
+    Interpreter *interpreter = [prototype forkWithInterpreterIO:io forkIndex:job];
+    return runInterpreter(interpreter, io, statementLimit);
+}
+
+/// Call `runJobAtIndex` for each job on the pool's workers, and return the
+/// results in order
+///
+/// Each worker takes the next job that nobody has started, until there are
+/// none left.  Each job writes only its own result slot.
+- (NSArray *)resultsOfJobCount:(NSUInteger)jobCount
+                 runJobAtIndex:(InterpreterPoolResult * (^)(NSUInteger job))runJobAtIndex
+{
+    vec<id> results(jobCount);
+    std::atomic<NSUInteger> nextJob{0};
+
+    auto resultsPtr = &results;
+    auto nextJobPtr = &nextJob;
+
+    const size_t workers = MIN(self.workerCount, jobCount);
+    dispatch_apply(workers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t) {
+        for (;;)
+        {
+            const NSUInteger job = nextJobPtr->fetch_add(1, std::memory_order_relaxed);
+            if (job >= jobCount)
+            {
+                break;
+            }
+
+            @autoreleasepool
+            {
+                (*resultsPtr)[job] = runJobAtIndex(job);
+            }
+        }
+    });
+
+    return [NSArray arrayWithObjects:results.data() count:jobCount];
+}
+
+- (NSArray *)runPrograms:(NSArray *)programs inputDecks:(NSArray *)inputDecks
+{
+    const NSUInteger statementLimit = self.statementLimit;
+    return [self resultsOfJobCount:programs.count
+                     runJobAtIndex:^InterpreterPoolResult *(NSUInteger job) {
+                         NSString *inputDeck = job < inputDecks.count ? inputDecks[job] : nil;
+                         return runJob(programs[job], inputDeck, statementLimit);
+                     }];
+}
+
+- (NSArray *)runForksOfInterpreter:(Interpreter *)interpreter inputs:(NSArray *)inputs
+{
+    // The workers fork a fork, which nothing else uses, so they can all do
+    // so at once.  Its index is fixed, and each job's fork is indexed by its
+    // position, so the same inputs always give the same RND() numbers.
+    Interpreter *prototype = [interpreter forkWithInterpreterIO:nil forkIndex:0];
+
+    const NSUInteger statementLimit = self.statementLimit;
+    return [self resultsOfJobCount:inputs.count
+                     runJobAtIndex:^InterpreterPoolResult *(NSUInteger job) {
+                         return runFork(prototype, inputs[job], job, statementLimit);
+                     }];
+}
+
+
+@end
@@ -0,0 +1,185 @@
+/*
+ Copyright (c) 2015 Kristopher Johnson
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __finchbasic__arena__
+#define __finchbasic__arena__
+
+#include "cppdefs.h"
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace finchlib_cpp
+{
+
+#pragma mark - NodeArena
+
+/// Allocator for syntax-tree nodes
+///
+/// Nodes are placed one after another in blocks, and are all destroyed
+/// together when the arena is destroyed.  Syntax elements refer to their
+/// nodes with plain pointers, so an arena must outlive every element
+/// allocated from it.
+///
+/// Lines that are parsed together, such as the lines of a LOAD, share an
+/// arena.  A line entered on its own has an arena whose first block is
+/// sized to fit it.  Each following block is twice the size of the one
+/// before it.  The list of blocks and the destructors of the nodes are kept
+/// in the blocks themselves, so an arena that needs one block is made with
+/// two allocations: the block and the arena.
+///
+/// The factory functions of the syntax elements allocate from the
+/// "current" arena of the calling thread, which is set by creating a
+/// `NodeArena::Scope`.
+class NodeArena
+{
+private:
+    struct Block;
+    struct Destructor;
+
+public:
+    /// Size of the first block of an arena, unless another is requested
+    static const size_t DefaultFirstBlockSize = 512;
+
+    /// Construct an arena whose first block holds at least `firstBlockSize`
+    /// bytes.  No memory is allocated until the first object is made.
+    explicit NodeArena(size_t firstBlockSize = DefaultFirstBlockSize);
+    ~NodeArena();
+
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator=(const NodeArena &) = delete;
+
+    /// Construct an object in the arena
+    template <typename T, typename... Args>
+    T *make(Args &&... args)
+    {
+        if (std::is_trivially_destructible<T>::value)
+        {
+            return new (allocate(sizeof(T), alignof(T)))
+                T(std::forward<Args>(args)...);
+        }
+
+        const auto destructor = static_cast<Destructor *>(
+            allocate(sizeof(Destructor), alignof(Destructor)));
+        const auto object = new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+        *destructor = {object, [](void *p)
+                       { static_cast<T *>(p)->~T(); }, lastDestructor};
+        lastDestructor = destructor;
+        return object;
+    }
+
+    /// Return total number of bytes used by objects in the arena
+    size_t bytesUsed() const { return used; }
+
+    /// Position of an arena, to which it can be rolled back
+    class Mark
+    {
+    private:
+        friend class NodeArena;
+        Block *lastBlock;
+        char *nextFree;
+        size_t available;
+        size_t used;
+        Destructor *lastDestructor;
+    };
+
+    /// Return the current position of the arena
+    Mark mark() const;
+
+    /// Destroy the objects made since `mark` was returned by mark(), and
+    /// release the blocks allocated for them
+    ///
+    /// This is used to discard the nodes of a line that could not be
+    /// parsed, when the arena is shared with other lines.
+    void rollBack(const Mark &mark);
+
+    /// Return the current arena for this thread
+    static NodeArena &current();
+
+    /// Makes an arena the current arena for this thread for the lifetime
+    /// of the Scope object.
+    ///
+    /// Scopes may be nested.  The previous arena is restored when the Scope
+    /// is destroyed.
+    class Scope
+    {
+    private:
+        NodeArena *previous;
+
+    public:
+        Scope(NodeArena &arena);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+private:
+    /// Header at the start of each block
+    struct Block
+    {
+        Block *previous;
+    };
+
+    /// Record of an object to be destroyed with the arena, placed just
+    /// before the object
+    struct Destructor
+    {
+        void *object;
+        void (*destroy)(void *);
+        Destructor *previous;
+    };
+
+    /// Size of the first block
+    size_t firstBlockSize;
+
+    /// Number of blocks allocated
+    size_t blockCount{0};
+
+    /// Last block allocated, which objects are placed in
+    Block *lastBlock{nullptr};
+
+    /// Next free byte in the last block
+    char *nextFree{nullptr};
+
+    /// Number of free bytes in the last block
+    size_t available{0};
+
+    /// Total number of bytes allocated to objects
+    size_t used{0};
+
+    /// Destructor of the last object that needs one
+    Destructor *lastDestructor{nullptr};
+
+    /// Return uninitialized memory for an object
+    void *allocate(size_t size, size_t alignment);
+
+    /// Destroy objects and release blocks back to a position
+    void releaseTo(Block *block, Destructor *destructor);
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__arena__) */
@@ -0,0 +1,162 @@
+/*
+ Copyright (c) 2015 Kristopher Johnson
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <pthread.h>
+
+using namespace finchlib_cpp;
+
+// Largest size of the blocks of memory allocated by an arena, other than
+// blocks for objects that are larger still
+static const size_t MaximumBlockSize = 16 * 1024;
+
+#pragma mark - Current arena
+
+// We use pthread-specific data rather than C++11 thread_local,
+// because thread_local is not available on older iOS versions.
+
+static pthread_key_t currentArenaKey;
+static pthread_once_t currentArenaKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createCurrentArenaKey()
+{
+    pthread_key_create(&currentArenaKey, nullptr);
+}
+
+static NodeArena *getCurrentArena()
+{
+    pthread_once(&currentArenaKeyOnce, createCurrentArenaKey);
+    return static_cast<NodeArena *>(pthread_getspecific(currentArenaKey));
+}
+
+static void setCurrentArena(NodeArena *arena)
+{
+    pthread_once(&currentArenaKeyOnce, createCurrentArenaKey);
+    pthread_setspecific(currentArenaKey, arena);
+}
+
+NodeArena &NodeArena::current()
+{
+    auto arena = getCurrentArena();
+    assert(arena != nullptr && "no NodeArena::Scope is active on this thread");
+    if (arena == nullptr)
+    {
+        // Should never happen.  Rather than crash, put the nodes
+        // in an arena that is never released.  Each thread gets its
+        // own, so that threads never allocate from the same arena.
+        arena = new NodeArena;
+        setCurrentArena(arena);
+    }
+    return *arena;
+}
+
+NodeArena::Scope::Scope(NodeArena &arena) : previous{getCurrentArena()}
+{
+    setCurrentArena(&arena);
+}
+
+NodeArena::Scope::~Scope()
+{
+    setCurrentArena(previous);
+}
+
+#pragma mark - NodeArena
+
+NodeArena::NodeArena(size_t firstBlockSize) : firstBlockSize{firstBlockSize}
+{
+}
+
+NodeArena::~NodeArena()
+{
+    releaseTo(nullptr, nullptr);
+}
+
+NodeArena::Mark NodeArena::mark() const
+{
+    auto m = Mark{};
+    m.lastBlock = lastBlock;
+    m.nextFree = nextFree;
+    m.available = available;
+    m.used = used;
+    m.lastDestructor = lastDestructor;
+    return m;
+}
+
+void NodeArena::rollBack(const Mark &mark)
+{
+    releaseTo(mark.lastBlock, mark.lastDestructor);
+    nextFree = mark.nextFree;
+    available = mark.available;
+    used = mark.used;
+}
+
+void NodeArena::releaseTo(Block *block, Destructor *destructor)
+{
+    // Destroy objects in the reverse of the order they were created
+    while (lastDestructor != destructor)
+    {
+        lastDestructor->destroy(lastDestructor->object);
+        lastDestructor = lastDestructor->previous;
+    }
+
+    while (lastBlock != block)
+    {
+        const auto previous = lastBlock->previous;
+        ::operator delete(lastBlock);
+        lastBlock = previous;
+        --blockCount;
+    }
+}
+
+void *NodeArena::allocate(size_t size, size_t alignment)
+{
+    auto padding = (alignment - reinterpret_cast<uintptr_t>(nextFree) % alignment) % alignment;
+    if (nextFree == nullptr || padding + size > available)
+    {
+        // Each block is twice the size of the one before it, up to the
+        // maximum, unless the first block was already larger than that
+        auto nextBlockSize = firstBlockSize;
+        for (size_t i = 0; i < blockCount && nextBlockSize < MaximumBlockSize; ++i)
+        {
+            nextBlockSize *= 2;
+        }
+        nextBlockSize = std::max(firstBlockSize, std::min(nextBlockSize, MaximumBlockSize));
+        const auto blockSize = sizeof(Block) + std::max(size + alignment, nextBlockSize);
+        const auto block = static_cast<Block *>(::operator new(blockSize));
+        block->previous = lastBlock;
+        lastBlock = block;
+        ++blockCount;
+        nextFree = reinterpret_cast<char *>(block + 1);
+        available = blockSize - sizeof(Block);
+        padding = (alignment - reinterpret_cast<uintptr_t>(nextFree) % alignment) % alignment;
+    }
+
+    const auto result = nextFree + padding;
+    nextFree += padding + size;
+    available -= padding + size;
+    used += size;
+    return result;
+}
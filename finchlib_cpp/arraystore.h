@@ -0,0 +1,242 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __finchbasic__arraystore__
+#define __finchbasic__arraystore__
+
+#include "Interpreter.h"
+
+#include "cppdefs.h"
+
+#include <cassert>
+
+namespace finchlib_cpp
+{
+
+#pragma mark - ArrayStore
+
+/// Storage for the elements of the "@()" array
+///
+/// Elements are kept in fixed-size pages, which are allocated the first
+/// time one of their elements is set.  A page that has never been written
+/// reads as zeros, so DIM of a large array costs only a table of page
+/// pointers, and programs that touch a few elements use a few pages.
+///
+/// Indexes wrap around the size of the array, so that a negative index
+/// counts back from the end.
+///
+/// A store made by `fork()` shares its pages with the original until one
+/// of them writes to a page, which then gets its own copy.  A page whose
+/// other sharers have all gone is written in place rather than copied.  The
+/// stores may be used on different threads, as a shared page is never
+/// written.
+class ArrayStore
+{
+public:
+    /// Number of elements in each page
+    static const size_t PageSize = 1024;
+
+    ArrayStore() = default;
+
+    explicit ArrayStore(size_t count) { reset(count); }
+
+    ArrayStore(ArrayStore &&) = default;
+    ArrayStore &operator=(ArrayStore &&) = default;
+
+    /// Return number of elements
+    size_t size() const { return count; }
+
+    /// Change the number of elements, and set them all to zero
+    void reset(size_t newCount);
+
+    /// Set all elements to zero, releasing the pages
+    void clear() { reset(count); }
+
+    /// Return the value of the element at a wrapped index
+    ///
+    /// An empty array reads as zero.
+    Number get(Number index) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        const auto i = wrap(index);
+        const auto page = pages[i / PageSize].elements.get();
+        return page ? page[i % PageSize] : 0;
+    }
+
+    /// Set the value of the element at a wrapped index
+    ///
+    /// Setting an element of an empty array has no effect.
+    void set(Number index, Number value)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        const auto i = wrap(index);
+        writablePage(i / PageSize)[i % PageSize] = value;
+    }
+
+    /// Set the value of the element at `index`, which must be less
+    /// than `size()`
+    void setAt(size_t index, Number value)
+    {
+        assert(index < count);
+        writablePage(index / PageSize)[index % PageSize] = value;
+    }
+
+    /// Return the number of pages, including those not yet allocated
+    size_t pageCount() const { return pages.size(); }
+
+    /// Return the number of elements of a page that are within the array
+    size_t pageLength(size_t pageIndex) const
+    {
+        const auto first = pageIndex * PageSize;
+        return count - first < PageSize ? count - first : PageSize;
+    }
+
+#pragma mark - Bulk operations
+
+    // These operate on `n` elements starting at a wrapped index.  The
+    // indexes of the range wrap around like those of single elements, so a
+    // range may continue from the end of the array to its start.  Nothing
+    // is done if `n` is less than 1.
+    //
+    // Each one gets or sets the elements of a page at once, rather than
+    // wrapping each index, so its loops can be vectorized.
+
+    /// Set the elements of a range to a value
+    ///
+    /// If the range is larger than the array, the result is the same as
+    /// setting its elements one at a time.
+    void fill(Number first, Number n, Number value);
+
+    /// Copy the elements of the range starting at `source` to the range
+    /// starting at `destination`
+    ///
+    /// All of the source elements are read before any are written, so the
+    /// ranges may overlap.  If the ranges are larger than the array, only
+    /// the last `size()` elements are copied, as those are the ones that a
+    /// copy of one element at a time would leave.
+    void copy(Number source, Number destination, Number n);
+
+    /// Return the sum of the elements of a range, wrapping around on
+    /// overflow
+    Number sum(Number first, Number n) const;
+
+    /// Return the smallest element of a range, or 0 if the range is empty
+    Number minimum(Number first, Number n) const;
+
+    /// Return the largest element of a range, or 0 if the range is empty
+    Number maximum(Number first, Number n) const;
+
+    /// Return the wrapped index of the first element of a range that is
+    /// equal to `value`, or -1 if there is none
+    Number find(Number value, Number first, Number n) const;
+
+    /// Return the elements of a page, or nullptr if the page has never
+    /// been written
+    const Number *page(size_t pageIndex) const { return pages[pageIndex].elements.get(); }
+
+    /// Return the elements of a page, allocating it, or copying it if it is
+    /// still shared, if necessary
+    Number *writablePage(size_t pageIndex)
+    {
+        auto &page = pages[pageIndex];
+        if (!page.isExclusive)
+        {
+            makeExclusive(page);
+        }
+        return page.elements.get();
+    }
+
+    /// Return a store with the same elements, sharing this store's pages
+    ArrayStore fork();
+
+    void swap(ArrayStore &other);
+
+private:
+    /// Number of elements
+    size_t count{0};
+
+    /// `count - 1` if count is a power of two, otherwise 0
+    size_t mask{0};
+
+    struct Page
+    {
+        /// The elements, or null if the page has never been written
+        sptr<Number> elements;
+
+        /// True if no other store shares the elements
+        bool isExclusive{false};
+    };
+
+    /// Pages of elements
+    vec<Page> pages;
+
+    /// Give a page elements that no other store shares
+    void makeExclusive(Page &page);
+
+    /// Call `f(pageIndex, offset, length)` for the part of the range of `n`
+    /// elements starting at element `start` that is in each page, in order,
+    /// until it returns false.  `n` must not be greater than `count`.
+    template <typename F>
+    void forEachSpan(size_t start, size_t n, F f) const;
+
+    /// Return the element index where a range of `n` elements starts, and
+    /// change `n` to the number of elements that a bulk operation that
+    /// visits each element at most once needs to visit
+    ///
+    /// Only the last `count` elements are kept from a range that is larger
+    /// than the array.  `n` must be at least 1, and `count` must not be 0.
+    size_t lastElementsOfRange(Number first, size_t &n) const;
+
+    /// Return the element index for a (possibly negative) Number index
+    size_t wrap(Number index) const
+    {
+        // Most indexes are already in range.  (A negative index converts
+        // to a very large size_t, so it fails this test.)
+        if (static_cast<size_t>(index) < count)
+        {
+            return static_cast<size_t>(index);
+        }
+        if (mask != 0)
+        {
+            // For a power-of-two size, the low bits of the two's-complement
+            // value are the remainder we want, even for a negative index.
+            return static_cast<size_t>(index) & mask;
+        }
+        auto remainder = static_cast<long long>(index) % static_cast<long long>(count);
+        if (remainder < 0)
+        {
+            remainder += static_cast<long long>(count);
+        }
+        return static_cast<size_t>(remainder);
+    }
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__arraystore__) */
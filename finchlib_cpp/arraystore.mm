@@ -0,0 +1,359 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "arraystore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+
+using namespace finchlib_cpp;
+
+#pragma mark - ArrayStore
+
+void ArrayStore::reset(size_t newCount)
+{
+    count = newCount;
+
+    // A size of 1 also has mask 0, but then every index wraps to 0
+    // through the general path anyway.
+    const auto isPowerOfTwo = newCount != 0 && (newCount & (newCount - 1)) == 0;
+    mask = isPowerOfTwo ? newCount - 1 : 0;
+
+    pages.clear();
+    pages.resize((newCount + PageSize - 1) / PageSize);
+}
+
+void ArrayStore::makeExclusive(Page &page)
+{
+    // If every store that shared the page has since dropped it, by being
+    // destroyed, reset, or writing its own copy, the page is this store's
+    // alone and needn't be copied.  Those stores release their references
+    // with a release decrement, so the fence orders their last reads of the
+    // page before this store's writes.
+    if (page.elements && page.elements.use_count() == 1)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        page.isExclusive = true;
+        return;
+    }
+
+    const auto elements = new Number[PageSize]();
+    if (page.elements)
+    {
+        std::copy(page.elements.get(), page.elements.get() + PageSize, elements);
+    }
+    page.elements.reset(elements, std::default_delete<Number[]>());
+    page.isExclusive = true;
+}
+
+ArrayStore ArrayStore::fork()
+{
+    // Neither store may write a shared page from now on, even if this one
+    // was its only owner until now.  A flag that is already clear is not
+    // written, so a store that has not been written since it was last
+    // forked can be forked on several threads at once.
+    auto result = ArrayStore{};
+    result.count = count;
+    result.mask = mask;
+    for (auto &page : pages)
+    {
+        if (page.isExclusive)
+        {
+            page.isExclusive = false;
+        }
+    }
+    result.pages = pages;
+    return result;
+}
+
+void ArrayStore::swap(ArrayStore &other)
+{
+    std::swap(count, other.count);
+    std::swap(mask, other.mask);
+    pages.swap(other.pages);
+}
+
+#pragma mark - Bulk operations
+
+template <typename F>
+void ArrayStore::forEachSpan(size_t start, size_t n, F f) const
+{
+    auto i = start;
+    while (n > 0)
+    {
+        const auto offset = i % PageSize;
+        const auto length = std::min({n, PageSize - offset, count - i});
+        if (!f(i / PageSize, offset, length))
+        {
+            return;
+        }
+        n -= length;
+        i += length;
+        if (i == count)
+        {
+            i = 0;
+        }
+    }
+}
+
+size_t ArrayStore::lastElementsOfRange(Number first, size_t &n) const
+{
+    auto start = wrap(first);
+    if (n > count)
+    {
+        start = (start + (n - count) % count) % count;
+        n = count;
+    }
+    return start;
+}
+
+// The kernels below are plain loops over contiguous elements, written so
+// that the compiler can vectorize them for whichever processor the library
+// is built for.
+
+/// Unsigned type used to add Numbers with wrap-around
+///
+/// It is at least as wide as `unsigned`, so that arithmetic on it is never
+/// promoted to a signed type.
+using Sum = std::conditional<sizeof(Number) < sizeof(unsigned), unsigned,
+                             std::make_unsigned<Number>::type>::type;
+
+static Sum sumOfElements(const Number *elements, size_t length)
+{
+    auto total = Sum{0};
+    for (auto i = size_t{0}; i < length; ++i)
+    {
+        total += static_cast<Sum>(elements[i]);
+    }
+    return total;
+}
+
+static Number minimumOfElements(const Number *elements, size_t length, Number result)
+{
+    for (auto i = size_t{0}; i < length; ++i)
+    {
+        result = elements[i] < result ? elements[i] : result;
+    }
+    return result;
+}
+
+static Number maximumOfElements(const Number *elements, size_t length, Number result)
+{
+    for (auto i = size_t{0}; i < length; ++i)
+    {
+        result = elements[i] > result ? elements[i] : result;
+    }
+    return result;
+}
+
+/// Return the index of the first element equal to `value`, or `length`
+static size_t findElement(const Number *elements, size_t length, Number value)
+{
+    // Test whole blocks without branching, and search only the block that
+    // has a match.
+    const size_t BlockSize = 16;
+    auto i = size_t{0};
+    for (; i + BlockSize <= length; i += BlockSize)
+    {
+        auto isFound = false;
+        for (auto j = size_t{0}; j < BlockSize; ++j)
+        {
+            isFound |= elements[i + j] == value;
+        }
+        if (isFound)
+        {
+            break;
+        }
+    }
+    for (; i < length; ++i)
+    {
+        if (elements[i] == value)
+        {
+            return i;
+        }
+    }
+    return length;
+}
+
+void ArrayStore::fill(Number first, Number n, Number value)
+{
+    if (n < 1 || count == 0)
+    {
+        return;
+    }
+
+    auto length = static_cast<size_t>(n);
+    const auto start = lastElementsOfRange(first, length);
+    forEachSpan(start, length, [this, value](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    // A page that has never been written is already zero
+                    if (value != 0 || page(pageIndex) != nullptr)
+                    {
+                        std::fill_n(writablePage(pageIndex) + offset, spanLength, value);
+                    }
+                    return true;
+                });
+}
+
+void ArrayStore::copy(Number source, Number destination, Number n)
+{
+    if (n < 1 || count == 0)
+    {
+        return;
+    }
+
+    // The source and destination ranges are the same length, so the same
+    // elements are dropped from both.
+    auto length = static_cast<size_t>(n);
+    const auto sourceStart = lastElementsOfRange(source, length);
+    auto destinationLength = static_cast<size_t>(n);
+    const auto destinationStart = lastElementsOfRange(destination, destinationLength);
+    if (sourceStart == destinationStart)
+    {
+        return;
+    }
+
+    auto values = vec<Number>(length);
+    auto next = values.data();
+    forEachSpan(sourceStart, length, [this, &next](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    const auto elements = page(pageIndex);
+                    if (elements)
+                    {
+                        std::copy(elements + offset, elements + offset + spanLength, next);
+                    }
+                    next += spanLength;
+                    return true;
+                });
+
+    auto from = values.cbegin();
+    forEachSpan(destinationStart, length, [this, &from](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    std::copy(from, from + spanLength, writablePage(pageIndex) + offset);
+                    from += spanLength;
+                    return true;
+                });
+}
+
+Number ArrayStore::sum(Number first, Number n) const
+{
+    if (n < 1 || count == 0)
+    {
+        return 0;
+    }
+
+    // A range larger than the array adds every element some number of
+    // times, and then adds the elements of a shorter range.
+    auto length = static_cast<size_t>(n);
+    auto total = Sum{0};
+    if (length > count)
+    {
+        total = static_cast<Sum>(sum(0, static_cast<Number>(count))) *
+                static_cast<Sum>(length / count);
+        length %= count;
+    }
+
+    forEachSpan(wrap(first), length, [this, &total](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    if (const auto elements = page(pageIndex))
+                    {
+                        total += sumOfElements(elements + offset, spanLength);
+                    }
+                    return true;
+                });
+    return static_cast<Number>(total);
+}
+
+Number ArrayStore::minimum(Number first, Number n) const
+{
+    if (n < 1 || count == 0)
+    {
+        return 0;
+    }
+
+    auto length = static_cast<size_t>(n);
+    const auto start = lastElementsOfRange(first, length);
+    auto result = numeric_limits<Number>::max();
+    forEachSpan(start, length, [this, &result](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    const auto elements = page(pageIndex);
+                    result = elements ? minimumOfElements(elements + offset, spanLength, result)
+                                      : std::min(result, Number{0});
+                    return true;
+                });
+    return result;
+}
+
+Number ArrayStore::maximum(Number first, Number n) const
+{
+    if (n < 1 || count == 0)
+    {
+        return 0;
+    }
+
+    auto length = static_cast<size_t>(n);
+    const auto start = lastElementsOfRange(first, length);
+    auto result = numeric_limits<Number>::min();
+    forEachSpan(start, length, [this, &result](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    const auto elements = page(pageIndex);
+                    result = elements ? maximumOfElements(elements + offset, spanLength, result)
+                                      : std::max(result, Number{0});
+                    return true;
+                });
+    return result;
+}
+
+Number ArrayStore::find(Number value, Number first, Number n) const
+{
+    if (n < 1 || count == 0)
+    {
+        return -1;
+    }
+
+    // Every element is visited by the first `count` elements of the range
+    auto length = std::min(static_cast<size_t>(n), count);
+    auto result = Number{-1};
+    forEachSpan(wrap(first), length, [this, value, &result](size_t pageIndex, size_t offset, size_t spanLength)
+                {
+                    const auto elements = page(pageIndex);
+                    auto i = size_t{0};
+                    if (elements)
+                    {
+                        i = findElement(elements + offset, spanLength, value);
+                    }
+                    else if (value != 0)
+                    {
+                        i = spanLength;
+                    }
+
+                    if (i < spanLength)
+                    {
+                        result = static_cast<Number>(pageIndex * PageSize + offset + i);
+                        return false;
+                    }
+                    return true;
+                });
+    return result;
+}
@@ -0,0 +1,247 @@
+/*
+ Copyright (c) 2015 Kristopher Johnson
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __finchbasic__bytecode__
+#define __finchbasic__bytecode__
+
+#include "syntax.h"
+
+namespace finchlib_cpp
+{
+
+#pragma mark - Opcode
+
+/// Operation performed by a bytecode Instruction
+///
+/// Expressions are evaluated using a stack.  Each program line
+/// is compiled to a sequence of instructions ending with `EndLine`
+/// or with an instruction that transfers control to another line.
+enum class Opcode : uint8_t
+{
+    /// Push `operand` onto the stack
+    PushNumber,
+
+    /// Push the value of the variable named `operand`
+    PushVariable,
+
+    /// Replace subscript on top of stack with the value of that array element
+    PushArrayElement,
+
+    /// Replace value `n` on top of stack with `RND(n)`
+    Rnd,
+
+    /// Pop a count and then the index of the first element of a range of
+    /// the array, and push the sum, smallest, or largest of its elements
+    ArraySum,
+    ArrayMin,
+    ArrayMax,
+
+    /// Pop a count, the index of the first element of a range of the array,
+    /// and a value, and push the index of the first element of the range
+    /// equal to the value, or -1
+    ArrayFind,
+
+    /// Pop two values and push the result of the arithmetic operation
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+
+    /// Negate the value on top of stack
+    Negate,
+
+    /// Pop a value and assign it to the variable named `operand`
+    StoreVariable,
+
+    /// Pop a subscript and then a value, and assign the value to that array
+    /// element
+    StoreArrayElement,
+
+    /// Add `operand` to the variable named `variable`
+    ///
+    /// This replaces the code for `LET V = V + n` and `LET V = V - n`, the
+    /// step of a counted loop.
+    AddToVariable,
+
+    /// Pop two values, and skip the next `operand` instructions unless
+    /// the values satisfy `relation`
+    JumpUnless,
+
+    /// Continue execution at program index `operand`
+    Goto,
+
+    /// Pop two values, and continue execution at program index `operand` if
+    /// they satisfy `relation`
+    ///
+    /// This replaces a `JumpUnless` that skips only a `Goto`, the code for
+    /// `IF ... THEN GOTO n`, the test of a counted loop.
+    GotoIf,
+
+    /// Pop a line number and continue execution at that line
+    GotoLineNumber,
+
+    /// Push return address and continue execution at program index `operand`
+    Gosub,
+
+    /// Pop a line number, push return address, and continue execution at that
+    /// line
+    GosubLineNumber,
+
+    /// Execute RETURN
+    Return,
+
+    /// Execute END
+    End,
+
+    /// Execute element `operand` of the `statements` table using the syntax
+    /// tree
+    ///
+    /// This is used for statements that have no specialized instructions.
+    Execute,
+
+    /// End of the instructions for a program line
+    EndLine
+};
+
+/// A single bytecode instruction
+struct Instruction
+{
+    Opcode opcode;
+    RelOp::Kind relation;   // only used by JumpUnless and GotoIf
+    VariableName variable;  // only used by AddToVariable
+    Number operand;
+};
+
+#pragma mark - Bytecode
+
+/// Compiled form of a Program
+///
+/// A Bytecode object is built by `Bytecode::compile()` and executed by
+/// `InterpreterEngine`.  The syntax tree is still used to LIST and SAVE the
+/// program, and to execute any statement that has no specialized instructions.
+struct Bytecode
+{
+    /// Instructions for all lines of the program
+    vec<Instruction> code;
+
+    /// Index into `code` of the first instruction of each program line
+    vec<size_t> lineStart;
+
+    /// Statements executed by `Execute` instructions
+    vec<Statement> statements;
+
+    /// Maximum number of stack elements needed to evaluate any expression
+    size_t maxStackDepth{0};
+
+    /// Arenas holding the syntax-tree nodes of the program's lines
+    ///
+    /// This keeps the nodes used by `statements` alive even if lines are
+    /// replaced or the program is cleared while the code is running.
+    vec<sptr<NodeArena>> arenas;
+
+    /// Compile a program
+    static Bytecode compile(const Program &program);
+};
+
+#pragma mark - CodeBuilder
+
+/// Accumulates instructions while a Program is being compiled
+///
+/// The `compile()` methods of the syntax-tree elements call these methods
+/// to emit their code.
+///
+/// Arithmetic on constants is folded as it is emitted, so an expression
+/// like `(10*4)+2` compiles to a single `PushNumber 42`, and `I+0` compiles
+/// to `PushVariable I`.  The syntax tree is unchanged, so LIST and SAVE
+/// still show the expressions as they were entered.
+///
+/// The statements of Tiny BASIC loops are also recognized as they are
+/// emitted: `LET I = I + 1` compiles to `AddToVariable`, and
+/// `IF I < N THEN GOTO 100` compiles to the operands and a `GotoIf`.  These
+/// change only the instructions used for a line, so each line still
+/// executes as one step.
+class CodeBuilder
+{
+private:
+    const Program &program;
+    Bytecode &bytecode;
+    size_t stackDepth{0};
+
+public:
+    CodeBuilder(const Program &p, Bytecode &b) : program(p), bytecode(b) {}
+
+    /// Append an instruction
+    void emit(Opcode opcode, Number operand = 0);
+
+    /// Append an instruction for an arithmetic operation
+    void emit(const ArithOp &op);
+
+    /// Append a `JumpUnless` instruction whose target will be set by
+    /// `setJumpTargetToHere()`.
+    ///
+    /// Returns index of the instruction.
+    size_t emitJumpUnless(const RelOp &op);
+
+    /// Make the jump instruction at the specified index skip to
+    /// the next instruction to be emitted
+    void setJumpTargetToHere(size_t jumpIndex);
+
+    /// Emit code to transfer control to the line whose number is the value
+    /// of the expression.
+    ///
+    /// If the expression is a constant and the program has a line with
+    /// that number, `resolvedOpcode` is emitted with the line's index. Otherwise
+    /// the expression is evaluated and `lineNumberOpcode` is emitted.
+    void emitTransfer(const Expression &lineNumber, Opcode resolvedOpcode,
+                      Opcode lineNumberOpcode);
+
+    /// Emit an `Execute` instruction for a statement
+    void emitExecute(const Statement &statement);
+
+    /// Return the index of the program line with the specified number,
+    /// or -1 if there is no such line
+    Number lineIndexForNumber(Number lineNumber) const;
+
+private:
+    /// If the operands of the arithmetic operation are constants, or the
+    /// operation is an identity, rewrite the operand instructions to produce
+    /// the result.
+    ///
+    /// Returns true if the operation does not need to be emitted.
+    bool foldArithmetic(const ArithOp &op);
+
+    /// If the code just emitted is `PushVariable V`, `PushNumber n`, and
+    /// `Add` or `Subtract`, and the variable being stored is `V`, replace
+    /// those instructions with an `AddToVariable`.
+    ///
+    /// Returns true if the `StoreVariable` does not need to be emitted.
+    bool fuseIncrement(Number variableName);
+
+    /// Return true if the instruction `distanceFromEnd` positions from the end
+    /// of the code (1 is the last instruction) has the specified opcode
+    bool lastInstructionIs(Opcode opcode, size_t distanceFromEnd) const;
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__bytecode__) */
@@ -0,0 +1,315 @@
+/*
+ Copyright (c) 2015 Kristopher Johnson
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bytecode.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace finchlib_cpp;
+
+#pragma mark - Bytecode
+
+Bytecode Bytecode::compile(const Program &program)
+{
+    auto bytecode = Bytecode{};
+    for (const auto &line : program)
+    {
+        // Lines parsed together share an arena, and are usually next to
+        // each other in the program
+        if (bytecode.arenas.empty() || bytecode.arenas.back() != line.arena)
+        {
+            bytecode.arenas.push_back(line.arena);
+        }
+    }
+    bytecode.lineStart.reserve(program.size());
+
+    auto builder = CodeBuilder{program, bytecode};
+    for (const auto &line : program)
+    {
+        bytecode.lineStart.push_back(bytecode.code.size());
+        line.statement.compile(builder);
+        builder.emit(Opcode::EndLine);
+    }
+
+    return bytecode;
+}
+
+#pragma mark - CodeBuilder
+
+/// Return the change in stack depth caused by an instruction
+static int stackEffect(Opcode opcode)
+{
+    switch (opcode)
+    {
+        case Opcode::PushNumber:
+        case Opcode::PushVariable:
+            return 1;
+
+        case Opcode::ArraySum:
+        case Opcode::ArrayMin:
+        case Opcode::ArrayMax:
+        case Opcode::Add:
+        case Opcode::Subtract:
+        case Opcode::Multiply:
+        case Opcode::Divide:
+        case Opcode::StoreVariable:
+        case Opcode::GotoLineNumber:
+        case Opcode::GosubLineNumber:
+            return -1;
+
+        case Opcode::ArrayFind:
+        case Opcode::StoreArrayElement:
+        case Opcode::JumpUnless:
+        case Opcode::GotoIf:
+            return -2;
+
+        default:
+            return 0;
+    }
+}
+
+void CodeBuilder::emit(Opcode opcode, Number operand)
+{
+    if (opcode == Opcode::Negate && lastInstructionIs(Opcode::PushNumber, 1))
+    {
+        // Negate the constant in place
+        auto &constant = bytecode.code.back().operand;
+        constant = -constant;
+        return;
+    }
+
+    if (opcode == Opcode::StoreVariable && fuseIncrement(operand))
+    {
+        return;
+    }
+
+    bytecode.code.push_back({opcode, RelOp::Kind::Equal, 0, operand});
+
+    stackDepth += stackEffect(opcode);
+    bytecode.maxStackDepth = std::max(bytecode.maxStackDepth, stackDepth);
+}
+
+void CodeBuilder::emit(const ArithOp &op)
+{
+    if (foldArithmetic(op))
+    {
+        return;
+    }
+
+    switch (op.kind())
+    {
+        case ArithOp::Kind::Add:
+            emit(Opcode::Add);
+            break;
+        case ArithOp::Kind::Subtract:
+            emit(Opcode::Subtract);
+            break;
+        case ArithOp::Kind::Multiply:
+            emit(Opcode::Multiply);
+            break;
+        case ArithOp::Kind::Divide:
+            emit(Opcode::Divide);
+            break;
+    }
+}
+
+bool CodeBuilder::foldArithmetic(const ArithOp &op)
+{
+    auto &code = bytecode.code;
+    if (!lastInstructionIs(Opcode::PushNumber, 1))
+    {
+        // The only identities we can use with a non-constant right operand
+        // are "0 + x" and "1 * x".  We can only find the start of x if it is
+        // a single instruction.
+        const auto kind = op.kind();
+        if ((kind == ArithOp::Kind::Add || kind == ArithOp::Kind::Multiply) &&
+            lastInstructionIs(Opcode::PushVariable, 1) &&
+            lastInstructionIs(Opcode::PushNumber, 2))
+        {
+            const auto lhs = code[code.size() - 2].operand;
+            const auto identity = kind == ArithOp::Kind::Add ? 0 : 1;
+            if (lhs == identity)
+            {
+                code.erase(code.end() - 2);
+                stackDepth -= 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const auto rhs = code.back().operand;
+
+    if (lastInstructionIs(Opcode::PushNumber, 2))
+    {
+        // Both operands are constants, so replace them with the result.
+        //
+        // An instruction sequence for a value ends with the instruction
+        // that produces it, so a PushNumber just before the right operand
+        // is the whole left operand.
+        code.pop_back();
+        stackDepth -= 1;
+        auto &lhs = code.back().operand;
+        lhs = op.apply(lhs, rhs);
+        return true;
+    }
+
+    // "x + 0", "x - 0", "x * 1", and "x / 1" are just x
+    switch (op.kind())
+    {
+        case ArithOp::Kind::Add:
+        case ArithOp::Kind::Subtract:
+            if (rhs != 0)
+            {
+                return false;
+            }
+            break;
+        case ArithOp::Kind::Multiply:
+        case ArithOp::Kind::Divide:
+            if (rhs != 1)
+            {
+                return false;
+            }
+            break;
+    }
+    code.pop_back();
+    stackDepth -= 1;
+    return true;
+}
+
+bool CodeBuilder::fuseIncrement(Number variableName)
+{
+    auto &code = bytecode.code;
+    if (!lastInstructionIs(Opcode::PushVariable, 3) ||
+        !lastInstructionIs(Opcode::PushNumber, 2))
+    {
+        return false;
+    }
+
+    const auto &variable = code[code.size() - 3];
+    const auto n = code[code.size() - 2].operand;
+    if (variable.operand != variableName)
+    {
+        return false;
+    }
+
+    auto increment = Number{0};
+    if (lastInstructionIs(Opcode::Add, 1))
+    {
+        increment = n;
+    }
+    else if (lastInstructionIs(Opcode::Subtract, 1) &&
+             n != std::numeric_limits<Number>::min())
+    {
+        increment = -n;
+    }
+    else
+    {
+        return false;
+    }
+
+    code.erase(code.end() - 3, code.end());
+    stackDepth -= 1;
+    code.push_back({Opcode::AddToVariable, RelOp::Kind::Equal,
+                    static_cast<VariableName>(variableName), increment});
+    return true;
+}
+
+bool CodeBuilder::lastInstructionIs(Opcode opcode, size_t distanceFromEnd) const
+{
+    const auto &code = bytecode.code;
+    return code.size() >= distanceFromEnd &&
+           code[code.size() - distanceFromEnd].opcode == opcode;
+}
+
+size_t CodeBuilder::emitJumpUnless(const RelOp &op)
+{
+    const auto jumpIndex = bytecode.code.size();
+    emit(Opcode::JumpUnless);
+    bytecode.code[jumpIndex].relation = op.kind();
+    return jumpIndex;
+}
+
+void CodeBuilder::setJumpTargetToHere(size_t jumpIndex)
+{
+    auto &code = bytecode.code;
+    const auto distance = code.size() - (jumpIndex + 1);
+
+    // A jump over a single Goto is a conditional Goto
+    if (distance == 1 && lastInstructionIs(Opcode::Goto, 1))
+    {
+        auto &jump = code[jumpIndex];
+        jump.opcode = Opcode::GotoIf;
+        jump.operand = code.back().operand;
+        code.pop_back();
+        return;
+    }
+
+    code[jumpIndex].operand = static_cast<Number>(distance);
+}
+
+void CodeBuilder::emitTransfer(const Expression &lineNumber,
+                               Opcode resolvedOpcode,
+                               Opcode lineNumberOpcode)
+{
+    const auto start = bytecode.code.size();
+    lineNumber.compile(*this);
+
+    // If the expression compiled to a single constant, and there is a line
+    // with that number, replace it with a direct jump to the line's index.
+    const auto &code = bytecode.code;
+    if (code.size() == start + 1 && code.back().opcode == Opcode::PushNumber)
+    {
+        const auto index = lineIndexForNumber(code.back().operand);
+        if (index >= 0)
+        {
+            bytecode.code.pop_back();
+            stackDepth -= 1;
+            emit(resolvedOpcode, index);
+            return;
+        }
+    }
+
+    emit(lineNumberOpcode);
+}
+
+void CodeBuilder::emitExecute(const Statement &statement)
+{
+    const auto index = bytecode.statements.size();
+    bytecode.statements.push_back(statement);
+    emit(Opcode::Execute, static_cast<Number>(index));
+}
+
+Number CodeBuilder::lineIndexForNumber(Number lineNumber) const
+{
+    const auto it = std::lower_bound(program.begin(), program.end(), lineNumber,
+                                     [](const NumberedStatement &line, Number n)
+                                         -> bool
+                                     { return line.lineNumber < n; });
+    if (it == program.end() || it->lineNumber != lineNumber)
+    {
+        return -1;
+    }
+    return static_cast<Number>(it - program.begin());
+}
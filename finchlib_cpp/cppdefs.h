@@ -25,17 +25,40 @@
 #define finchlib_cpp_cppdefs_h
 
 #include <cctype>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
+// Number is the type of BASIC values, variables, and array elements.  Its
+// width is chosen when the library is built, by defining
+// FINCHLIB_NUMBER_BITS as 16, 32 (the default), or 64.  Only the engine
+// sees Number; the Objective-C interface uses types that hold any width.
+#ifndef FINCHLIB_NUMBER_BITS
+#define FINCHLIB_NUMBER_BITS 32
+#endif
+
 namespace finchlib_cpp
 {
 
+#if FINCHLIB_NUMBER_BITS == 16
+using Number = std::int16_t;
+#elif FINCHLIB_NUMBER_BITS == 32
+using Number = std::int32_t;
+#elif FINCHLIB_NUMBER_BITS == 64
+using Number = std::int64_t;
+#else
+#error "FINCHLIB_NUMBER_BITS must be 16, 32, or 64"
+#endif
+
+static_assert(sizeof(Number) * 8 == FINCHLIB_NUMBER_BITS,
+              "Number must have the width selected by FINCHLIB_NUMBER_BITS");
+
 // Bring these types and functions from the std namespace into our namespace
 using std::equal_to;
 using std::function;
@@ -57,6 +80,7 @@ using std::string;
 using std::pair;
 using std::toupper;
 using std::tuple;
+using std::unordered_map;
 
 // Use "sptr" as abbreviation for "std::shared_ptr"
 template <typename T>
@@ -4,3 +4,4 @@
 //
 
 #import "Interpreter.h"
+#import "InterpreterPool.h"
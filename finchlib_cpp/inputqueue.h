@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __finchbasic__inputqueue__
+#define __finchbasic__inputqueue__
+
+#import "Interpreter.h"
+#include "cppdefs.h"
+
+#include <mutex>
+
+namespace finchlib_cpp
+{
+
+#pragma mark - InputQueue
+
+/// Input pushed to an interpreter by its host
+///
+/// Unlike the rest of the interpreter, an InputQueue may be used by any
+/// thread.  The host pushes characters as they arrive, and the engine takes
+/// them when it needs input.
+///
+/// When the engine has to stop because there is no input, it records that
+/// it is waiting.  The next push then returns true, telling the host to
+/// resume the engine.  Both of these happen while the queue is locked, so
+/// input that arrives while the engine is deciding to wait is never missed.
+class InputQueue
+{
+private:
+    mutable std::mutex mutex;
+
+    /// Characters that have been pushed but not yet taken
+    vec<Char> chars;
+
+    /// True if pushEndOfInput() has been called
+    bool isAtEndOfInput{false};
+
+    /// True if anything has been pushed
+    bool isActive{false};
+
+    /// True if the engine stopped for input, and no push has yet reported it
+    bool isEngineWaiting{false};
+
+public:
+    /// Add characters to the end of the queue
+    ///
+    /// Returns true if the engine is waiting for input, in which case the
+    /// caller must arrange for it to be resumed.
+    bool push(const Char *newChars, size_t count)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        chars.insert(chars.end(), newChars, newChars + count);
+        return notePush();
+    }
+
+    /// Mark the end of the input
+    ///
+    /// Once the pushed characters have been taken, the engine sees the end
+    /// of the input stream.  Returns true as for `push()`.
+    bool pushEndOfInput()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        isAtEndOfInput = true;
+        return notePush();
+    }
+
+    /// Return true if anything has been pushed
+    ///
+    /// From then on, the engine reads its input only from the queue.
+    bool hasBeenUsed() const
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return isActive;
+    }
+
+    /// Move all pushed characters to the end of `buffer`
+    ///
+    /// Returns `InputResultKindValue` if there were any,
+    /// `InputResultKindEndOfStream` if there were none and the end of the
+    /// input has been pushed, or `InputResultKindWaiting` otherwise.
+    InputResultKind take(vec<Char> &buffer)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!chars.empty())
+        {
+            buffer.insert(buffer.end(), chars.begin(), chars.end());
+            chars.clear();
+            return InputResultKindValue;
+        }
+        return isAtEndOfInput ? InputResultKindEndOfStream : InputResultKindWaiting;
+    }
+
+    /// Record that the engine is about to stop because it is waiting for
+    /// input
+    ///
+    /// Returns false, recording nothing, if input has been pushed since the
+    /// engine last looked, so that it should look again instead of stopping.
+    bool markEngineWaiting()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!chars.empty() || isAtEndOfInput)
+        {
+            return false;
+        }
+        isEngineWaiting = true;
+        return true;
+    }
+
+private:
+    /// Update the state after a push, and return true if the engine was
+    /// waiting.  Must be called with the mutex locked.
+    bool notePush()
+    {
+        isActive = true;
+        const auto wasWaiting = isEngineWaiting;
+        isEngineWaiting = false;
+        return wasWaiting;
+    }
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__inputqueue__) */
@@ -0,0 +1,154 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __finchbasic__jit__
+#define __finchbasic__jit__
+
+#include "bytecode.h"
+#include "arraystore.h"
+#include "metrics.h"
+#include "prng.h"
+
+#include <atomic>
+
+#if defined(__APPLE__)
+#include <TargetConditionals.h>
+#endif
+
+// Hot program lines are compiled to native code if FINCHLIB_JIT is defined
+// as 1.  Only x86-64 code is generated, with 32-bit or 64-bit Numbers, and
+// never for iOS, which does not let applications make memory executable.
+// There is no arm64 backend: on arm64, including Apple silicon Macs, the
+// macro is ignored and every line is run as bytecode.
+#ifndef FINCHLIB_JIT
+#define FINCHLIB_JIT 0
+#endif
+
+#if FINCHLIB_JIT
+#if !defined(__x86_64__) || FINCHLIB_NUMBER_BITS == 16 || \
+    (defined(TARGET_OS_IPHONE) && TARGET_OS_IPHONE)
+#undef FINCHLIB_JIT
+#define FINCHLIB_JIT 0
+#endif
+#endif
+
+#if FINCHLIB_JIT
+
+namespace finchlib_cpp
+{
+
+#pragma mark - NativeState
+
+/// The parts of an InterpreterEngine that native code reads and changes
+struct NativeState
+{
+    /// Values of the variables A to Z
+    Number *variables;
+
+    ArrayStore *array;
+    RandomGenerator *rng;
+    ReturnStack *returnStack;
+    MetricCounter *maxGosubDepth;
+
+    /// Flag that is set when the host asks for a break
+    ///
+    /// Native code checks it as it starts each line, and returns if it is
+    /// set.
+    const std::atomic<bool> *breakRequested;
+
+    /// Number of lines that may be executed before returning
+    ///
+    /// Native code decrements this as it starts each line.
+    size_t linesRemaining;
+
+    /// Index of the line to be executed
+    ///
+    /// Native code sets this to the next line to be executed when it returns.
+    size_t lineIndex;
+};
+
+#pragma mark - NativeTier
+
+class NativeRegion;
+
+/// Compiles hot program lines to native code, and runs that code
+///
+/// Each line has a counter of the times it has been started by the
+/// interpreter.  When the count for a line reaches `HotLineThreshold`, the
+/// line and the run of consecutive lines after it that contain only
+/// assignments, arithmetic, array elements, RND, IF, GOTO, and GOSUB are
+/// compiled to a native function.  Up to four of the variables used by the
+/// lines are kept in registers while it runs.
+///
+/// Native code runs until it transfers control to a line outside the run,
+/// until the line budget is used up, or until a break is requested, so the
+/// interpreter still gets control back between time slices and on a break, and the line that stopped the native
+/// code (a PRINT, INPUT, RETURN, END, or computed GOTO) is always executed
+/// by the interpreter.
+///
+/// The native code is discarded when the program is recompiled.
+class NativeTier
+{
+public:
+    /// Number of times a line must be started before it is compiled
+    static const uint32_t HotLineThreshold = 64;
+
+    NativeTier();
+    ~NativeTier();
+
+    NativeTier(const NativeTier &) = delete;
+    NativeTier &operator=(const NativeTier &) = delete;
+
+    /// Count a start of the line at `state.lineIndex`, and if that line has
+    /// been compiled, run the native code.
+    ///
+    /// Returns the number of lines executed, updating `state`, or 0 if the
+    /// line must be executed by the interpreter.
+    size_t run(const sptr<const Bytecode> &bytecode, NativeState &state);
+
+private:
+    struct LineEntry
+    {
+        uint32_t starts{0};
+        bool isRejected{false};
+        NativeRegion *region{nullptr};
+    };
+
+    /// Code that the lines were compiled from
+    sptr<const Bytecode> code;
+
+    /// One entry per program line
+    vec<LineEntry> lines;
+
+    /// Functions compiled from `code`
+    vec<uptr<NativeRegion>> regions;
+
+    /// Discard compiled functions, and start counting for `bytecode`
+    void reset(const sptr<const Bytecode> &bytecode);
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* FINCHLIB_JIT */
+
+#endif /* defined(__finchbasic__jit__) */
@@ -0,0 +1,1043 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "jit.h"
+
+#if FINCHLIB_JIT
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace finchlib_cpp;
+
+namespace
+{
+
+#pragma mark - Registers and condition codes
+
+/// x86-64 general-purpose registers
+enum Register : unsigned
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15
+};
+
+// Registers used by the generated code:
+//
+//   RAX       top of the expression stack (the rest is on the machine stack)
+//   RCX, RDX  scratch
+//   RBX       NativeState
+//   RBP       variable values
+//   R12-R15   values of the most-used variables
+
+const Register PinnedRegisters[] = {R12, R13, R14, R15};
+
+/// Condition codes, as used in the Jcc opcodes
+enum Condition : uint8_t
+{
+    Equal = 0x4,
+    NotEqual = 0x5,
+    Less = 0xC,
+    GreaterOrEqual = 0xD,
+    LessOrEqual = 0xE,
+    Greater = 0xF
+};
+
+Condition conditionForRelation(RelOp::Kind relation)
+{
+    switch (relation)
+    {
+        case RelOp::Kind::Less:
+            return Less;
+        case RelOp::Kind::Greater:
+            return Greater;
+        case RelOp::Kind::Equal:
+            return Equal;
+        case RelOp::Kind::LessOrEqual:
+            return LessOrEqual;
+        case RelOp::Kind::GreaterOrEqual:
+            return GreaterOrEqual;
+        case RelOp::Kind::NotEqual:
+            return NotEqual;
+    }
+    return Equal;  // not reached
+}
+
+/// Return the condition that is true when `c` is false
+Condition inverse(Condition c)
+{
+    return static_cast<Condition>(c ^ 1);
+}
+
+/// True if arithmetic on Numbers uses 64-bit operations
+const bool IsWide = sizeof(Number) == 8;
+
+bool fitsInInt32(Number n)
+{
+    return numeric_limits<int32_t>::min() <= n && n <= numeric_limits<int32_t>::max();
+}
+
+int32_t offsetOfVariable(VariableName name)
+{
+    return static_cast<int32_t>((name - 'A') * sizeof(Number));
+}
+
+const auto LinesRemainingOffset =
+    static_cast<int32_t>(offsetof(NativeState, linesRemaining));
+const auto LineIndexOffset = static_cast<int32_t>(offsetof(NativeState, lineIndex));
+const auto VariablesOffset = static_cast<int32_t>(offsetof(NativeState, variables));
+const auto BreakRequestedOffset =
+    static_cast<int32_t>(offsetof(NativeState, breakRequested));
+
+// Native code reads the break flag with a plain byte load, which on x86-64
+// is a relaxed atomic load
+static_assert(sizeof(std::atomic<bool>) == 1 && ATOMIC_BOOL_LOCK_FREE == 2,
+              "the break flag must be a lock-free byte");
+
+#pragma mark - Helper functions
+
+// Native code calls these for operations that are not worth inlining.  They
+// must not throw, as there is no unwind information for the native frames.
+
+Number nativeArrayGet(NativeState *state, Number index) noexcept
+{
+    return state->array->get(index);
+}
+
+void nativeArraySet(NativeState *state, Number index, Number value) noexcept
+{
+    state->array->set(index, value);
+}
+
+Number nativeRnd(NativeState *state, Number n) noexcept
+{
+    return randomNumber(*state->rng, n);
+}
+
+void nativeGosub(NativeState *state, size_t returnIndex) noexcept
+{
+    state->returnStack->push_back(returnIndex);
+    state->maxGosubDepth->raiseTo(state->returnStack->size());
+}
+
+#pragma mark - Assembler
+
+/// Accumulates x86-64 machine code
+class Assembler
+{
+private:
+    vec<uint8_t> bytes;
+
+public:
+    size_t position() const { return bytes.size(); }
+
+    const vec<uint8_t> &code() const { return bytes; }
+
+    void byte(uint8_t b) { bytes.push_back(b); }
+
+    void int32(int32_t n)
+    {
+        uint8_t b[4];
+        memcpy(b, &n, sizeof b);
+        bytes.insert(bytes.end(), b, b + sizeof b);
+    }
+
+    void int64(int64_t n)
+    {
+        uint8_t b[8];
+        memcpy(b, &n, sizeof b);
+        bytes.insert(bytes.end(), b, b + sizeof b);
+    }
+
+    /// Emit a REX prefix, if one is needed
+    void rex(bool wide, unsigned reg, unsigned rm)
+    {
+        const auto prefix = static_cast<uint8_t>(0x40 | (wide ? 0x08 : 0) |
+                                                 ((reg >> 3) << 2) | (rm >> 3));
+        if (prefix != 0x40)
+        {
+            byte(prefix);
+        }
+    }
+
+    /// Emit an instruction whose ModRM byte names two registers
+    void registers(bool wide, initializer_list<uint8_t> opcode, unsigned reg,
+                   unsigned rm)
+    {
+        rex(wide, reg, rm);
+        bytes.insert(bytes.end(), opcode);
+        byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+    /// Emit an instruction whose ModRM byte names a register and the memory
+    /// at `[base + displacement]`
+    ///
+    /// `base` must not be RSP or R12, which would need a SIB byte.
+    void memory(bool wide, initializer_list<uint8_t> opcode, unsigned reg,
+                unsigned base, int32_t displacement)
+    {
+        assert((base & 7) != RSP);
+        rex(wide, reg, base);
+        bytes.insert(bytes.end(), opcode);
+        byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+        int32(displacement);
+    }
+
+    void push(Register r)
+    {
+        rex(false, 0, r);
+        byte(static_cast<uint8_t>(0x50 | (r & 7)));
+    }
+
+    void pop(Register r)
+    {
+        rex(false, 0, r);
+        byte(static_cast<uint8_t>(0x58 | (r & 7)));
+    }
+
+    /// Load a constant into a register
+    void loadConstant(Register r, Number n)
+    {
+        if (n == 0)
+        {
+            registers(false, {0x31}, r, r);  // xor r32, r32
+        }
+        else if (fitsInInt32(n))
+        {
+            registers(IsWide, {0xC7}, 0, r);  // mov r, imm32
+            int32(static_cast<int32_t>(n));
+        }
+        else
+        {
+            rex(true, 0, r);  // mov r64, imm64
+            byte(static_cast<uint8_t>(0xB8 | (r & 7)));
+            int64(static_cast<int64_t>(n));
+        }
+    }
+
+    /// Call a function, with the stack adjusted for alignment if `isAligned`
+    /// is false
+    void call(const void *function, bool isAligned)
+    {
+        if (!isAligned)
+        {
+            registers(true, {0x83}, 5, RSP);  // sub rsp, 8
+            byte(8);
+        }
+        registers(true, {0x89}, RBX, RDI);  // mov rdi, rbx
+        rex(true, 0, R11);                   // mov r11, imm64
+        byte(0xB8 | (R11 & 7));
+        int64(reinterpret_cast<int64_t>(function));
+        registers(false, {0xFF}, 2, R11);  // call r11
+        if (!isAligned)
+        {
+            registers(true, {0x83}, 0, RSP);  // add rsp, 8
+            byte(8);
+        }
+    }
+
+    /// Emit a jump with a 32-bit displacement to be set by `bind()` or
+    /// `patch()`, and return the position of the displacement
+    size_t jump()
+    {
+        byte(0xE9);
+        int32(0);
+        return position() - 4;
+    }
+
+    size_t jumpIf(Condition c)
+    {
+        byte(0x0F);
+        byte(static_cast<uint8_t>(0x80 | c));
+        int32(0);
+        return position() - 4;
+    }
+
+    /// Make the jump whose displacement is at `at` go to `target`
+    void patch(size_t at, size_t target)
+    {
+        const auto displacement =
+            static_cast<int32_t>(static_cast<ptrdiff_t>(target) -
+                                 static_cast<ptrdiff_t>(at + 4));
+        memcpy(&bytes[at], &displacement, sizeof displacement);
+    }
+
+    /// Make the jump whose displacement is at `at` go to the current position
+    void bind(size_t at) { patch(at, position()); }
+};
+
+#pragma mark - Line classification
+
+/// Return the index in `code.code` of the end of a line's instructions
+size_t endOfLine(const Bytecode &code, size_t lineIndex)
+{
+    return lineIndex + 1 < code.lineStart.size() ? code.lineStart[lineIndex + 1]
+                                                 : code.code.size();
+}
+
+/// Return true if every instruction of the line can be compiled
+bool isCompilable(const Bytecode &code, size_t lineIndex)
+{
+    for (auto i = code.lineStart[lineIndex]; i < endOfLine(code, lineIndex); ++i)
+    {
+        switch (code.code[i].opcode)
+        {
+            case Opcode::PushNumber:
+            case Opcode::PushVariable:
+            case Opcode::PushArrayElement:
+            case Opcode::Rnd:
+            case Opcode::Add:
+            case Opcode::Subtract:
+            case Opcode::Multiply:
+            case Opcode::Divide:
+            case Opcode::Negate:
+            case Opcode::StoreVariable:
+            case Opcode::StoreArrayElement:
+            case Opcode::AddToVariable:
+            case Opcode::JumpUnless:
+            case Opcode::Goto:
+            case Opcode::GotoIf:
+            case Opcode::Gosub:
+            case Opcode::EndLine:
+                break;
+
+            case Opcode::ArraySum:
+            case Opcode::ArrayMin:
+            case Opcode::ArrayMax:
+            case Opcode::ArrayFind:
+            case Opcode::GotoLineNumber:
+            case Opcode::GosubLineNumber:
+            case Opcode::Return:
+            case Opcode::End:
+            case Opcode::Execute:
+                return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+namespace finchlib_cpp
+{
+
+#pragma mark - NativeRegion
+
+/// Executable memory holding the native code for a run of lines
+class NativeRegion
+{
+private:
+    void *memory{nullptr};
+    size_t length{0};
+
+public:
+    using Function = void (*)(NativeState *);
+
+    NativeRegion() = default;
+    NativeRegion(const NativeRegion &) = delete;
+    NativeRegion &operator=(const NativeRegion &) = delete;
+
+    ~NativeRegion()
+    {
+        if (memory != nullptr)
+        {
+            munmap(memory, length);
+        }
+    }
+
+    /// Copy machine code into executable memory
+    ///
+    /// The memory is writable only until the code has been copied.  Returns
+    /// false if the memory can't be allocated.
+    bool load(const vec<uint8_t> &code)
+    {
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        length = (code.size() + pageSize - 1) / pageSize * pageSize;
+        auto flags = MAP_PRIVATE | MAP_ANON;
+#ifdef MAP_JIT
+        flags |= MAP_JIT;
+#endif
+        auto p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        memory = p;
+        memcpy(memory, code.data(), code.size());
+        return mprotect(memory, length, PROT_READ | PROT_EXEC) == 0;
+    }
+
+    void run(NativeState &state) const
+    {
+        reinterpret_cast<Function>(memory)(&state);
+    }
+};
+
+}  // namespace finchlib_cpp
+
+namespace
+{
+
+#pragma mark - RegionCompiler
+
+/// Generates the native code for a run of lines
+///
+/// Each bytecode instruction becomes a short fixed sequence of machine
+/// instructions, with the top of the expression stack kept in RAX and the
+/// rest on the machine stack.  A push of a variable or constant that is
+/// immediately consumed by an arithmetic operation or comparison is folded
+/// into that operation.
+class RegionCompiler
+{
+private:
+    const Bytecode &code;
+    size_t firstLine;
+    size_t endLine;  // index of the line after the run
+
+    Assembler as;
+
+    /// Register holding each variable, or 0 if the variable is in memory
+    Register pinned[26] = {};
+    vec<Register> pinnedRegisters;
+
+    /// Position of the code for each line of the run
+    vec<size_t> lineOffsets;
+
+    /// Jumps to the start of lines of the run, and to exits, where the
+    /// second element is the program index
+    vec<pair<size_t, size_t>> lineJumps;
+    map<size_t, vec<size_t>> exitJumps;
+
+    /// Jumps within the current line, where the second element is the index
+    /// of the target instruction
+    vec<pair<size_t, size_t>> instructionJumps;
+
+public:
+    RegionCompiler(const Bytecode &c, size_t first, size_t end)
+        : code(c), firstLine(first), endLine(end)
+    {
+    }
+
+    /// Generate the code, returning false if the lines can't be compiled
+    bool compile()
+    {
+        pinMostUsedVariables();
+        emitPrologue();
+        for (auto lineIndex = firstLine; lineIndex < endLine; ++lineIndex)
+        {
+            if (!compileLine(lineIndex))
+            {
+                return false;
+            }
+        }
+        const auto epilogue = as.position();
+        emitEpilogue();
+        emitExits(epilogue);
+        for (const auto &jump : lineJumps)
+        {
+            as.patch(jump.first, lineOffsets[jump.second - firstLine]);
+        }
+        return true;
+    }
+
+    const vec<uint8_t> &machineCode() const { return as.code(); }
+
+private:
+    void pinMostUsedVariables()
+    {
+        size_t uses[26] = {};
+        for (auto i = code.lineStart[firstLine]; i < endOfLine(code, endLine - 1); ++i)
+        {
+            const auto &instruction = code.code[i];
+            switch (instruction.opcode)
+            {
+                case Opcode::PushVariable:
+                case Opcode::StoreVariable:
+                    ++uses[instruction.operand - 'A'];
+                    break;
+                case Opcode::AddToVariable:
+                    ++uses[instruction.variable - 'A'];
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        for (auto reg : PinnedRegisters)
+        {
+            const auto most = std::max_element(std::begin(uses), std::end(uses));
+            if (*most == 0)
+            {
+                break;
+            }
+            pinned[most - std::begin(uses)] = reg;
+            pinnedRegisters.push_back(reg);
+            *most = 0;
+        }
+    }
+
+    Register pinnedRegister(VariableName name) const { return pinned[name - 'A']; }
+
+    void emitPrologue()
+    {
+        // After the return address and these six pushes, one more slot
+        // aligns the stack to 16 bytes for calls.
+        as.push(RBX);
+        as.push(RBP);
+        as.push(R12);
+        as.push(R13);
+        as.push(R14);
+        as.push(R15);
+        as.registers(true, {0x83}, 5, RSP);  // sub rsp, 8
+        as.byte(8);
+
+        as.registers(true, {0x89}, RDI, RBX);               // mov rbx, rdi
+        as.memory(true, {0x8B}, RBP, RBX, VariablesOffset);  // mov rbp, [rbx]
+        for (auto name = 'A'; name <= 'Z'; ++name)
+        {
+            if (const auto reg = pinnedRegister(name))
+            {
+                as.memory(IsWide, {0x8B}, reg, RBP, offsetOfVariable(name));
+            }
+        }
+    }
+
+    void emitEpilogue()
+    {
+        for (auto name = 'A'; name <= 'Z'; ++name)
+        {
+            if (const auto reg = pinnedRegister(name))
+            {
+                as.memory(IsWide, {0x89}, reg, RBP, offsetOfVariable(name));
+            }
+        }
+        as.registers(true, {0x83}, 0, RSP);  // add rsp, 8
+        as.byte(8);
+        as.pop(R15);
+        as.pop(R14);
+        as.pop(R13);
+        as.pop(R12);
+        as.pop(RBP);
+        as.pop(RBX);
+        as.byte(0xC3);  // ret
+    }
+
+    /// Emit the code that stores each exit's program index and returns
+    void emitExits(size_t epilogue)
+    {
+        for (const auto &exit : exitJumps)
+        {
+            for (auto at : exit.second)
+            {
+                as.bind(at);
+            }
+            // mov qword [rbx + lineIndex], imm32
+            as.memory(true, {0xC7}, 0, RBX, LineIndexOffset);
+            as.int32(static_cast<int32_t>(exit.first));
+            as.patch(as.jump(), epilogue);
+        }
+    }
+
+    /// Record a jump to a line, which is a jump within the native code if the
+    /// line is part of the run and is otherwise an exit
+    void addLineJump(size_t at, size_t lineIndex)
+    {
+        if (firstLine <= lineIndex && lineIndex < endLine)
+        {
+            lineJumps.emplace_back(at, lineIndex);
+        }
+        else
+        {
+            exitJumps[lineIndex].push_back(at);
+        }
+    }
+
+    void loadVariable(Register r, VariableName name)
+    {
+        if (const auto reg = pinnedRegister(name))
+        {
+            as.registers(IsWide, {0x89}, reg, r);
+        }
+        else
+        {
+            as.memory(IsWide, {0x8B}, r, RBP, offsetOfVariable(name));
+        }
+    }
+
+    /// Load the value pushed by a PushNumber or PushVariable instruction
+    void loadOperand(Register r, const Instruction &instruction)
+    {
+        if (instruction.opcode == Opcode::PushNumber)
+        {
+            as.loadConstant(r, instruction.operand);
+        }
+        else
+        {
+            loadVariable(r, static_cast<VariableName>(instruction.operand));
+        }
+    }
+
+    void storeVariable(VariableName name)
+    {
+        if (const auto reg = pinnedRegister(name))
+        {
+            as.registers(IsWide, {0x89}, RAX, reg);
+        }
+        else
+        {
+            as.memory(IsWide, {0x89}, RAX, RBP, offsetOfVariable(name));
+        }
+    }
+
+    void addToVariable(VariableName name, Number n)
+    {
+        const auto reg = pinnedRegister(name);
+        if (fitsInInt32(n))
+        {
+            // add v, imm32
+            if (reg)
+            {
+                as.registers(IsWide, {0x81}, 0, reg);
+            }
+            else
+            {
+                as.memory(IsWide, {0x81}, 0, RBP, offsetOfVariable(name));
+            }
+            as.int32(static_cast<int32_t>(n));
+        }
+        else
+        {
+            as.loadConstant(RCX, n);
+            if (reg)
+            {
+                as.registers(IsWide, {0x01}, RCX, reg);
+            }
+            else
+            {
+                as.memory(IsWide, {0x01}, RCX, RBP, offsetOfVariable(name));
+            }
+        }
+    }
+
+    /// Emit an arithmetic operation on RAX and RCX, leaving the result in RAX
+    void arithmetic(Opcode opcode)
+    {
+        switch (opcode)
+        {
+            case Opcode::Add:
+                as.registers(IsWide, {0x01}, RCX, RAX);
+                break;
+
+            case Opcode::Subtract:
+                as.registers(IsWide, {0x29}, RCX, RAX);
+                break;
+
+            case Opcode::Multiply:
+                as.registers(IsWide, {0x0F, 0xAF}, RAX, RCX);
+                break;
+
+            case Opcode::Divide:
+            {
+                // Division by zero gives 0, and division by -1 is negation,
+                // which also avoids the fault for the most negative number.
+                as.registers(IsWide, {0x85}, RCX, RCX);  // test rcx, rcx
+                const auto byZero = as.jumpIf(Equal);
+                as.registers(IsWide, {0x83}, 7, RCX);  // cmp rcx, -1
+                as.byte(0xFF);
+                const auto byMinusOne = as.jumpIf(Equal);
+                as.rex(IsWide, 0, 0);  // cdq/cqo
+                as.byte(0x99);
+                as.registers(IsWide, {0xF7}, 7, RCX);  // idiv rcx
+                const auto divided = as.jump();
+                as.bind(byZero);
+                as.registers(false, {0x31}, RAX, RAX);  // xor eax, eax
+                const auto zeroed = as.jump();
+                as.bind(byMinusOne);
+                as.registers(IsWide, {0xF7}, 3, RAX);  // neg rax
+                as.bind(divided);
+                as.bind(zeroed);
+                break;
+            }
+
+            default:
+                assert(false);
+                break;
+        }
+    }
+
+    static bool isBinaryOperation(Opcode opcode)
+    {
+        switch (opcode)
+        {
+            case Opcode::Add:
+            case Opcode::Subtract:
+            case Opcode::Multiply:
+            case Opcode::Divide:
+            case Opcode::JumpUnless:
+            case Opcode::GotoIf:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /// Compile one line, returning false if its code has a form that this
+    /// compiler does not expect
+    bool compileLine(size_t lineIndex)
+    {
+        lineOffsets.push_back(as.position());
+
+        // Give up before starting the line if the budget is used up
+        as.memory(true, {0x83}, 7, RBX, LinesRemainingOffset);  // cmp [], 0
+        as.byte(0);
+        exitJumps[lineIndex].push_back(as.jumpIf(Equal));
+
+        // ...or if a break has been requested
+        as.memory(true, {0x8B}, RCX, RBX, BreakRequestedOffset);  // mov rcx, []
+        as.memory(false, {0x80}, 7, RCX, 0);                      // cmp byte [rcx], 0
+        as.byte(0);
+        exitJumps[lineIndex].push_back(as.jumpIf(NotEqual));
+
+        as.memory(true, {0xFF}, 1, RBX, LinesRemainingOffset);  // dec []
+
+        const auto start = code.lineStart[lineIndex];
+        const auto end = endOfLine(code, lineIndex);
+
+        // Stack depth expected at each instruction that is a jump target, or
+        // -1.  A jump to `end` goes to the next line.
+        auto targetDepth = vec<int>(end - start, -1);
+        auto offsets = vec<size_t>(end - start, 0);
+        instructionJumps.clear();
+
+        auto depth = 0;
+        auto isReachable = true;
+        for (auto i = start; i < end; ++i)
+        {
+            const auto &instruction = code.code[i];
+            if (targetDepth[i - start] >= 0)
+            {
+                if (isReachable && depth != targetDepth[i - start])
+                {
+                    return false;
+                }
+                depth = targetDepth[i - start];
+                isReachable = true;
+            }
+            offsets[i - start] = as.position();
+            if (!isReachable)
+            {
+                continue;
+            }
+
+            // Only the machine stack below RAX counts for alignment
+            const auto isAligned = [&depth](int consumed)
+            { return std::max(depth - consumed, 0) % 2 == 0; };
+
+            switch (instruction.opcode)
+            {
+                case Opcode::PushNumber:
+                case Opcode::PushVariable:
+                {
+                    const auto next = i + 1;
+                    if (depth > 0 && next < end && targetDepth[next - start] < 0 &&
+                        isBinaryOperation(code.code[next].opcode))
+                    {
+                        // Fold the push into the operation that consumes it
+                        loadOperand(RCX, instruction);
+                        ++depth;
+                        offsets[next - start] = as.position();
+                        ++i;
+                        if (!compileBinaryOperation(code.code[i], i, lineIndex, end,
+                                                    depth, targetDepth))
+                        {
+                            return false;
+                        }
+                    }
+                    else
+                    {
+                        if (depth > 0)
+                        {
+                            as.push(RAX);
+                        }
+                        loadOperand(RAX, instruction);
+                        ++depth;
+                    }
+                    break;
+                }
+
+                case Opcode::PushArrayElement:
+                    as.registers(true, {0x89}, RAX, RSI);  // mov rsi, rax
+                    as.call(reinterpret_cast<const void *>(&nativeArrayGet),
+                            isAligned(1));
+                    break;
+
+                case Opcode::Rnd:
+                    as.registers(true, {0x89}, RAX, RSI);  // mov rsi, rax
+                    as.call(reinterpret_cast<const void *>(&nativeRnd), isAligned(1));
+                    break;
+
+                case Opcode::Add:
+                case Opcode::Subtract:
+                case Opcode::Multiply:
+                case Opcode::Divide:
+                case Opcode::JumpUnless:
+                case Opcode::GotoIf:
+                    if (depth < 2)
+                    {
+                        return false;
+                    }
+                    as.pop(RCX);
+                    as.registers(true, {0x87}, RCX, RAX);  // xchg rax, rcx
+                    if (!compileBinaryOperation(instruction, i, lineIndex, end, depth,
+                                                targetDepth))
+                    {
+                        return false;
+                    }
+                    break;
+
+                case Opcode::Negate:
+                    as.registers(IsWide, {0xF7}, 3, RAX);  // neg rax
+                    break;
+
+                case Opcode::StoreVariable:
+                    storeVariable(static_cast<VariableName>(instruction.operand));
+                    popAfterConsuming(1, depth);
+                    break;
+
+                case Opcode::StoreArrayElement:
+                    if (depth < 2)
+                    {
+                        return false;
+                    }
+                    as.registers(true, {0x89}, RAX, RSI);  // mov rsi, rax
+                    as.pop(RDX);
+                    as.call(reinterpret_cast<const void *>(&nativeArraySet),
+                            isAligned(2));
+                    popAfterConsuming(2, depth);
+                    break;
+
+                case Opcode::AddToVariable:
+                    addToVariable(instruction.variable, instruction.operand);
+                    break;
+
+                case Opcode::Goto:
+                    if (depth != 0)
+                    {
+                        return false;
+                    }
+                    addLineJump(as.jump(), static_cast<size_t>(instruction.operand));
+                    isReachable = false;
+                    break;
+
+                case Opcode::Gosub:
+                    if (depth != 0)
+                    {
+                        return false;
+                    }
+                    as.loadConstant(RSI, static_cast<Number>(lineIndex + 1));
+                    as.call(reinterpret_cast<const void *>(&nativeGosub), true);
+                    addLineJump(as.jump(), static_cast<size_t>(instruction.operand));
+                    isReachable = false;
+                    break;
+
+                case Opcode::EndLine:
+                    if (depth != 0)
+                    {
+                        return false;
+                    }
+                    isReachable = false;
+                    break;
+
+                default:
+                    return false;
+            }
+        }
+
+        // A line ends with EndLine or a transfer of control, and jumps past
+        // its last instruction go to the next line.  The next line's code
+        // follows immediately, unless this is the last line of the run.
+        for (const auto &jump : instructionJumps)
+        {
+            if (jump.second == end)
+            {
+                addLineJump(jump.first, lineIndex + 1);
+            }
+            else
+            {
+                as.patch(jump.first, offsets[jump.second - start]);
+            }
+        }
+
+        const auto hasEndLine = code.code[end - 1].opcode == Opcode::EndLine;
+        if ((isReachable || hasEndLine) && lineIndex + 1 == endLine)
+        {
+            addLineJump(as.jump(), lineIndex + 1);
+        }
+        return !isReachable || depth == 0;
+    }
+
+    /// After an instruction consumes values, reload RAX with the new top of
+    /// the stack
+    void popAfterConsuming(int consumed, int &depth)
+    {
+        depth -= consumed;
+        if (depth > 0)
+        {
+            as.pop(RAX);
+        }
+    }
+
+    /// Emit an operation on the two values at the top of the stack, which
+    /// are in RAX and RCX
+    bool compileBinaryOperation(const Instruction &instruction, size_t i,
+                                size_t lineIndex, size_t end, int &depth,
+                                vec<int> &targetDepth)
+    {
+        const auto start = code.lineStart[lineIndex];
+        switch (instruction.opcode)
+        {
+            case Opcode::JumpUnless:
+            {
+                as.registers(IsWide, {0x39}, RCX, RAX);  // cmp rax, rcx
+                popAfterConsuming(2, depth);
+                if (instruction.operand < 0 ||
+                    i + 1 + static_cast<size_t>(instruction.operand) > end)
+                {
+                    return false;
+                }
+                const auto target = i + 1 + static_cast<size_t>(instruction.operand);
+                if (target < end)
+                {
+                    auto &expected = targetDepth[target - start];
+                    if (expected >= 0 && expected != depth)
+                    {
+                        return false;
+                    }
+                    expected = depth;
+                }
+                else if (depth != 0)
+                {
+                    return false;
+                }
+                const auto c = inverse(conditionForRelation(instruction.relation));
+                instructionJumps.emplace_back(as.jumpIf(c), target);
+                return true;
+            }
+
+            case Opcode::GotoIf:
+            {
+                as.registers(IsWide, {0x39}, RCX, RAX);  // cmp rax, rcx
+                popAfterConsuming(2, depth);
+                if (depth != 0)
+                {
+                    return false;
+                }
+                const auto c = conditionForRelation(instruction.relation);
+                addLineJump(as.jumpIf(c), static_cast<size_t>(instruction.operand));
+                return true;
+            }
+
+            default:
+                arithmetic(instruction.opcode);
+                --depth;
+                return true;
+        }
+    }
+};
+
+/// Maximum number of lines compiled into one function
+const size_t MaxRegionLines = 256;
+
+}  // namespace
+
+#pragma mark - NativeTier
+
+NativeTier::NativeTier() = default;
+
+NativeTier::~NativeTier() = default;
+
+void NativeTier::reset(const sptr<const Bytecode> &bytecode)
+{
+    code = bytecode;
+    regions.clear();
+    lines.assign(bytecode->lineStart.size(), LineEntry{});
+}
+
+size_t NativeTier::run(const sptr<const Bytecode> &bytecode, NativeState &state)
+{
+    if (code != bytecode)
+    {
+        reset(bytecode);
+    }
+
+    auto &entry = lines[state.lineIndex];
+    if (entry.region == nullptr)
+    {
+        if (entry.isRejected || ++entry.starts < HotLineThreshold)
+        {
+            return 0;
+        }
+
+        // Compile this line and the compilable lines after it
+        const auto first = state.lineIndex;
+        auto end = first;
+        while (end < lines.size() && end - first < MaxRegionLines &&
+               isCompilable(*code, end))
+        {
+            ++end;
+        }
+
+        auto compiler = RegionCompiler{*code, first, end};
+        auto region = make_unique<NativeRegion>();
+        if (end == first ||
+            lines.size() > static_cast<size_t>(numeric_limits<int32_t>::max()) ||
+            !compiler.compile() || !region->load(compiler.machineCode()))
+        {
+            entry.isRejected = true;
+            return 0;
+        }
+        entry.region = region.get();
+        regions.push_back(std::move(region));
+    }
+
+    const auto linesAvailable = state.linesRemaining;
+    entry.region->run(state);
+    return linesAvailable - state.linesRemaining;
+}
+
+#endif /* FINCHLIB_JIT */
@@ -0,0 +1,325 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __finchbasic__metrics__
+#define __finchbasic__metrics__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Signpost intervals are emitted when the OS headers provide them, unless
+// FINCHLIB_SIGNPOSTS is defined as 0.
+#ifndef FINCHLIB_SIGNPOSTS
+#if defined(__has_include)
+#if __has_include(<os/signpost.h>)
+#define FINCHLIB_SIGNPOSTS 1
+#endif
+#endif
+#endif
+
+#ifndef FINCHLIB_SIGNPOSTS
+#define FINCHLIB_SIGNPOSTS 0
+#endif
+
+#if FINCHLIB_SIGNPOSTS
+#include <os/signpost.h>
+#endif
+
+namespace finchlib_cpp
+{
+
+#pragma mark - MetricCounter
+
+/// A statistic that is written by the engine's thread and may be read by any
+/// thread
+///
+/// There is only one writer, so an update is a relaxed load and store rather
+/// than a locked read-modify-write, and costs no more than updating a plain
+/// integer.
+class MetricCounter
+{
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    /// Add to the value.  Only the engine's thread may call this.
+    void add(uint64_t n)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /// Raise the value to `n` if it is lower.  Only the engine's thread may
+    /// call this.
+    void raiseTo(uint64_t n)
+    {
+        if (n > value.load(std::memory_order_relaxed))
+        {
+            value.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+#pragma mark - Duration histograms
+
+/// Number of buckets in a duration histogram
+///
+/// Bucket `i` counts durations of at least 2^(i+7) and less than 2^(i+8)
+/// nanoseconds, except that the first bucket also counts shorter durations
+/// and the last also counts longer ones.
+static const size_t DurationBucketCount = 16;
+
+/// Return the index of the histogram bucket for a duration
+inline size_t durationBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < (uint64_t{1} << 8))
+    {
+        return 0;
+    }
+    const auto log2 = static_cast<size_t>(63 - __builtin_clzll(nanoseconds));
+    return std::min(log2 - 7, DurationBucketCount - 1);
+}
+
+/// Return the nanoseconds between two points in time
+inline uint64_t nanosecondsBetween(std::chrono::steady_clock::time_point start,
+                                   std::chrono::steady_clock::time_point end)
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+/// Durations collected by a task that is not on the engine's thread, to be
+/// added to a DurationHistogram when the task is done
+struct DurationCounts
+{
+    uint64_t buckets[DurationBucketCount]{};
+    uint64_t count{0};
+    uint64_t totalNanoseconds{0};
+
+    void record(uint64_t nanoseconds)
+    {
+        ++buckets[durationBucket(nanoseconds)];
+        ++count;
+        totalNanoseconds += nanoseconds;
+    }
+};
+
+/// Number and total of a set of durations, with a histogram of their lengths
+class DurationHistogram
+{
+private:
+    MetricCounter buckets[DurationBucketCount];
+    MetricCounter count;
+    MetricCounter totalNanoseconds;
+
+public:
+    void record(uint64_t nanoseconds)
+    {
+        buckets[durationBucket(nanoseconds)].add(1);
+        count.add(1);
+        totalNanoseconds.add(nanoseconds);
+    }
+
+    void add(const DurationCounts &counts)
+    {
+        for (auto i = size_t{0}; i < DurationBucketCount; ++i)
+        {
+            buckets[i].add(counts.buckets[i]);
+        }
+        count.add(counts.count);
+        totalNanoseconds.add(counts.totalNanoseconds);
+    }
+
+    uint64_t bucketCount(size_t i) const { return buckets[i].get(); }
+    uint64_t durationCount() const { return count.get(); }
+    uint64_t nanoseconds() const { return totalNanoseconds.get(); }
+};
+
+#pragma mark - EngineMetrics
+
+/// Aggregate statistics about an engine, collected all the time
+///
+/// Unlike the per-line statistics of PROFILE, these are cheap enough to
+/// leave on, and can be read while the engine is running.
+struct EngineMetrics
+{
+    /// Program lines and immediate statements executed
+    MetricCounter statementsExecuted;
+
+    /// Greatest number of entries on the GOSUB return stack
+    MetricCounter maxGosubDepth;
+
+    /// Time taken to parse each line of input or of loaded text
+    DurationHistogram parseTimes;
+
+    /// LOAD statements that read their file, with the bytes read and the
+    /// time taken to read and interpret them
+    MetricCounter loadCount;
+    MetricCounter loadBytes;
+    MetricCounter loadNanoseconds;
+
+    /// SAVE statements that wrote their file, with the bytes written and the
+    /// time taken
+    MetricCounter saveCount;
+    MetricCounter saveBytes;
+    MetricCounter saveNanoseconds;
+
+    /// Characters sent to the InterpreterIO object
+    MetricCounter outputChars;
+
+    /// Times the engine stopped because no input was available
+    MetricCounter inputWaits;
+
+    /// Program lines executed by native code, which are also counted in
+    /// statementsExecuted
+    MetricCounter nativeLinesExecuted;
+};
+
+#pragma mark - Signposts
+
+/// Operations that are marked as os_signpost intervals
+enum class SignpostName
+{
+    Run,
+    Load,
+    Save,
+    Archive,
+    Restore
+};
+
+#if FINCHLIB_SIGNPOSTS
+/// Return the log to which the interpreter's signposts are written
+///
+/// Must only be called where os_signpost is available.
+inline os_log_t signpostLog() API_AVAILABLE(macos(10.14), ios(12.0))
+{
+    static const os_log_t log = os_log_create("net.kristopherjohnson.finchlib", "Interpreter");
+    return log;
+}
+#endif
+
+/// An os_signpost interval, shown by Instruments
+///
+/// This does nothing if signposts are not available or not being recorded.
+class Signpost
+{
+private:
+    SignpostName name{SignpostName::Run};
+    uint64_t identifier{0};
+
+public:
+    /// Return true if `begin()` started an interval that has not ended
+    bool isActive() const { return identifier != 0; }
+
+    void begin(SignpostName signpostName)
+    {
+#if FINCHLIB_SIGNPOSTS
+        if (@available(macOS 10.14, iOS 12.0, *))
+        {
+            const auto log = signpostLog();
+            if (!os_signpost_enabled(log))
+            {
+                return;
+            }
+            name = signpostName;
+            identifier = os_signpost_id_generate(log);
+
+            // The names must be string literals
+            switch (name)
+            {
+                case SignpostName::Run:
+                    os_signpost_interval_begin(log, identifier, "RUN");
+                    break;
+                case SignpostName::Load:
+                    os_signpost_interval_begin(log, identifier, "LOAD");
+                    break;
+                case SignpostName::Save:
+                    os_signpost_interval_begin(log, identifier, "SAVE");
+                    break;
+                case SignpostName::Archive:
+                    os_signpost_interval_begin(log, identifier, "Archive");
+                    break;
+                case SignpostName::Restore:
+                    os_signpost_interval_begin(log, identifier, "Restore");
+                    break;
+            }
+        }
+#else
+        (void)signpostName;
+#endif
+    }
+
+    void end()
+    {
+        if (!isActive())
+        {
+            return;
+        }
+#if FINCHLIB_SIGNPOSTS
+        if (@available(macOS 10.14, iOS 12.0, *))
+        {
+            const auto log = signpostLog();
+            switch (name)
+            {
+                case SignpostName::Run:
+                    os_signpost_interval_end(log, identifier, "RUN");
+                    break;
+                case SignpostName::Load:
+                    os_signpost_interval_end(log, identifier, "LOAD");
+                    break;
+                case SignpostName::Save:
+                    os_signpost_interval_end(log, identifier, "SAVE");
+                    break;
+                case SignpostName::Archive:
+                    os_signpost_interval_end(log, identifier, "Archive");
+                    break;
+                case SignpostName::Restore:
+                    os_signpost_interval_end(log, identifier, "Restore");
+                    break;
+            }
+        }
+#endif
+        identifier = 0;
+    }
+};
+
+/// A Signpost interval that lasts until the end of the enclosing scope
+class ScopedSignpost
+{
+private:
+    Signpost signpost;
+
+public:
+    explicit ScopedSignpost(SignpostName name) { signpost.begin(name); }
+    ~ScopedSignpost() { signpost.end(); }
+
+    ScopedSignpost(const ScopedSignpost &) = delete;
+    ScopedSignpost &operator=(const ScopedSignpost &) = delete;
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__metrics__) */
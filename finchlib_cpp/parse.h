@@ -26,63 +26,14 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "InterpreterEngine.h"
 
-namespace finchlib_cpp
-{
-class InputPos;
-
-/// Result from an attempt to parse an element
-///
-/// If `success()` is true, then call `value()` and
-/// `nextPos()` to get the parsed value and the position
-/// following the parsed element.
-///
-/// `ParseResult<T>` is an abstract class.  Concrete subclasses
-/// are `NotParsed<T>` and `Parsed<T>`.
-template <typename T>
-class ParseResult
-{
-public:
-    /// Return true if parse was successful, false if not.
-    virtual bool wasParsed() const = 0;
-
-    // Only call these if success() returns true
-    virtual const T *value() const = 0;
-    virtual const InputPos *nextPos() const = 0;
-};
+#include <new>
+#include <type_traits>
 
-/// Concrete subclass of ParseResult<T> for a failed parse attempt.
-template <typename T>
-class NotParsed : public ParseResult<T>
+namespace finchlib_cpp
 {
-public:
-    virtual bool wasParsed() const { return false; }
-    virtual const T *value() const { return nullptr; }
-    virtual const InputPos *nextPos() const { return nullptr; }
-};
-
-// Parsed is defined after InputPos
-template <typename T>
-struct Parsed;
-
-// Parse is defined after InputPos
 
-/// Container for a ParseResult
 template <typename T>
-class Parse
-{
-private:
-    sptr<ParseResult<T>> result;
-
-public:
-    Parse(sptr<ParseResult<T>> res) : result(res) {}
-
-    bool wasParsed() const { return result->wasParsed(); }
-
-    // It is not valid to call value() or nextPos() if wasParsed()
-    // is not true. The result would be an access violation.
-    const T &value() const { return *result->value(); }
-    const InputPos &nextPos() const { return *result->nextPos(); }
-};
+class Parse;
 
 #pragma mark - InputPos
 
@@ -91,25 +42,23 @@ public:
 /// This encapsulates the concept of an index into a character array.
 /// It provides some convenient methods/properties used by the
 /// parsing code in `InterpreterEngine`.
+///
+/// An InputPos does not own the line it refers to.  The line must outlive
+/// every position (and every `Parse` result) that refers to it.
 struct InputPos
 {
-    sptr<const InputLine> input;
+    const InputLine *input;
     size_t index;
 
-    InputPos(const InputLine &line, size_t n)
-        : input{make_shared<const InputLine>(line)}, index{n} {}
+    InputPos() : input{nullptr}, index{0} {}
 
-    InputPos(sptr<const InputLine> line, size_t n)
-        : input{line}, index{n} {}
-
-    InputPos(const InputPos &copy)
-        : input{copy.input}, index{copy.index} {}
+    InputPos(const InputLine &line, size_t n) : input{&line}, index{n} {}
 
     /// Return the character at this position
     Char at() const
     {
         assert(!isAtEndOfLine());
-        return input->at(index);
+        return (*input)[index];
     }
 
     /// Return true if there are no non-space characters at or following the
@@ -127,61 +76,55 @@ struct InputPos
     /// position
     vec<Char> remainingChars() const
     {
-        const auto count = input->size();
-        if (index >= count)
+        if (index >= input->size())
         {
             return {};
         }
 
-        vec<Char> result;
-        for (auto i = index; i < count; ++i)
-        {
-            result.push_back(input->at(i));
-        }
-        return result;
+        return vec<Char>(input->cbegin() + index, input->cend());
     }
 
     /// Return true if this position is at the end of the line
     bool isAtEndOfLine() const { return index >= input->size(); }
 
     /// Return the next input position
-    InputPos next() const { return {input, index + 1}; }
+    InputPos next() const { return {*input, index + 1}; }
 
     /// Return the position at the end of the line
-    InputPos endOfLine() const { return {input, input->size()}; }
+    InputPos endOfLine() const { return {*input, input->size()}; }
 
     /// Return position of first non-space character at or after this position
     InputPos afterSpaces() const
     {
         auto i = index;
         const auto count = input->size();
-        while (i < count && input->at(i) == ' ')
+        while (i < count && (*input)[i] == ' ')
         {
             ++i;
         }
-        return {input, i};
+        return {*input, i};
     }
 
-    // The parse() methods take a starting position and a sequence
+    // The parse() method takes a starting position and a sequence
     // of "parsing functions" to apply in order.
     //
     // Each parsing function takes an `InputPos` and returns a
-    // `Parse<T>>`, where `T` is the type of data parsed.
+    // `Parse<T>`, where `T` is the type of data parsed.  A parsing
+    // function may be a function or any callable object.
     //
-    // `parse()` returns a tuple containing all the parsed elements
-    // and the following `InputPos`, or returns `nullptr` if any
-    // of the parsing functions fail.
+    // `parse()` returns a `Parse` of a tuple containing all the parsed
+    // elements, whose `nextPos()` is the position following the last of
+    // them.  The result is not parsed if any of the parsing functions fail.
     //
     // This allows us to write pattern-matching-like parsing code like this:
     //
     //     // Try to parse "LET var = expr"
-    //     uptr<tuple<string, Lvalue, string, Expression,
-    //     InputPos>> t
-    //         = pos.parse<string, Lvalue, string, Expression>
-    //             (lit("LET"), variable, lit("="), expression);
-    //     if (t != nullptr)
+    //     const auto t = pos.parse<string, Lvalue, string, Expression>
+    //         (lit("LET"), variable, lit("="), expression);
+    //     if (t.wasParsed())
     //     {
-    //         // do something with the five-element tuple *t
+    //         // do something with the four-element tuple t.value()
+    //         // and the position t.nextPos()
     //         // ...
     //     }
     //
@@ -203,202 +146,150 @@ struct InputPos
     //
     // where `lit(String)`, `variable`, and `expression` are
     // functions that take an `InputPos` and return a Parse<T>.
+    //
+    // The parsing functions are template parameters, so the calls are
+    // direct, and no intermediate results are allocated on the heap.
 
-    template <typename A>
-    uptr<tuple<A, InputPos>>
-    parse(function<Parse<A>(const InputPos &)> a) const
-    {
-        const auto aP = a(*this);
-        if (aP.wasParsed())
-        {
-            return make_unique<tuple<A, InputPos>>(
-                aP.value(), aP.nextPos());
-        }
+    template <typename... Ts, typename... Fs>
+    Parse<tuple<Ts...>> parse(Fs... fs) const;
+};
 
-        return nullptr;
-    }
+#pragma mark - Parse
 
-    template <typename A, typename B>
-    uptr<tuple<A, B, InputPos>>
-    parse(function<Parse<A>(const InputPos &)> a,
-          function<Parse<B>(const InputPos &)> b) const
-    {
-        const Parse<A> aP = a(*this);
-        if (aP.wasParsed())
-        {
-            const Parse<B> bP = b(aP.nextPos());
-            if (bP.wasParsed())
-            {
-                return make_unique<tuple<A, B, InputPos>>(
-                    aP.value(), bP.value(),
-                    bP.nextPos());
-            }
-        }
+/// Result from an attempt to parse an element
+///
+/// If `wasParsed()` is true, then call `value()` and
+/// `nextPos()` to get the parsed value and the position
+/// following the parsed element.
+///
+/// The parsed value is held in the Parse object itself, so
+/// creating a result does not allocate memory.
+template <typename T>
+class Parse
+{
+private:
+    bool parsed;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    InputPos next;
 
-        return nullptr;
-    }
+    T *valuePtr() { return reinterpret_cast<T *>(&storage); }
+    const T *valuePtr() const { return reinterpret_cast<const T *>(&storage); }
 
-    template <typename A, typename B, typename C>
-    uptr<tuple<A, B, C, InputPos>>
-    parse(function<Parse<A>(const InputPos &)> a,
-          function<Parse<B>(const InputPos &)> b,
-          function<Parse<C>(const InputPos &)> c) const
+public:
+    /// Construct a failed result
+    Parse() : parsed{false} {}
+
+    /// Construct a successful result
+    Parse(const T &v, const InputPos &nextPos) : parsed{true}, next{nextPos}
     {
-        const Parse<A> aP = a(*this);
-        if (aP.wasParsed())
-        {
-            const Parse<B> bP = b(aP.nextPos());
-            if (bP.wasParsed())
-            {
-                const Parse<C> cP = c(bP.nextPos());
-                if (cP.wasParsed())
-                {
-                    return make_unique<tuple<A, B, C, InputPos>>(
-                        aP.value(), bP.value(),
-                        cP.value(), cP.nextPos());
-                }
-            }
-        }
+        new (&storage) T(v);
+    }
 
-        return nullptr;
+    Parse(T &&v, const InputPos &nextPos) : parsed{true}, next{nextPos}
+    {
+        new (&storage) T(std::move(v));
     }
 
-    template <typename A, typename B, typename C, typename D>
-    uptr<tuple<A, B, C, D, InputPos>>
-    parse(function<Parse<A>(const InputPos &)> a,
-          function<Parse<B>(const InputPos &)> b,
-          function<Parse<C>(const InputPos &)> c,
-          function<Parse<D>(const InputPos &)> d) const
+    Parse(const Parse &copy) : parsed{copy.parsed}, next{copy.next}
     {
-        const Parse<A> aP = a(*this);
-        if (aP.wasParsed())
+        if (parsed)
         {
-            const Parse<B> bP = b(aP.nextPos());
-            if (bP.wasParsed())
-            {
-                const Parse<C> cP = c(bP.nextPos());
-                if (cP.wasParsed())
-                {
-                    const Parse<D> dP = d(cP.nextPos());
-                    if (dP.wasParsed())
-                    {
-                        return make_unique<tuple<A, B, C, D, InputPos>>(
-                            aP.value(), bP.value(),
-                            cP.value(), dP.value(),
-                            dP.nextPos());
-                    }
-                }
-            }
+            new (&storage) T(*copy.valuePtr());
         }
-
-        return nullptr;
     }
 
-    template <typename A, typename B, typename C, typename D, typename E>
-    uptr<tuple<A, B, C, D, E, InputPos>>
-    parse(function<Parse<A>(const InputPos &)> a,
-          function<Parse<B>(const InputPos &)> b,
-          function<Parse<C>(const InputPos &)> c,
-          function<Parse<D>(const InputPos &)> d,
-          function<Parse<E>(const InputPos &)> e) const
+    Parse(Parse &&other) : parsed{other.parsed}, next{other.next}
     {
-        const Parse<A> aP = a(*this);
-        if (aP.wasParsed())
+        if (parsed)
         {
-            const Parse<B> bP = b(aP.nextPos());
-            if (bP.wasParsed())
-            {
-                const Parse<C> cP = c(bP.nextPos());
-                if (cP.wasParsed())
-                {
-                    const Parse<D> dP = d(cP.nextPos());
-                    if (dP.wasParsed())
-                    {
-                        const Parse<E> eP = e(dP.nextPos());
-                        if (eP.wasParsed())
-                        {
-                            return make_unique<tuple<A, B, C, D, E, InputPos>>(
-                                aP.value(), bP.value(), cP.value(), dP.value(),
-                                eP.value(), eP.nextPos());
-                        }
-                    }
-                }
-            }
+            new (&storage) T(std::move(*other.valuePtr()));
         }
-
-        return nullptr;
     }
 
-    template <typename A, typename B, typename C, typename D, typename E,
-              typename F>
-    uptr<tuple<A, B, C, D, E, F, InputPos>>
-    parse(function<Parse<A>(const InputPos &)> a,
-          function<Parse<B>(const InputPos &)> b,
-          function<Parse<C>(const InputPos &)> c,
-          function<Parse<D>(const InputPos &)> d,
-          function<Parse<E>(const InputPos &)> e,
-          function<Parse<F>(const InputPos &)> f) const
+    Parse &operator=(const Parse &) = delete;
+
+    ~Parse()
     {
-        const Parse<A> aP = a(*this);
-        if (aP.wasParsed())
+        if (parsed)
         {
-            const Parse<B> bP = b(aP.nextPos());
-            if (bP.wasParsed())
-            {
-                const Parse<C> cP = c(bP.nextPos());
-                if (cP.wasParsed())
-                {
-                    const Parse<D> dP = d(cP.nextPos());
-                    if (dP.wasParsed())
-                    {
-                        const Parse<E> eP = e(dP.nextPos());
-                        if (eP.wasParsed())
-                        {
-                            const Parse<F> fP = f(eP.nextPos());
-                            if (fP.wasParsed())
-                            {
-                                return make_unique<tuple<A, B, C, D, E, F, InputPos>>(
-                                    aP.value(), bP.value(), cP.value(), dP.value(),
-                                    eP.value(), fP.value(), fP.nextPos());
-                            }
-                        }
-                    }
-                }
-            }
+            valuePtr()->~T();
         }
-
-        return nullptr;
     }
-};
 
-/// Concrete subclass of ParseResult<T> for a successful parse operation
-template <typename T>
-class Parsed : public ParseResult<T>
-{
-private:
-    T value_;
-    InputPos nextPos_;
+    bool wasParsed() const { return parsed; }
 
-public:
-    Parsed(const T &v, const InputPos &next) : value_{v}, nextPos_{next} {}
+    // It is not valid to call value() or nextPos() if wasParsed()
+    // is not true.
+    const T &value() const
+    {
+        assert(parsed);
+        return *valuePtr();
+    }
 
-    virtual bool wasParsed() const { return true; }
-    virtual const T *value() const { return &value_; }
-    virtual const InputPos *nextPos() const { return &nextPos_; }
+    const InputPos &nextPos() const
+    {
+        assert(parsed);
+        return next;
+    }
 };
 
-/// Return a newly constructed Parse object representing a failure
+/// Return a Parse object representing a failure
 template <class T>
 static Parse<T> failedParse()
 {
-    return Parse<T>{make_shared<NotParsed<T>>()};
+    return Parse<T>{};
 }
 
-/// Return a newly constructed Parse object representing success
+/// Return a Parse object representing success
 template <class T>
-static Parse<T> successfulParse(const T &v, const InputPos &next)
+static Parse<typename std::decay<T>::type> successfulParse(T &&v,
+                                                          const InputPos &next)
+{
+    return {std::forward<T>(v), next};
+}
+
+#pragma mark - Parsing sequences
+
+/// Apply a single parsing function, wrapping its value in a tuple
+template <typename T, typename F>
+Parse<tuple<T>> parseSequence(const InputPos &pos, F &f)
 {
-    return Parse<T>{make_shared<Parsed<T>>(v, next)};
+    const auto p = f(pos);
+    if (p.wasParsed())
+    {
+        return {tuple<T>{p.value()}, p.nextPos()};
+    }
+
+    return failedParse<tuple<T>>();
+}
+
+/// Apply a sequence of parsing functions, each starting at the position
+/// following the element parsed by the previous one
+template <typename T, typename T2, typename... Ts, typename F, typename F2,
+          typename... Fs>
+Parse<tuple<T, T2, Ts...>> parseSequence(const InputPos &pos, F &f, F2 &f2,
+                                         Fs &... fs)
+{
+    const auto p = f(pos);
+    if (p.wasParsed())
+    {
+        const auto rest = parseSequence<T2, Ts...>(p.nextPos(), f2, fs...);
+        if (rest.wasParsed())
+        {
+            return {std::tuple_cat(tuple<T>{p.value()}, rest.value()),
+                    rest.nextPos()};
+        }
+    }
+
+    return failedParse<tuple<T, T2, Ts...>>();
+}
+
+template <typename... Ts, typename... Fs>
+Parse<tuple<Ts...>> InputPos::parse(Fs... fs) const
+{
+    static_assert(sizeof...(Ts) == sizeof...(Fs),
+                  "parse() needs one result type for each parsing function");
+    return parseSequence<Ts...>(*this, fs...);
 }
 
 /// Determine whether character is a digit
@@ -419,6 +310,13 @@ Parse<Statement> statement(const InputPos &pos);
 /// name.
 Parse<Number> inputExpression(const InputPos &pos, InterpreterEngine &engine);
 
+/// Scan user entry for INPUT that is a plain integer
+///
+/// Accepts the same numbers as `inputExpression()`, with an optional leading
+/// sign, but reads the characters directly rather than through the parsing
+/// combinators.  Returns nil for anything else, such as a variable name.
+Parse<Number> inputInteger(const InputPos &pos);
+
 /// Attempt to read an unsigned number from input.  If successful, returns
 /// parsed number and position of next input character.  If not, returns nil.
 Parse<Number> numberLiteral(const InputPos &pos);
@@ -430,11 +328,14 @@ Parse<Number> numberLiteral(const InputPos &pos);
 /// false, returns nil.
 ///
 /// Matching is case-insensitive. Spaces in the input are ignored.
-Parse<string> literal(string s, const InputPos &pos);
+Parse<string> literal(const char *s, const InputPos &pos);
 
 /// Attempt to parse an Lvalue (variable name or array element reference) from a String
 ///
 /// Returns Lvalue if successful, or nil if the string cannot be parsed as an Lvalue.
+///
+/// The result's `nextPos()` must not be used, as it refers to a temporary
+/// copy of the string.
 Parse<Lvalue> lvalueFromString(const string &input);
 
 }  // namespace finchlib_cpp
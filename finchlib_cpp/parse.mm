@@ -24,6 +24,10 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "parse.h"
 #include "syntax.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 using std::get;
 
 namespace finchlib_cpp
@@ -38,10 +42,10 @@ static Parse<Expression> expression(const InputPos &pos);
 /// false, returns nil.
 ///
 /// Matching is case-insensitive. Spaces in the input are ignored.
-Parse<string> literal(string s, const InputPos &pos)
+Parse<string> literal(const char *s, const InputPos &pos)
 {
     auto matchCount = size_t{0};
-    const auto matchGoal = size_t{s.length()};
+    const auto matchGoal = size_t{strlen(s)};
 
     auto i = pos;
     while ((matchCount < matchGoal) && !i.isAtEndOfLine())
@@ -65,32 +69,39 @@ Parse<string> literal(string s, const InputPos &pos)
 
     if (matchCount == matchGoal)
     {
-        return successfulParse(s, i);
+        return successfulParse(string{s}, i);
     }
 
     return failedParse<string>();
 }
 
 /// Callable object that tries to parse a literal
+///
+/// The literal string must outlive the object.  It is normally a
+/// string literal in the source.
 class lit
 {
 private:
-    string s;
+    const char *s;
 
 public:
-    lit(string literalString) : s{literalString} {}
+    lit(const char *literalString) : s{literalString} {}
 
-    Parse<string> operator()(const InputPos &pos) { return literal(s, pos); }
+    Parse<string> operator()(const InputPos &pos) const
+    {
+        return literal(s, pos);
+    }
 };
 
 /// Try to parse one of a set of literals
 ///
 /// Returns first match, or nil if there are no matches
-static Parse<string> oneOfLiteral(vec<string> strings, const InputPos &pos)
+static Parse<string> oneOfLiteral(initializer_list<const char *> strings,
+                                  const InputPos &pos)
 {
-    for (const auto &s : strings)
+    for (const auto s : strings)
     {
-        const auto match = literal(s, pos);
+        auto match = literal(s, pos);
         if (match.wasParsed())
         {
             return match;
@@ -104,14 +115,31 @@ static Parse<string> oneOfLiteral(vec<string> strings, const InputPos &pos)
 class oneOfLit
 {
 private:
-    vec<string> strings;
+    // The longest list we use is "PRINT", "PR", "?"
+    static const size_t MaxStrings = 3;
+
+    const char *strings[MaxStrings];
+    size_t count;
 
 public:
-    oneOfLit(initializer_list<string> initList) : strings(initList) {}
+    oneOfLit(initializer_list<const char *> initList) : count{initList.size()}
+    {
+        assert(count <= MaxStrings);
+        std::copy(initList.begin(), initList.end(), strings);
+    }
 
-    Parse<string> operator()(const InputPos &pos)
+    Parse<string> operator()(const InputPos &pos) const
     {
-        return oneOfLiteral(strings, pos);
+        for (auto i = size_t{0}; i < count; ++i)
+        {
+            auto match = literal(strings[i], pos);
+            if (match.wasParsed())
+            {
+                return match;
+            }
+        }
+
+        return failedParse<string>();
     }
 };
 
@@ -124,27 +152,30 @@ public:
 ///
 /// This is used in situations where a statement allows an optional keyword,
 /// such as LET or THEN, that can be ignored if present.
-static Parse<string> optLiteral(string s, const InputPos &pos)
+static Parse<string> optLiteral(const char *s, const InputPos &pos)
 {
-    const auto lit = literal(s, pos);
+    auto lit = literal(s, pos);
     if (lit.wasParsed())
     {
-        return successfulParse(s, lit.nextPos());
+        return lit;
     }
 
-    return successfulParse(s, pos);
+    return successfulParse(string{s}, pos);
 }
 
 /// Callable object that tries to parse an optional literal
 class optLit
 {
 private:
-    string s;
+    const char *s;
 
 public:
-    optLit(string literal) : s(literal) {}
+    optLit(const char *literal) : s(literal) {}
 
-    Parse<string> operator()(const InputPos &pos) { return optLiteral(s, pos); }
+    Parse<string> operator()(const InputPos &pos) const
+    {
+        return optLiteral(s, pos);
+    }
 };
 
 /// Attempt to read an unsigned number from input.  If successful, returns
@@ -163,7 +194,7 @@ Parse<Number> numberLiteral(const InputPos &pos)
         return failedParse<Number>();
     }
 
-    auto num = Number{i.at() - '0'};
+    auto num = static_cast<Number>(i.at() - '0');
     i = i.next();
     while (!i.isAtEndOfLine())
     {
@@ -255,10 +286,10 @@ static Parse<Lvalue> lvalue(const InputPos &pos)
     }
 
     const auto aelem = pos.parse<string, Expression, string>(lit("@("), expression, lit(")"));
-    if (aelem != nullptr)
+    if (aelem.wasParsed())
     {
-        const auto &expr = get<1>(*aelem);
-        const auto &nextPos = get<3>(*aelem);
+        const auto &expr = get<1>(aelem.value());
+        const auto &nextPos = aelem.nextPos();
         const auto result = Lvalue::arrayElement(expr);
         return successfulParse(result, nextPos);
     }
@@ -291,30 +322,64 @@ static Parse<Factor> factor(const InputPos &pos)
 
     // "RND(" expression ")"
     const auto rnd = pos.parse<string, Expression, string>(lit("RND("), expression, lit(")"));
-    if (rnd != nullptr)
+    if (rnd.wasParsed())
     {
-        const auto &expr = get<1>(*rnd);
-        const auto &nextPos = get<3>(*rnd);
+        const auto &expr = get<1>(rnd.value());
+        const auto &nextPos = rnd.nextPos();
         const auto result = Factor::rnd(expr);
         return successfulParse(result, nextPos);
     }
 
+    // Array functions, which all begin with one of these letters
+    const auto start = pos.afterSpaces();
+    if (!start.isAtEndOfLine() && strchr("SMF", toupper(start.at())) != nullptr)
+    {
+        // "SUM(" / "MIN(" / "MAX(" expression "," expression ")"
+        static const pair<const char *, Factor (*)(const Expression &, const Expression &)>
+            reductions[] = {{"SUM(", Factor::sum},
+                            {"MIN(", Factor::minimum},
+                            {"MAX(", Factor::maximum}};
+        for (const auto &reduction : reductions)
+        {
+            const auto parsed = pos.parse<string, Expression, string, Expression, string>(
+                lit(reduction.first), expression, lit(","), expression, lit(")"));
+            if (parsed.wasParsed())
+            {
+                const auto result =
+                    reduction.second(get<1>(parsed.value()), get<3>(parsed.value()));
+                return successfulParse(result, parsed.nextPos());
+            }
+        }
+
+        // "FIND(" expression "," expression "," expression ")"
+        const auto find =
+            pos.parse<string, Expression, string, Expression, string, Expression, string>(
+                lit("FIND("), expression, lit(","), expression, lit(","), expression,
+                lit(")"));
+        if (find.wasParsed())
+        {
+            const auto &args = find.value();
+            const auto result = Factor::find(get<1>(args), get<3>(args), get<5>(args));
+            return successfulParse(result, find.nextPos());
+        }
+    }
+
     // "(" expression ")"
     const auto parenExpr = pos.parse<string, Expression, string>(lit("("), expression, lit(")"));
-    if (parenExpr != nullptr)
+    if (parenExpr.wasParsed())
     {
-        const auto &expr = get<1>(*parenExpr);
-        const auto &nextPos = get<3>(*parenExpr);
+        const auto &expr = get<1>(parenExpr.value());
+        const auto &nextPos = parenExpr.nextPos();
         const auto result = Factor::parenExpr(expr);
         return successfulParse(result, nextPos);
     }
 
     // "@(" expression ")"
     const auto aelem = pos.parse<string, Expression, string>(lit("@("), expression, lit(")"));
-    if (aelem != nullptr)
+    if (aelem.wasParsed())
     {
-        const auto &expr = get<1>(*aelem);
-        const auto &nextPos = get<3>(*aelem);
+        const auto &expr = get<1>(aelem.value());
+        const auto &nextPos = aelem.nextPos();
         const auto result = Factor::arrayElement(expr);
         return successfulParse(result, nextPos);
     }
@@ -341,20 +406,20 @@ static Parse<Term> term(const InputPos &pos)
     {
         // If followed by "*", then it's a product
         const auto mult = f.nextPos().parse<string, Term>(lit("*"), term);
-        if (mult != nullptr)
+        if (mult.wasParsed())
         {
-            const auto &t = get<1>(*mult);
-            const auto &nextPos = get<2>(*mult);
+            const auto &t = get<1>(mult.value());
+            const auto &nextPos = mult.nextPos();
             const auto result = Term::compound(f.value(), ArithOp::Multiply, t);
             return successfulParse(result, nextPos);
         }
 
         // If followed by "/", then it's a quotient
         const auto div = f.nextPos().parse<string, Term>(lit("/"), term);
-        if (div != nullptr)
+        if (div.wasParsed())
         {
-            const auto &t = get<1>(*div);
-            const auto &nextPos = get<2>(*div);
+            const auto &t = get<1>(div.value());
+            const auto &nextPos = div.nextPos();
             const auto result = Term::compound(f.value(), ArithOp::Divide, t);
             return successfulParse(result, nextPos);
         }
@@ -378,10 +443,10 @@ static Parse<UnsignedExpression> unsignedExpression(const InputPos &pos)
         // If followed by "+", then it's addition
         const auto add = t.nextPos().parse<string, UnsignedExpression>(
             lit("+"), unsignedExpression);
-        if (add != nullptr)
+        if (add.wasParsed())
         {
-            const auto &uexpr = get<1>(*add);
-            const auto &nextPos = get<2>(*add);
+            const auto &uexpr = get<1>(add.value());
+            const auto &nextPos = add.nextPos();
             const auto result = UnsignedExpression::compound(t.value(), ArithOp::Add, uexpr);
             return successfulParse(result, nextPos);
         }
@@ -389,10 +454,10 @@ static Parse<UnsignedExpression> unsignedExpression(const InputPos &pos)
         // If followed by "+", then it's addition
         const auto sub = t.nextPos().parse<string, UnsignedExpression>(
             lit("-"), unsignedExpression);
-        if (sub != nullptr)
+        if (sub.wasParsed())
         {
-            const auto &uexpr = get<1>(*sub);
-            const auto &nextPos = get<2>(*sub);
+            const auto &uexpr = get<1>(sub.value());
+            const auto &nextPos = sub.nextPos();
             const auto result = UnsignedExpression::compound(t.value(), ArithOp::Subtract, uexpr);
             return successfulParse(result, nextPos);
         }
@@ -412,19 +477,19 @@ static Parse<UnsignedExpression> unsignedExpression(const InputPos &pos)
 static Parse<Expression> expression(const InputPos &pos)
 {
     const auto leadingPlus = pos.parse<string, UnsignedExpression>(lit("+"), unsignedExpression);
-    if (leadingPlus != nullptr)
+    if (leadingPlus.wasParsed())
     {
-        const auto &uexpr = get<1>(*leadingPlus);
-        const auto &nextPos = get<2>(*leadingPlus);
+        const auto &uexpr = get<1>(leadingPlus.value());
+        const auto &nextPos = leadingPlus.nextPos();
         const auto result = Expression::plus(uexpr);
         return successfulParse(result, nextPos);
     }
 
     const auto leadingMinus = pos.parse<string, UnsignedExpression>(lit("-"), unsignedExpression);
-    if (leadingMinus != nullptr)
+    if (leadingMinus.wasParsed())
     {
-        const auto &uexpr = get<1>(*leadingMinus);
-        const auto &nextPos = get<2>(*leadingMinus);
+        const auto &uexpr = get<1>(leadingMinus.value());
+        const auto &nextPos = leadingMinus.nextPos();
         const auto result = Expression::minus(uexpr);
         return successfulParse(result, nextPos);
     }
@@ -480,7 +545,7 @@ static Parse<PrintList> printList(const InputPos &pos)
             const auto tail = printList(comma.nextPos());
             if (tail.wasParsed())
             {
-                const auto pTail = make_shared<PrintList>(tail.value());
+                const auto pTail = NodeArena::current().make<PrintList>(tail.value());
                 PrintList result{item.value(), PrintSeparatorTab, pTail};
                 return successfulParse(result, tail.nextPos());
             }
@@ -501,7 +566,7 @@ static Parse<PrintList> printList(const InputPos &pos)
                 const auto tail = printList(semicolon.nextPos());
                 if (tail.wasParsed())
                 {
-                    const auto pTail = make_shared<PrintList>(tail.value());
+                    const auto pTail = NodeArena::current().make<PrintList>(tail.value());
                     PrintList result{item.value(), PrintSeparatorEmpty, pTail};
                     return successfulParse(result, tail.nextPos());
                 }
@@ -524,7 +589,7 @@ static Parse<PrintList> printList(const InputPos &pos)
 static Parse<RelOp> relOp(const InputPos &pos)
 {
     // Note: We need to test the longer sequences before the shorter
-    static const vec<tuple<string, RelOp>> opTable = {
+    static const pair<const char *, RelOp> opTable[] = {
         {"<=", RelOp::LessOrEqual},
         {">=", RelOp::GreaterOrEqual},
         {"<>", RelOp::NotEqual},
@@ -535,10 +600,10 @@ static Parse<RelOp> relOp(const InputPos &pos)
 
     for (const auto &item : opTable)
     {
-        const auto op = literal(get<0>(item), pos);
+        const auto op = literal(item.first, pos);
         if (op.wasParsed())
         {
-            return successfulParse(get<1>(item), op.nextPos());
+            return successfulParse(item.second, op.nextPos());
         }
     }
 
@@ -588,10 +653,10 @@ static Parse<Statement> listStatement(const InputPos &pos)
         if (lowExpr.wasParsed())
         {
             const auto commaExpr = lowExpr.nextPos().parse<string, Expression>(lit(","), expression);
-            if (commaExpr != nullptr)
+            if (commaExpr.wasParsed())
             {
-                const auto &highExpr = get<1>(*commaExpr);
-                const auto &nextPos = get<2>(*commaExpr);
+                const auto &highExpr = get<1>(commaExpr.value());
+                const auto &nextPos = commaExpr.nextPos();
                 const auto stmt = Statement::list(lowExpr.value(), highExpr);
                 return successfulParse(stmt, nextPos);
             }
@@ -613,11 +678,11 @@ static Parse<Statement> letStatement(const InputPos &pos)
 {
     const auto let = pos.parse<string, Lvalue, string, Expression>(
         optLit("LET"), lvalue, lit("="), expression);
-    if (let != nullptr)
+    if (let.wasParsed())
     {
-        const auto &lv = get<1>(*let);
-        const auto &expr = get<3>(*let);
-        const auto &nextPos = get<4>(*let);
+        const auto &lv = get<1>(let.value());
+        const auto &expr = get<3>(let.value());
+        const auto &nextPos = let.nextPos();
         const auto stmt = Statement::let(lv, expr);
         return successfulParse(stmt, nextPos);
     }
@@ -633,12 +698,15 @@ static Parse<Lvalues> lvalueList(const InputPos &pos)
         Lvalues lvalues{firstItem.value()};
         auto nextPos = firstItem.nextPos();
 
-        auto more = nextPos.parse<string, Lvalue>(lit(","), lvalue);
-        while (more != nullptr)
+        for (;;)
         {
-            lvalues.push_back(get<1>(*more));
-            nextPos = get<2>(*more);
-            more = nextPos.parse<string, Lvalue>(lit(","), lvalue);
+            const auto more = nextPos.parse<string, Lvalue>(lit(","), lvalue);
+            if (!more.wasParsed())
+            {
+                break;
+            }
+            lvalues.push_back(get<1>(more.value()));
+            nextPos = more.nextPos();
         }
 
         return successfulParse(lvalues, nextPos);
@@ -653,10 +721,10 @@ static Parse<Lvalues> lvalueList(const InputPos &pos)
 static Parse<Statement> inputStatement(const InputPos &pos)
 {
     const auto parsed = pos.parse<string, Lvalues>(oneOfLit{"INPUT", "IN"}, lvalueList);
-    if (parsed != nullptr)
+    if (parsed.wasParsed())
     {
-        const auto &lvalues = get<1>(*parsed);
-        const auto &nextPos = get<2>(*parsed);
+        const auto &lvalues = get<1>(parsed.value());
+        const auto &nextPos = parsed.nextPos();
         const auto result = Statement::input(lvalues);
         return successfulParse(result, nextPos);
     }
@@ -671,13 +739,13 @@ static Parse<Statement> ifStatement(const InputPos &pos)
 {
     const auto ifThen = pos.parse<string, Expression, RelOp, Expression, string, Statement>(
         lit("IF"), expression, relOp, expression, optLit("THEN"), statement);
-    if (ifThen != nullptr)
+    if (ifThen.wasParsed())
     {
-        const auto &lhs = get<1>(*ifThen);
-        const auto &op = get<2>(*ifThen);
-        const auto &rhs = get<3>(*ifThen);
-        const auto &stmt = get<5>(*ifThen);
-        const auto &nextPos = get<6>(*ifThen);
+        const auto &lhs = get<1>(ifThen.value());
+        const auto &op = get<2>(ifThen.value());
+        const auto &rhs = get<3>(ifThen.value());
+        const auto &stmt = get<5>(ifThen.value());
+        const auto &nextPos = ifThen.nextPos();
         const auto result = Statement::ifThen(lhs, op, rhs, stmt);
         return successfulParse(result, nextPos);
     }
@@ -691,10 +759,10 @@ static Parse<Statement> ifStatement(const InputPos &pos)
 static Parse<Statement> gotoStatement(const InputPos &pos)
 {
     const auto s = pos.parse<string, Expression>(oneOfLit{"GOTO", "GT"}, expression);
-    if (s != nullptr)
+    if (s.wasParsed())
     {
-        const auto &expr = get<1>(*s);
-        const auto &nextPos = get<2>(*s);
+        const auto &expr = get<1>(s.value());
+        const auto &nextPos = s.nextPos();
         const auto result = Statement::gotoStatement(expr);
         return successfulParse(result, nextPos);
     }
@@ -708,10 +776,10 @@ static Parse<Statement> gotoStatement(const InputPos &pos)
 static Parse<Statement> gosubStatement(const InputPos &pos)
 {
     const auto s = pos.parse<string, Expression>(oneOfLit{"GOSUB", "GS"}, expression);
-    if (s != nullptr)
+    if (s.wasParsed())
     {
-        const auto &expr = get<1>(*s);
-        const auto &nextPos = get<2>(*s);
+        const auto &expr = get<1>(s.value());
+        const auto &nextPos = s.nextPos();
         const auto result = Statement::gosub(expr);
         return successfulParse(result, nextPos);
     }
@@ -746,10 +814,10 @@ static Parse<Statement> remStatement(const InputPos &pos)
 static Parse<Statement> dimStatement(const InputPos &pos)
 {
     const auto parsed = pos.parse<string, Expression, string>(lit("DIM@("), expression, lit(")"));
-    if (parsed != nullptr)
+    if (parsed.wasParsed())
     {
-        const auto result = Statement::dim(get<1>(*parsed));
-        const auto &nextPos = get<3>(*parsed);
+        const auto result = Statement::dim(get<1>(parsed.value()));
+        const auto &nextPos = parsed.nextPos();
         return successfulParse(result, nextPos);
     }
 
@@ -762,10 +830,10 @@ static Parse<Statement> dimStatement(const InputPos &pos)
 static Parse<Statement> saveStatement(const InputPos &pos)
 {
     const auto parsed = pos.parse<string, vec<Char>>(oneOfLit{"SAVE", "SV"}, stringLiteral);
-    if (parsed != nullptr)
+    if (parsed.wasParsed())
     {
-        const auto &chars = get<1>(*parsed);
-        const auto &nextPos = get<2>(*parsed);
+        const auto &chars = get<1>(parsed.value());
+        const auto &nextPos = parsed.nextPos();
         const auto filename = string(chars.cbegin(), chars.cend());
         const auto result = Statement::save(filename);
         return successfulParse(result, nextPos);
@@ -780,10 +848,10 @@ static Parse<Statement> saveStatement(const InputPos &pos)
 static Parse<Statement> loadStatement(const InputPos &pos)
 {
     const auto parsed = pos.parse<string, vec<Char>>(oneOfLit{"LOAD", "LD"}, stringLiteral);
-    if (parsed != nullptr)
+    if (parsed.wasParsed())
     {
-        const auto &chars = get<1>(*parsed);
-        const auto &nextPos = get<2>(*parsed);
+        const auto &chars = get<1>(parsed.value());
+        const auto &nextPos = parsed.nextPos();
         const auto filename = string(chars.cbegin(), chars.cend());
         const auto result = Statement::load(filename);
         return successfulParse(result, nextPos);
@@ -792,6 +860,113 @@ static Parse<Statement> loadStatement(const InputPos &pos)
     return failedParse<Statement>();
 }
 
+/// Attempt to parse a RANDOMIZE statement
+///
+/// Return statement and position of next character if successful.
+static Parse<Statement> randomizeStatement(const InputPos &pos)
+{
+    const auto parsed = pos.parse<string, Expression>(lit("RANDOMIZE"), expression);
+    if (parsed.wasParsed())
+    {
+        const auto result = Statement::randomize(get<1>(parsed.value()));
+        return successfulParse(result, parsed.nextPos());
+    }
+
+    return failedParse<Statement>();
+}
+
+/// Attempt to parse a FILL statement
+///
+/// Return statement and position of next character if successful.
+static Parse<Statement> fillStatement(const InputPos &pos)
+{
+    const auto parsed = pos.parse<string, Expression, string, Expression, string, Expression>(
+        lit("FILL"), expression, lit(","), expression, lit(","), expression);
+    if (parsed.wasParsed())
+    {
+        const auto &args = parsed.value();
+        const auto result = Statement::fill(get<1>(args), get<3>(args), get<5>(args));
+        return successfulParse(result, parsed.nextPos());
+    }
+
+    return failedParse<Statement>();
+}
+
+/// Attempt to parse a COPY statement
+///
+/// Return statement and position of next character if successful.
+static Parse<Statement> copyStatement(const InputPos &pos)
+{
+    const auto parsed = pos.parse<string, Expression, string, Expression, string, Expression>(
+        lit("COPY"), expression, lit(","), expression, lit(","), expression);
+    if (parsed.wasParsed())
+    {
+        const auto &args = parsed.value();
+        const auto result = Statement::copy(get<1>(args), get<3>(args), get<5>(args));
+        return successfulParse(result, parsed.nextPos());
+    }
+
+    return failedParse<Statement>();
+}
+
+/// Attempt to parse a PROFILE statement
+///
+/// This must be tried before PRINT, because "PROFILE" begins with the "PR"
+/// abbreviation.
+///
+/// Return statement and position of next character if successful.
+static Parse<Statement> profileStatement(const InputPos &pos)
+{
+    const auto keyword = literal("PROFILE", pos);
+    if (keyword.wasParsed())
+    {
+        return successfulParse(Statement::profile(), keyword.nextPos());
+    }
+
+    return failedParse<Statement>();
+}
+
+/// Function that attempts to parse a statement of one kind
+using StatementParser = Parse<Statement> (*)(const InputPos &);
+
+/// Return the statement parsers to try for each first character of a
+/// statement, indexed by the upper-case character
+///
+/// A statement can only begin with the first letter of its keyword, or
+/// with the first character of its abbreviations, so only these parsers can
+/// succeed.  Any variable name can begin a LET without the keyword.  The
+/// parsers for a character are in the order of the list below, so the first
+/// one that succeeds is the same as if all of them were tried.
+static vec<vec<StatementParser>> statementParsersByFirstChar()
+{
+    static const pair<const char *, StatementParser> parsers[] = {
+        {"P", profileStatement},
+        {"P?", printStatement},
+        {"ABCDEFGHIJKLMNOPQRSTUVWXYZ@", letStatement},
+        {"I", inputStatement},
+        {"D", dimStatement},
+        {"I", ifStatement},
+        {"G", gotoStatement},
+        {"G", gosubStatement},
+        {"R'", remStatement},
+        {"L", listStatement},
+        {"S", saveStatement},
+        {"L", loadStatement},
+        {"R", randomizeStatement},
+        {"F", fillStatement},
+        {"C", copyStatement}};
+
+    auto result = vec<vec<StatementParser>>(numeric_limits<Char>::max() + 1);
+    for (const auto &parser : parsers)
+    {
+        for (auto c = parser.first; *c != '\0'; ++c)
+        {
+            result[static_cast<Char>(*c)].push_back(parser.second);
+        }
+    }
+    return result;
+}
+
 /// Parse a statement
 ///
 /// Returns a parsed statement and position of character
@@ -799,20 +974,15 @@ static Parse<Statement> loadStatement(const InputPos &pos)
 /// if there is no valid statement.
 Parse<Statement> statement(const InputPos &pos)
 {
-    // List of parsing functions to try
-    static const vec<function<Parse<Statement>(const InputPos &)>> functions{
-        printStatement,
-        letStatement,
-        inputStatement,
-        dimStatement,
-        ifStatement,
-        gotoStatement,
-        gosubStatement,
-        remStatement,
-        listStatement,
-        saveStatement,
-        loadStatement};
-    for (const auto &f : functions)
+    const auto start = pos.afterSpaces();
+    if (start.isAtEndOfLine())
+    {
+        return failedParse<Statement>();
+    }
+    const auto firstChar = static_cast<Char>(toupper(start.at()));
+
+    static const auto parsers = statementParsersByFirstChar();
+    for (const auto f : parsers[firstChar])
     {
         const auto stmt = f(pos);
         if (stmt.wasParsed())
@@ -822,7 +992,7 @@ Parse<Statement> statement(const InputPos &pos)
     }
 
     // For simple single-word statements, we use this table
-    static const vec<pair<string, function<Statement()>>> statements{
+    static const pair<const char *, Statement (*)()> statements[] = {
         {"RETURN", Statement::returnStatement},
         {"RT", Statement::returnStatement},
         {"RUN", Statement::run},
@@ -835,9 +1005,15 @@ Parse<Statement> statement(const InputPos &pos)
         {"FL", Statement::files},
         {"TRON", Statement::tron},
         {"TROFF", Statement::troff},
+        {"UNPROFILE", Statement::unprofile},
         {"HELP", Statement::help}};
     for (const auto &s : statements)
     {
+        if (s.first[0] != firstChar)
+        {
+            continue;
+        }
+
         const auto keyword = literal(s.first, pos);
         if (keyword.wasParsed())
         {
@@ -865,16 +1041,17 @@ Parse<Number> inputExpression(const InputPos &pos, InterpreterEngine &engine)
 
     // "+" number
     const auto plusNum = pos.parse<string, Number>(lit("+"), numberLiteral);
-    if (plusNum != nullptr)
+    if (plusNum.wasParsed())
     {
-        return successfulParse(get<1>(*plusNum), get<2>(*plusNum));
+        return successfulParse(get<1>(plusNum.value()), plusNum.nextPos());
     }
 
     // "-" number
     const auto minusNum = pos.parse<string, Number>(lit("-"), numberLiteral);
-    if (minusNum != nullptr)
+    if (minusNum.wasParsed())
     {
-        return successfulParse(-get<1>(*minusNum), get<2>(*minusNum));
+        return successfulParse(static_cast<Number>(-get<1>(minusNum.value())),
+                               minusNum.nextPos());
     }
 
     // variable
@@ -888,4 +1065,53 @@ Parse<Number> inputExpression(const InputPos &pos, InterpreterEngine &engine)
     return failedParse<Number>();
 }
 
+Parse<Number> inputInteger(const InputPos &pos)
+{
+    const auto &line = *pos.input;
+    const auto count = line.size();
+
+    auto i = pos.index;
+    while (i < count && line[i] == ' ')
+    {
+        ++i;
+    }
+
+    auto isNegative = false;
+    if (i < count && (line[i] == '+' || line[i] == '-'))
+    {
+        isNegative = line[i] == '-';
+        ++i;
+        while (i < count && line[i] == ' ')
+        {
+            ++i;
+        }
+    }
+
+    if (i == count || !isDigitChar(line[i]))
+    {
+        return failedParse<Number>();
+    }
+
+    // Digits are accumulated without sign so that an entry too large for a
+    // Number wraps around as it does in numberLiteral().  Spaces between
+    // digits are ignored.
+    using Digits = std::make_unsigned<Number>::type;
+    auto digits = Digits{0};
+    for (; i < count; ++i)
+    {
+        const auto c = line[i];
+        if (isDigitChar(c))
+        {
+            digits = static_cast<Digits>(digits * 10 + (c - '0'));
+        }
+        else if (c != ' ')
+        {
+            break;
+        }
+    }
+
+    const auto value = isNegative ? static_cast<Digits>(0 - digits) : digits;
+    return successfulParse(static_cast<Number>(value), InputPos{line, i});
+}
+
 }  // namespace finchlib_cpp
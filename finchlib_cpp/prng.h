@@ -0,0 +1,138 @@
+/*
+Copyright (c) 2015 Kristopher Johnson
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be
+included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __finchbasic__prng__
+#define __finchbasic__prng__
+
+#include <cstdint>
+
+namespace finchlib_cpp
+{
+
+#pragma mark - RandomGenerator
+
+/// Pseudo-random number generator for RND()
+///
+/// This is the PCG32 generator (see http://www.pcg-random.org).  It is
+/// fast, needs no locking because each interpreter has its own, and
+/// produces the same sequence every time it is given the same seed.
+///
+/// It is not suitable for cryptography.
+class RandomGenerator
+{
+private:
+    uint64_t state;
+
+    /// Selects one of the generator's 2^63 independent streams; always odd
+    uint64_t increment;
+
+public:
+    RandomGenerator() { seed(0, 0); }
+
+    RandomGenerator(uint64_t initialState, uint64_t stream)
+    {
+        seed(initialState, stream);
+    }
+
+    /// Restart the generator
+    ///
+    /// Generators given different `stream` values produce unrelated
+    /// sequences, even with the same `initialState`.
+    void seed(uint64_t initialState, uint64_t stream)
+    {
+        state = 0;
+        increment = (stream << 1) | 1;
+        next();
+        state += initialState;
+        next();
+    }
+
+    /// Return the next 32 random bits
+    uint32_t next()
+    {
+        const auto old = state;
+        state = old * 6364136223846793005ULL + increment;
+        const auto xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        const auto rotation = static_cast<uint32_t>(old >> 59);
+        return (xorShifted >> rotation) | (xorShifted << ((0u - rotation) & 31));
+    }
+
+    /// Return a uniformly distributed value in the range `0..<bound`
+    ///
+    /// `bound` must be greater than zero.
+    uint32_t nextBelow(uint32_t bound)
+    {
+        // Values below the threshold would make some results more likely
+        // than others, so they are rejected.  The loop rarely repeats.
+        const uint32_t threshold = (0u - bound) % bound;
+        for (;;)
+        {
+            const auto r = next();
+            if (r >= threshold)
+            {
+                return r % bound;
+            }
+        }
+    }
+
+    /// Return a uniformly distributed value in the range `0..<bound`
+    ///
+    /// Bounds that fit in 32 bits give the same results as the 32-bit
+    /// overload, so a program sees the same sequence whatever the width
+    /// of Number.  `bound` must be greater than zero.
+    uint64_t nextBelow(uint64_t bound)
+    {
+        if (bound <= UINT32_MAX)
+        {
+            return nextBelow(static_cast<uint32_t>(bound));
+        }
+
+        const uint64_t threshold = (0ull - bound) % bound;
+        for (;;)
+        {
+            const auto high = static_cast<uint64_t>(next()) << 32;
+            const auto r = high | next();
+            if (r >= threshold)
+            {
+                return r % bound;
+            }
+        }
+    }
+
+    /// Return the internal state, for saving the generator
+    uint64_t stateValue() const { return state; }
+
+    /// Return the stream selector, for saving the generator
+    uint64_t incrementValue() const { return increment; }
+
+    /// Restore state returned by `stateValue()` and `incrementValue()`
+    void restore(uint64_t savedState, uint64_t savedIncrement)
+    {
+        state = savedState;
+        increment = savedIncrement | 1;
+    }
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__prng__) */
@@ -0,0 +1,156 @@
+/*
+ Copyright (c) 2015 Kristopher Johnson
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __finchbasic__snapshot__
+#define __finchbasic__snapshot__
+
+#include "cppdefs.h"
+
+#include <cstring>
+#include <type_traits>
+
+namespace finchlib_cpp
+{
+
+#pragma mark - SnapshotWriter
+
+/// Builds the binary representation of interpreter state
+///
+/// Values are written in the host's byte order.  The snapshot header
+/// records the byte order and the size of a Number, so a snapshot made on
+/// an incompatible host is rejected rather than misread.
+class SnapshotWriter
+{
+public:
+    /// Bytes written so far
+    vec<uint8_t> bytes;
+
+    /// Append a fixed-size value
+    template <typename T>
+    void write(T value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only plain values can be written");
+        writeBytes(&value, sizeof(T));
+    }
+
+    /// Append a count of elements
+    void writeCount(size_t count) { write(static_cast<uint64_t>(count)); }
+
+    /// Append a count followed by characters
+    void writeChars(const Char *chars, size_t count)
+    {
+        writeCount(count);
+        writeBytes(chars, count);
+    }
+
+    /// Append a count followed by characters
+    void writeString(const string &s)
+    {
+        writeChars(reinterpret_cast<const Char *>(s.data()), s.size());
+    }
+
+    /// Append raw bytes
+    void writeBytes(const void *data, size_t length)
+    {
+        const auto p = static_cast<const uint8_t *>(data);
+        bytes.insert(bytes.end(), p, p + length);
+    }
+};
+
+#pragma mark - SnapshotReader
+
+/// Reads values written by a SnapshotWriter
+///
+/// Reading past the end of the data, or finding a value that is not valid,
+/// marks the reader as failed.  Once it has failed, every read returns
+/// zero or an empty value, so callers need only check `failed()` once,
+/// after reading everything.
+class SnapshotReader
+{
+private:
+    const uint8_t *next;
+    const uint8_t *end;
+    bool hasFailed{false};
+
+public:
+    SnapshotReader(const void *data, size_t length)
+        : next{static_cast<const uint8_t *>(data)}, end{next + length} {}
+
+    /// Return true if any read has failed
+    bool failed() const { return hasFailed; }
+
+    /// Mark the snapshot as invalid
+    void fail()
+    {
+        hasFailed = true;
+        next = end;
+    }
+
+    /// Return true if all the data has been read
+    bool atEnd() const { return next == end; }
+
+    /// Read a fixed-size value
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only plain values can be read");
+        T value{};
+        readBytes(&value, sizeof(T));
+        return value;
+    }
+
+    /// Read a count of elements, each of which occupies at least
+    /// `minimumElementSize` bytes of the remaining data
+    ///
+    /// The check guards against allocating space for a count that was
+    /// corrupted.
+    size_t readCount(size_t minimumElementSize = 1);
+
+    /// Read a count followed by characters
+    void readChars(vec<Char> &chars);
+
+    /// Read a count followed by characters
+    string readString();
+
+    /// Read raw bytes
+    void readBytes(void *data, size_t length)
+    {
+        if (static_cast<size_t>(end - next) < length)
+        {
+            fail();
+            return;
+        }
+        if (length == 0)
+        {
+            return;
+        }
+        std::memcpy(data, next, length);
+        next += length;
+    }
+};
+
+}  // namespace finchlib_cpp
+
+#endif /* defined(__finchbasic__snapshot__) */
@@ -0,0 +1,707 @@
+/*
+ Copyright (c) 2015 Kristopher Johnson
+
+ Permission is hereby granted, free of charge, to any person obtaining
+ a copy of this software and associated documentation files (the
+ "Software"), to deal in the Software without restriction, including
+ without limitation the rights to use, copy, modify, merge, publish,
+ distribute, sublicense, and/or sell copies of the Software, and to
+ permit persons to whom the Software is furnished to do so, subject to
+ the following conditions:
+
+ The above copyright notice and this permission notice shall be
+ included in all copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "snapshot.h"
+#include "syntax.h"
+
+#include <cassert>
+
+using namespace finchlib_cpp;
+
+// This file defines the snapshot format of the syntax tree.  Each node is
+// written as a tag identifying its subtype, followed by its operands.
+//
+// The tag values are part of the snapshot format, so new values must be
+// added at the ends of these enumerations.  Any other change requires a
+// new snapshot version number.
+
+enum class FactorTag : uint8_t
+{
+    Num,
+    ParenExpr,
+    Var,
+    ArrayElement,
+    Rnd,
+    Reduction,
+    Find
+};
+
+enum class TermTag : uint8_t
+{
+    Value,
+    Compound
+};
+
+enum class UnsignedExpressionTag : uint8_t
+{
+    Value,
+    Compound
+};
+
+enum class ExpressionTag : uint8_t
+{
+    UnsignedExpr,
+    Plus,
+    Minus
+};
+
+enum class PrintItemTag : uint8_t
+{
+    Expr,
+    StringLiteral
+};
+
+enum class LvalueTag : uint8_t
+{
+    Var,
+    ArrayElement
+};
+
+enum class StatementTag : uint8_t
+{
+    Keyword,
+    Print,
+    List,
+    Let,
+    Input,
+    IfThen,
+    Goto,
+    Gosub,
+    Rem,
+    Dim,
+    Save,
+    Load,
+    Randomize,
+    Fill,
+    Copy
+};
+
+/// Statements that have no operands, written as `StatementTag::Keyword`
+/// followed by the index of the statement in this table
+static Statement (*const keywordStatements[])() = {
+    Statement::printNewline,
+    Statement::run,
+    Statement::end,
+    Statement::returnStatement,
+    Statement::clear,
+    Statement::bye,
+    Statement::help,
+    Statement::files,
+    Statement::clipSave,
+    Statement::clipLoad,
+    Statement::tron,
+    Statement::troff,
+    Statement::profile,
+    Statement::unprofile};
+
+static const size_t keywordStatementCount =
+    sizeof(keywordStatements) / sizeof(keywordStatements[0]);
+
+#pragma mark - SnapshotReader
+
+size_t SnapshotReader::readCount(size_t minimumElementSize)
+{
+    const auto count = read<uint64_t>();
+    const auto remaining = static_cast<uint64_t>(end - next);
+    if (count > remaining / minimumElementSize)
+    {
+        fail();
+        return 0;
+    }
+    return static_cast<size_t>(count);
+}
+
+void SnapshotReader::readChars(vec<Char> &chars)
+{
+    chars.resize(readCount());
+    readBytes(chars.data(), chars.size());
+}
+
+string SnapshotReader::readString()
+{
+    vec<Char> chars;
+    readChars(chars);
+    return string(chars.cbegin(), chars.cend());
+}
+
+#pragma mark - Operands
+
+static VariableName readVariableName(SnapshotReader &r)
+{
+    const auto variableName = r.read<VariableName>();
+    if (variableName < 'A' || 'Z' < variableName)
+    {
+        r.fail();
+        return 'A';
+    }
+    return variableName;
+}
+
+static void writeArithOp(SnapshotWriter &w, const ArithOp &op)
+{
+    w.write(op.kind());
+}
+
+static ArithOp readArithOp(SnapshotReader &r)
+{
+    const auto kind = r.read<ArithOp::Kind>();
+    if (kind > ArithOp::Kind::Divide)
+    {
+        r.fail();
+        return ArithOp::Add;
+    }
+    return {kind};
+}
+
+static void writeRelOp(SnapshotWriter &w, const RelOp &op)
+{
+    w.write(op.kind());
+}
+
+static RelOp readRelOp(SnapshotReader &r)
+{
+    const auto kind = r.read<RelOp::Kind>();
+    if (kind > RelOp::Kind::NotEqual)
+    {
+        r.fail();
+        return RelOp::Equal;
+    }
+    return {kind};
+}
+
+#pragma mark - Factor
+
+void Factor::writeSnapshot(SnapshotWriter &w) const { subtype->writeSnapshot(w); }
+
+void Factor::Num::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::Num);
+    w.write(number);
+}
+
+void Factor::ParenExpr::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::ParenExpr);
+    expression->writeSnapshot(w);
+}
+
+void Factor::Var::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::Var);
+    w.write(variableName);
+}
+
+void Factor::ArrayElement::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::ArrayElement);
+    expression->writeSnapshot(w);
+}
+
+void Factor::Rnd::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::Rnd);
+    expression->writeSnapshot(w);
+}
+
+void Factor::Reduction::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::Reduction);
+    w.write(kind);
+    first->writeSnapshot(w);
+    count->writeSnapshot(w);
+}
+
+void Factor::Find::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(FactorTag::Find);
+    value->writeSnapshot(w);
+    first->writeSnapshot(w);
+    count->writeSnapshot(w);
+}
+
+Factor Factor::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<FactorTag>())
+    {
+        case FactorTag::Num:
+            return number(r.read<Number>());
+        case FactorTag::ParenExpr:
+            return parenExpr(Expression::readSnapshot(r));
+        case FactorTag::Var:
+            return var(readVariableName(r));
+        case FactorTag::ArrayElement:
+            return arrayElement(Expression::readSnapshot(r));
+        case FactorTag::Rnd:
+            return rnd(Expression::readSnapshot(r));
+        case FactorTag::Reduction:
+        {
+            const auto kind = r.read<Reduction::Kind>();
+            const auto first = Expression::readSnapshot(r);
+            const auto count = Expression::readSnapshot(r);
+            switch (kind)
+            {
+                case Reduction::Kind::Sum:
+                    return sum(first, count);
+                case Reduction::Kind::Min:
+                    return minimum(first, count);
+                case Reduction::Kind::Max:
+                    return maximum(first, count);
+            }
+            break;
+        }
+        case FactorTag::Find:
+        {
+            const auto value = Expression::readSnapshot(r);
+            const auto first = Expression::readSnapshot(r);
+            const auto count = Expression::readSnapshot(r);
+            return find(value, first, count);
+        }
+    }
+
+    r.fail();
+    return number(0);
+}
+
+#pragma mark - Term
+
+void Term::writeSnapshot(SnapshotWriter &w) const { subtype->writeSnapshot(w); }
+
+void Term::Value::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(TermTag::Value);
+    factor.writeSnapshot(w);
+}
+
+void Term::Compound::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(TermTag::Compound);
+    factor.writeSnapshot(w);
+    writeArithOp(w, arithOp);
+    Term{term}.writeSnapshot(w);
+}
+
+Term Term::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<TermTag>())
+    {
+        case TermTag::Value:
+            return factor(Factor::readSnapshot(r));
+        case TermTag::Compound:
+        {
+            const auto f = Factor::readSnapshot(r);
+            const auto op = readArithOp(r);
+            const auto t = Term::readSnapshot(r);
+            return compound(f, op, t);
+        }
+    }
+
+    r.fail();
+    return factor(Factor::number(0));
+}
+
+#pragma mark - UnsignedExpression
+
+void UnsignedExpression::writeSnapshot(SnapshotWriter &w) const
+{
+    subtype->writeSnapshot(w);
+}
+
+void UnsignedExpression::Value::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(UnsignedExpressionTag::Value);
+    term.writeSnapshot(w);
+}
+
+void UnsignedExpression::Compound::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(UnsignedExpressionTag::Compound);
+    term.writeSnapshot(w);
+    writeArithOp(w, arithOp);
+    UnsignedExpression{tail}.writeSnapshot(w);
+}
+
+UnsignedExpression UnsignedExpression::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<UnsignedExpressionTag>())
+    {
+        case UnsignedExpressionTag::Value:
+            return term(Term::readSnapshot(r));
+        case UnsignedExpressionTag::Compound:
+        {
+            const auto t = Term::readSnapshot(r);
+            const auto op = readArithOp(r);
+            const auto u = UnsignedExpression::readSnapshot(r);
+            return compound(t, op, u);
+        }
+    }
+
+    r.fail();
+    return term(Term::factor(Factor::number(0)));
+}
+
+#pragma mark - Expression
+
+void Expression::writeSnapshot(SnapshotWriter &w) const { subtype->writeSnapshot(w); }
+
+void Expression::UnsignedExpr::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(ExpressionTag::UnsignedExpr);
+    unsignedExpression.writeSnapshot(w);
+}
+
+void Expression::Plus::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(ExpressionTag::Plus);
+    unsignedExpression.writeSnapshot(w);
+}
+
+void Expression::Minus::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(ExpressionTag::Minus);
+    unsignedExpression.writeSnapshot(w);
+}
+
+Expression Expression::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<ExpressionTag>())
+    {
+        case ExpressionTag::UnsignedExpr:
+            return unsignedExpr(UnsignedExpression::readSnapshot(r));
+        case ExpressionTag::Plus:
+            return plus(UnsignedExpression::readSnapshot(r));
+        case ExpressionTag::Minus:
+            return minus(UnsignedExpression::readSnapshot(r));
+    }
+
+    r.fail();
+    return number(0);
+}
+
+#pragma mark - PrintItem
+
+void PrintItem::writeSnapshot(SnapshotWriter &w) const { subtype->writeSnapshot(w); }
+
+void PrintItem::Expr::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(PrintItemTag::Expr);
+    expression.writeSnapshot(w);
+}
+
+void PrintItem::StringLiteral::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(PrintItemTag::StringLiteral);
+    w.writeChars(chars.data(), chars.size());
+}
+
+PrintItem PrintItem::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<PrintItemTag>())
+    {
+        case PrintItemTag::Expr:
+            return expression(Expression::readSnapshot(r));
+        case PrintItemTag::StringLiteral:
+        {
+            vec<Char> chars;
+            r.readChars(chars);
+            return stringLiteral(chars);
+        }
+    }
+
+    r.fail();
+    return expression(Expression::number(0));
+}
+
+#pragma mark - PrintList
+
+void PrintList::writeSnapshot(SnapshotWriter &w) const
+{
+    item.writeSnapshot(w);
+    w.write(static_cast<uint8_t>(separator));
+    w.write(static_cast<uint8_t>(tail != nullptr));
+    if (tail != nullptr)
+    {
+        tail->writeSnapshot(w);
+    }
+}
+
+PrintList PrintList::readSnapshot(SnapshotReader &r)
+{
+    const auto firstItem = PrintItem::readSnapshot(r);
+
+    auto sep = static_cast<PrintSeparator>(r.read<uint8_t>());
+    if (sep != PrintSeparatorNewline && sep != PrintSeparatorTab &&
+        sep != PrintSeparatorEmpty)
+    {
+        r.fail();
+        sep = PrintSeparatorNewline;
+    }
+
+    const PrintList *otherItems = nullptr;
+    if (r.read<uint8_t>() != 0)
+    {
+        otherItems = NodeArena::current().make<PrintList>(PrintList::readSnapshot(r));
+    }
+
+    return {firstItem, sep, otherItems};
+}
+
+#pragma mark - Lvalue
+
+void Lvalue::writeSnapshot(SnapshotWriter &w) const { subtype->writeSnapshot(w); }
+
+void Lvalue::Var::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(LvalueTag::Var);
+    w.write(variableName);
+}
+
+void Lvalue::ArrayElement::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(LvalueTag::ArrayElement);
+    subscript.writeSnapshot(w);
+}
+
+Lvalue Lvalue::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<LvalueTag>())
+    {
+        case LvalueTag::Var:
+            return var(readVariableName(r));
+        case LvalueTag::ArrayElement:
+            return arrayElement(Expression::readSnapshot(r));
+    }
+
+    r.fail();
+    return var('A');
+}
+
+#pragma mark - Statement
+
+void Statement::writeSnapshot(SnapshotWriter &w) const { subtype->writeSnapshot(w); }
+
+void Statement::Subtype::writeSnapshot(SnapshotWriter &w) const
+{
+    for (size_t i = 0; i < keywordStatementCount; ++i)
+    {
+        if (keywordStatements[i]().subtype == this)
+        {
+            w.write(StatementTag::Keyword);
+            w.write(static_cast<uint8_t>(i));
+            return;
+        }
+    }
+
+    assert(false);  // a statement with operands must override this method
+}
+
+void Statement::Print::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Print);
+    printList.writeSnapshot(w);
+}
+
+void Statement::List::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::List);
+    lowLineNumber.writeSnapshot(w);
+    highLineNumber.writeSnapshot(w);
+}
+
+void Statement::Let::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Let);
+    lvalue.writeSnapshot(w);
+    expression.writeSnapshot(w);
+}
+
+void Statement::Input::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Input);
+    w.writeCount(lvalues.size());
+    for (const auto &lv : lvalues)
+    {
+        lv.writeSnapshot(w);
+    }
+}
+
+void Statement::IfThen::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::IfThen);
+    lhs.writeSnapshot(w);
+    writeRelOp(w, op);
+    rhs.writeSnapshot(w);
+    Statement{consequent}.writeSnapshot(w);
+}
+
+void Statement::Goto::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Goto);
+    lineNumber.writeSnapshot(w);
+}
+
+void Statement::Gosub::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Gosub);
+    lineNumber.writeSnapshot(w);
+}
+
+void Statement::Rem::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Rem);
+    w.writeString(text);
+}
+
+void Statement::Dim::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Dim);
+    expression.writeSnapshot(w);
+}
+
+void Statement::Randomize::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Randomize);
+    seed.writeSnapshot(w);
+}
+
+void Statement::Fill::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Fill);
+    first.writeSnapshot(w);
+    count.writeSnapshot(w);
+    value.writeSnapshot(w);
+}
+
+void Statement::Copy::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Copy);
+    source.writeSnapshot(w);
+    destination.writeSnapshot(w);
+    count.writeSnapshot(w);
+}
+
+void Statement::Save::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Save);
+    w.writeString(filename);
+}
+
+void Statement::Load::writeSnapshot(SnapshotWriter &w) const
+{
+    w.write(StatementTag::Load);
+    w.writeString(filename);
+}
+
+Statement Statement::readSnapshot(SnapshotReader &r)
+{
+    switch (r.read<StatementTag>())
+    {
+        case StatementTag::Keyword:
+        {
+            const auto index = r.read<uint8_t>();
+            if (index < keywordStatementCount)
+            {
+                return keywordStatements[index]();
+            }
+            break;
+        }
+
+        case StatementTag::Print:
+            return print(PrintList::readSnapshot(r));
+
+        case StatementTag::List:
+        {
+            const auto low = Expression::readSnapshot(r);
+            const auto high = Expression::readSnapshot(r);
+            return list(low, high);
+        }
+
+        case StatementTag::Let:
+        {
+            const auto lv = Lvalue::readSnapshot(r);
+            const auto expr = Expression::readSnapshot(r);
+            return let(lv, expr);
+        }
+
+        case StatementTag::Input:
+        {
+            // Each lvalue occupies at least two bytes
+            auto lvalues = Lvalues{};
+            const auto count = r.readCount(2);
+            lvalues.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                lvalues.push_back(Lvalue::readSnapshot(r));
+            }
+            return input(lvalues);
+        }
+
+        case StatementTag::IfThen:
+        {
+            const auto lhs = Expression::readSnapshot(r);
+            const auto op = readRelOp(r);
+            const auto rhs = Expression::readSnapshot(r);
+            const auto consequent = Statement::readSnapshot(r);
+            return ifThen(lhs, op, rhs, consequent);
+        }
+
+        case StatementTag::Goto:
+            return gotoStatement(Expression::readSnapshot(r));
+
+        case StatementTag::Gosub:
+            return gosub(Expression::readSnapshot(r));
+
+        case StatementTag::Rem:
+            return rem(r.readString());
+
+        case StatementTag::Dim:
+            return dim(Expression::readSnapshot(r));
+
+        case StatementTag::Save:
+            return save(r.readString());
+
+        case StatementTag::Load:
+            return load(r.readString());
+
+        case StatementTag::Randomize:
+            return randomize(Expression::readSnapshot(r));
+
+        case StatementTag::Fill:
+        {
+            const auto first = Expression::readSnapshot(r);
+            const auto count = Expression::readSnapshot(r);
+            const auto value = Expression::readSnapshot(r);
+            return fill(first, count, value);
+        }
+
+        case StatementTag::Copy:
+        {
+            const auto source = Expression::readSnapshot(r);
+            const auto destination = Expression::readSnapshot(r);
+            const auto count = Expression::readSnapshot(r);
+            return copy(source, destination, count);
+        }
+    }
+
+    r.fail();
+    return end();
+}
@@ -26,34 +26,116 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "Interpreter.h"
 
+#include "arena.h"
+#include "arraystore.h"
+#include "prng.h"
 #include "cppdefs.h"
 
 namespace finchlib_cpp
 {
 class InterpreterEngine;
+class CodeBuilder;
+class SnapshotWriter;
+class SnapshotReader;
 
 using VariableName = Char;
 
-using VariableBindings = map<VariableName, Number>;
+/// Values of the variables "A" through "Z"
+class VariableBindings
+{
+private:
+    Number values[26] = {};
+
+public:
+    /// Return reference to the value of the named variable
+    Number &operator[](VariableName variableName)
+    {
+        assert('A' <= variableName && variableName <= 'Z');
+        return values[variableName - 'A'];
+    }
+
+    /// Return the value of the named variable
+    Number operator[](VariableName variableName) const
+    {
+        assert('A' <= variableName && variableName <= 'Z');
+        return values[variableName - 'A'];
+    }
+
+    /// Return pointer to the value of `A`, which is followed by the values of
+    /// the other variables in alphabetical order
+    Number *data() { return values; }
+
+    /// Set all variables to zero
+    void clear()
+    {
+        for (auto &value : values)
+        {
+            value = 0;
+        }
+    }
+};
+
 using Numbers = vec<Number>;
 using ReturnStack = vec<size_t>;
 
 class Expression;
 
+/// Return a random number in the range `0..<n`, or 0 if `n` is less than 1
+Number randomNumber(RandomGenerator &rng, Number n);
+
+/// Append the decimal representation of a number to a character array
+void appendNumberText(vec<Char> &chars, Number n);
+
 /// Binary operator for Numbers
 class ArithOp
 {
+public:
+    /// Identifies the operation
+    enum class Kind : uint8_t
+    {
+        Add,
+        Subtract,
+        Multiply,
+        Divide
+    };
+
 private:
-    function<Number(Number, Number)> fn;
-    string text;
+    Kind k;
 
 public:
-    ArithOp(function<Number(Number, Number)> f, string listText)
-        : fn{f}, text{listText} {}
-
-    Number apply(Number lhs, Number rhs) const { return fn(lhs, rhs); }
+    constexpr ArithOp(Kind kind) : k{kind} {}
+
+    Kind kind() const { return k; }
+
+    Number apply(Number lhs, Number rhs) const
+    {
+        switch (k)
+        {
+            case Kind::Add:
+                return lhs + rhs;
+            case Kind::Subtract:
+                return lhs - rhs;
+            case Kind::Multiply:
+                return lhs * rhs;
+            case Kind::Divide:
+                // Our division operator returns 0 on an attempt
+                // to divide by zero.
+                //
+                // This is better than letting the interpreter crash
+                // if the user attempts to divide something by zero
+                // in a BASIC program.  A better solution might be
+                // to let the interpreter report an error and abort
+                // execution, returning to command mode, but we
+                // don't have a way for expression evaluation to
+                // signal such a condition.  (In C++, we could do this
+                // with exceptions, but we can't port that over to
+                // the Swift implementation.)
+                return rhs == 0 ? 0 : lhs / rhs;
+        }
+        return 0;  // not reached
+    }
 
-    string listText() const { return text; }
+    string listText() const;
 
     static const ArithOp Add;
     static const ArithOp Subtract;
@@ -64,17 +146,47 @@ public:
 /// Relational operator
 class RelOp
 {
+public:
+    /// Identifies the relation
+    enum class Kind : uint8_t
+    {
+        Less,
+        Greater,
+        Equal,
+        LessOrEqual,
+        GreaterOrEqual,
+        NotEqual
+    };
+
 private:
-    function<bool(Number, Number)> fn;
-    string text;
+    Kind k;
 
 public:
-    RelOp(function<bool(Number, Number)> f, string listText)
-        : fn{f}, text{listText} {}
-
-    bool isTrueForNumbers(Number lhs, Number rhs) const { return fn(lhs, rhs); }
+    constexpr RelOp(Kind kind) : k{kind} {}
+
+    Kind kind() const { return k; }
+
+    bool isTrueForNumbers(Number lhs, Number rhs) const
+    {
+        switch (k)
+        {
+            case Kind::Less:
+                return lhs < rhs;
+            case Kind::Greater:
+                return lhs > rhs;
+            case Kind::Equal:
+                return lhs == rhs;
+            case Kind::LessOrEqual:
+                return lhs <= rhs;
+            case Kind::GreaterOrEqual:
+                return lhs >= rhs;
+            case Kind::NotEqual:
+                return lhs != rhs;
+        }
+        return false;  // not reached
+    }
 
-    string listText() const { return text; }
+    string listText() const;
 
     static const RelOp Less;
     static const RelOp Greater;
@@ -91,8 +203,11 @@ private:
     struct Subtype
     {
         virtual Number evaluate(const VariableBindings &v,
-                                const Numbers &a) const = 0;
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const = 0;
         virtual string listText() const = 0;
+        virtual void writeSnapshot(SnapshotWriter &w) const = 0;
+        virtual void compile(CodeBuilder &code) const = 0;
     };
 
     /// number
@@ -102,19 +217,27 @@ private:
 
         Num(Number n) : number(n) {}
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// "(" expression ")"
     struct ParenExpr : public Subtype
     {
-        sptr<Expression> expression;
+        const Expression *expression;
 
         ParenExpr(const Expression &e);
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// variable
@@ -124,72 +247,163 @@ private:
 
         Var(VariableName v) : variableName{v} {}
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// "@(" expression ")"
     struct ArrayElement : public Subtype
     {
-        sptr<Expression> expression;
+        const Expression *expression;
 
         ArrayElement(const Expression &e);
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// "RND(" expression ")"
     struct Rnd : public Subtype
     {
-        sptr<Expression> expression;
+        const Expression *expression;
 
         Rnd(const Expression &e);
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
-    sptr<Subtype> subtype;
+    /// "SUM(", "MIN(", or "MAX(" expression "," expression ")"
+    struct Reduction : public Subtype
+    {
+        /// Identifies the function
+        enum class Kind : uint8_t
+        {
+            Sum,
+            Min,
+            Max
+        };
+
+        Kind kind;
+        const Expression *first;
+        const Expression *count;
 
-    Factor(sptr<Subtype> s) : subtype(s) {}
+        Reduction(Kind k, const Expression &f, const Expression &n);
+
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
+        virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
+    };
+
+    /// "FIND(" expression "," expression "," expression ")"
+    struct Find : public Subtype
+    {
+        const Expression *value;
+        const Expression *first;
+        const Expression *count;
+
+        Find(const Expression &x, const Expression &f, const Expression &n);
+
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
+        virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
+    };
+
+    const Subtype *subtype;
+
+    Factor(const Subtype *s) : subtype(s) {}
 
 public:
     /// Construct a Factor from a Number
     static Factor number(Number n)
     {
-        return {make_shared<Num>(n)};
+        return {NodeArena::current().make<Num>(n)};
     }
 
     /// Construct a Factor from a parenthesized expression
     static Factor parenExpr(const Expression &expr)
     {
-        return {make_shared<ParenExpr>(expr)};
+        return {NodeArena::current().make<ParenExpr>(expr)};
     }
 
     /// Construct a Factor from a variable name
     static Factor var(VariableName v)
     {
-        return {make_shared<Var>(v)};
+        return {NodeArena::current().make<Var>(v)};
     }
 
     /// Construct a Factor for an array element
     static Factor arrayElement(const Expression &expr)
     {
-        return {make_shared<ArrayElement>(expr)};
+        return {NodeArena::current().make<ArrayElement>(expr)};
     }
 
     /// Construct a Factor for a RND() function call
     static Factor rnd(const Expression &expr)
     {
-        return {make_shared<Rnd>(expr)};
+        return {NodeArena::current().make<Rnd>(expr)};
+    }
+
+    /// Construct a Factor for a SUM() function call
+    static Factor sum(const Expression &first, const Expression &count)
+    {
+        return {NodeArena::current().make<Reduction>(Reduction::Kind::Sum, first, count)};
+    }
+
+    /// Construct a Factor for a MIN() function call
+    static Factor minimum(const Expression &first, const Expression &count)
+    {
+        return {NodeArena::current().make<Reduction>(Reduction::Kind::Min, first, count)};
+    }
+
+    /// Construct a Factor for a MAX() function call
+    static Factor maximum(const Expression &first, const Expression &count)
+    {
+        return {NodeArena::current().make<Reduction>(Reduction::Kind::Max, first, count)};
+    }
+
+    /// Construct a Factor for a FIND() function call
+    static Factor find(const Expression &value, const Expression &first,
+                       const Expression &count)
+    {
+        return {NodeArena::current().make<Find>(value, first, count)};
     }
 
     /// Return the value of the factor
-    Number evaluate(const VariableBindings &v, const Numbers &a) const;
+    Number evaluate(const VariableBindings &v,
+                    const ArrayStore &a,
+                    RandomGenerator &rng) const;
 
     /// Return pretty-printed text
     string listText() const;
+
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static Factor readSnapshot(SnapshotReader &r);
+
+    /// Emit code that pushes the value of the factor
+    void compile(CodeBuilder &code) const;
 };
 
 /// Result of parsing a term
@@ -199,8 +413,11 @@ private:
     struct Subtype
     {
         virtual Number evaluate(const VariableBindings &v,
-                                const Numbers &a) const = 0;
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const = 0;
         virtual string listText() const = 0;
+        virtual void writeSnapshot(SnapshotWriter &w) const = 0;
+        virtual void compile(CodeBuilder &code) const = 0;
         virtual bool isCompound() const = 0;
     };
 
@@ -213,8 +430,12 @@ private:
 
         virtual bool isCompound() const { return false; }
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// factor "*" term
@@ -223,41 +444,57 @@ private:
     {
         Factor factor;
         ArithOp arithOp;
-        sptr<Term> term;
+        const Subtype *term;
 
         Compound(Factor f, ArithOp op, const Term &t);
 
         virtual bool isCompound() const { return true; }
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
-    sptr<Subtype> subtype;
+    const Subtype *subtype;
 
-    Term(sptr<Subtype> s) : subtype{s} {}
+    Term(const Subtype *s) : subtype{s} {}
 
 public:
     /// Construct a Term from a Factor
     static Term factor(Factor f)
     {
-        return {make_shared<Value>(f)};
+        return {NodeArena::current().make<Value>(f)};
     }
 
     /// Construct a Term from a Factor, ArithOp, and another Term
     static Term compound(Factor f, ArithOp op, const Term &t)
     {
-        return {make_shared<Compound>(f, op, t)};
+        return {NodeArena::current().make<Compound>(f, op, t)};
     }
 
     /// Return the value of the term
-    Number evaluate(const VariableBindings &v, const Numbers &a) const;
+    Number evaluate(const VariableBindings &v,
+                    const ArrayStore &a,
+                    RandomGenerator &rng) const;
 
     /// Return true if this is a Compound
     bool isCompound() const;
 
     /// Return pretty-printed text
     string listText() const;
+
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static Term readSnapshot(SnapshotReader &r);
+
+    /// Emit code that pushes the value of the term
+    void compile(CodeBuilder &code) const;
 };
 
 /// Result of parsing an expression with no leading sign
@@ -267,8 +504,11 @@ private:
     struct Subtype
     {
         virtual Number evaluate(const VariableBindings &v,
-                                const Numbers &a) const = 0;
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const = 0;
         virtual string listText() const = 0;
+        virtual void writeSnapshot(SnapshotWriter &w) const = 0;
+        virtual void compile(CodeBuilder &code) const = 0;
         virtual bool isCompound() const = 0;
     };
 
@@ -281,8 +521,12 @@ private:
 
         virtual bool isCompound() const { return false; }
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// term "+" unsignedexpression
@@ -291,25 +535,38 @@ private:
     {
         Term term;
         ArithOp arithOp;
-        sptr<UnsignedExpression> tail;
+        const Subtype *tail;
 
         Compound(Term t, ArithOp op, const UnsignedExpression &u);
 
         virtual bool isCompound() const { return true; }
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
+
+        /// Apply the operations following the first term to the specified
+        /// value of the first term
+        Number evaluateOperations(Number accumulator, const VariableBindings &v,
+                                  const ArrayStore &a,
+                                  RandomGenerator &rng) const;
+
+        /// Emit code that applies the operations following the first term
+        void compileOperations(CodeBuilder &code) const;
     };
 
-    sptr<Subtype> subtype;
+    const Subtype *subtype;
 
-    UnsignedExpression(sptr<Subtype> s) : subtype(s) {}
+    UnsignedExpression(const Subtype *s) : subtype(s) {}
 
 public:
     /// Construct an UnsignedExpression from a Term
     static UnsignedExpression term(Term t)
     {
-        return {make_shared<Value>(t)};
+        return {NodeArena::current().make<Value>(t)};
     }
 
     /// Construct an UnsignedExpression from a term, an operation, and successive
@@ -317,21 +574,38 @@ public:
     static UnsignedExpression compound(Term t, ArithOp op,
                                        const UnsignedExpression &u)
     {
-        return {make_shared<Compound>(t, op, u)};
+        return {NodeArena::current().make<Compound>(t, op, u)};
     }
 
     /// Return the value of the expression
-    Number evaluate(const VariableBindings &v, const Numbers &a) const;
+    Number evaluate(const VariableBindings &v,
+                    const ArrayStore &a,
+                    RandomGenerator &rng) const;
 
     /// Return the value of the expression, negating the value of the first term
     Number evaluateWithNegatedFirstTerm(const VariableBindings &v,
-                                        const Numbers &a) const;
+                                        const ArrayStore &a,
+                                        RandomGenerator &rng) const;
 
     /// Return true if this is a Compound
     bool isCompound() const;
 
     /// Return pretty-printed text
     string listText() const;
+
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static UnsignedExpression readSnapshot(SnapshotReader &r);
+
+    /// Emit code that pushes the value of the expression
+    void compile(CodeBuilder &code) const;
+
+    /// Emit code that pushes the value of the expression, negating the value
+    /// of the first term
+    void compileWithNegatedFirstTerm(CodeBuilder &code) const;
 };
 
 /// Result of parsing an expression
@@ -345,8 +619,11 @@ private:
         Subtype(UnsignedExpression uexpr) : unsignedExpression{uexpr} {}
 
         virtual Number evaluate(const VariableBindings &v,
-                                const Numbers &a) const = 0;
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const = 0;
         virtual string listText() const = 0;
+        virtual void writeSnapshot(SnapshotWriter &w) const = 0;
+        virtual void compile(CodeBuilder &code) const = 0;
     };
 
     /// expression with no leading sign
@@ -354,8 +631,12 @@ private:
     {
         UnsignedExpr(UnsignedExpression uexpr) : Subtype{uexpr} {}
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// expression with explicit "+" prefix
@@ -363,8 +644,12 @@ private:
     {
         Plus(UnsignedExpression uexpr) : Subtype{uexpr} {}
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
     /// expression with explicit "-" prefix
@@ -372,50 +657,77 @@ private:
     {
         Minus(UnsignedExpression uexpr) : Subtype{uexpr} {}
 
-        virtual Number evaluate(const VariableBindings &v, const Numbers &a) const;
+        virtual Number evaluate(const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual void compile(CodeBuilder &code) const;
     };
 
-    sptr<Subtype> subtype;
+    const Subtype *subtype;
 
-    Expression(sptr<Subtype> s) : subtype{s} {}
+    Expression(const Subtype *s) : subtype{s} {}
 
 public:
     /// Construct an expression from an UnsignedExpression
     static Expression unsignedExpr(UnsignedExpression uexpr)
     {
-        return {make_shared<UnsignedExpr>(uexpr)};
+        return {NodeArena::current().make<UnsignedExpr>(uexpr)};
     }
 
     /// Construct an expression from an UnsignedExpression
     static Expression plus(UnsignedExpression uexpr)
     {
-        return {make_shared<Plus>(uexpr)};
+        return {NodeArena::current().make<Plus>(uexpr)};
     }
 
     /// Construct an expression from an UnsignedExpression
     static Expression minus(UnsignedExpression uexpr)
     {
-        return {make_shared<Minus>(uexpr)};
+        return {NodeArena::current().make<Minus>(uexpr)};
     }
 
     /// Construct an expression from a numeric constant
     static Expression number(Number n);
 
     /// Return the value of the expression
-    Number evaluate(const VariableBindings &v, const Numbers &a) const;
+    Number evaluate(const VariableBindings &v,
+                    const ArrayStore &a,
+                    RandomGenerator &rng) const;
 
     /// Return pretty-printed text
     string listText() const;
+
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static Expression readSnapshot(SnapshotReader &r);
+
+    /// Emit code that pushes the value of the expression
+    void compile(CodeBuilder &code) const;
 };
 
 /// Abstract interface for objects that provide text for PRINT output
 class PrintTextProvider
 {
 public:
+    /// Append characters to be output by PRINT statement for this element
+    virtual void appendPrintText(vec<Char> &output, const VariableBindings &v,
+                                 const ArrayStore &a,
+                                 RandomGenerator &rng) const = 0;
+
     /// Return characters to be output by PRINT statement for this element
-    virtual vec<Char> printText(const VariableBindings &v,
-                                const Numbers &a) const = 0;
+    vec<Char> printText(const VariableBindings &v,
+                        const ArrayStore &a,
+                        RandomGenerator &rng) const
+    {
+        vec<Char> result;
+        appendPrintText(result, v, a, rng);
+        return result;
+    }
 };
 
 /// Result of parsing an item in a printList
@@ -424,11 +736,14 @@ class PrintItem : public PrintTextProvider
 private:
     struct Subtype
     {
-        virtual vec<Char> printText(const VariableBindings &v,
-                                    const Numbers &a) const = 0;
+        virtual void appendPrintText(vec<Char> &output,
+                                     const VariableBindings &v,
+                                     const ArrayStore &a,
+                                     RandomGenerator &rng) const = 0;
 
         /// Return pretty-printed statement text
         virtual string listText() const = 0;
+        virtual void writeSnapshot(SnapshotWriter &w) const = 0;
     };
 
     /// expression
@@ -438,9 +753,12 @@ private:
 
         Expr(Expression e) : expression(e) {}
 
-        virtual vec<Char> printText(const VariableBindings &v,
-                                    const Numbers &a) const;
+        virtual void appendPrintText(vec<Char> &output,
+                                     const VariableBindings &v,
+                                     const ArrayStore &a,
+                                     RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     /// "string"
@@ -450,33 +768,44 @@ private:
 
         StringLiteral(const vec<Char> characters) : chars(characters) {}
 
-        virtual vec<Char> printText(const VariableBindings &v,
-                                    const Numbers &a) const;
+        virtual void appendPrintText(vec<Char> &output,
+                                     const VariableBindings &v,
+                                     const ArrayStore &a,
+                                     RandomGenerator &rng) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
-    sptr<Subtype> subtype;
+    const Subtype *subtype;
 
-    PrintItem(sptr<Subtype> sub) : subtype{sub} {}
+    PrintItem(const Subtype *sub) : subtype{sub} {}
 
 public:
     /// Construct a PrintItem from an expression
     static PrintItem expression(Expression expr)
     {
-        return {make_shared<Expr>(expr)};
+        return {NodeArena::current().make<Expr>(expr)};
     }
 
     /// Construct a PrintItem from a string literal
     static PrintItem stringLiteral(const vec<Char> &value)
     {
-        return {make_shared<StringLiteral>(value)};
+        return {NodeArena::current().make<StringLiteral>(value)};
     }
 
-    virtual vec<Char> printText(const VariableBindings &v,
-                                const Numbers &a) const;
+    virtual void appendPrintText(vec<Char> &output, const VariableBindings &v,
+                                 const ArrayStore &a,
+                                 RandomGenerator &rng) const;
 
     /// Return pretty-printed statement text
     string listText() const;
+
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static PrintItem readSnapshot(SnapshotReader &r);
 };
 
 /// Specification of text to be output between PrintItems
@@ -498,19 +827,27 @@ private:
     PrintSeparator separator;
 
     /// Remaining in list.  Null if no more items.
-    sptr<PrintList> tail;
+    const PrintList *tail;
 
 public:
     PrintList(const PrintItem &firstItem, PrintSeparator sep,
-              sptr<PrintList> otherItems)
+              const PrintList *otherItems)
         : item(firstItem), separator(sep), tail(otherItems) {}
 
-    /// Return characters to be output by PRINT statement for this element
-    vec<Char> printText(const VariableBindings &v,
-                        const Numbers &a) const;
+    /// Append characters to be output by PRINT statement for this element
+    virtual void appendPrintText(vec<Char> &output, const VariableBindings &v,
+                                 const ArrayStore &a,
+                                 RandomGenerator &rng) const;
 
     /// Return pretty-printed statement text
     string listText() const;
+
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static PrintList readSnapshot(SnapshotReader &r);
 };
 
 /// A variable or array element reference
@@ -520,7 +857,9 @@ private:
     struct Subtype
     {
         virtual string listText() const = 0;
+        virtual void writeSnapshot(SnapshotWriter &w) const = 0;
         virtual void setValue(Number n, InterpreterEngine &engine) const = 0;
+        virtual void compileStore(CodeBuilder &code) const = 0;
     };
 
     struct Var : public Subtype
@@ -530,7 +869,9 @@ private:
         Var(VariableName v) : variableName{v} {}
 
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
         virtual void setValue(Number n, InterpreterEngine &engine) const;
+        virtual void compileStore(CodeBuilder &code) const;
     };
 
     struct ArrayElement : public Subtype
@@ -540,34 +881,46 @@ private:
         ArrayElement(const Expression &sub) : subscript{sub} {}
 
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
         virtual void setValue(Number n, InterpreterEngine &engine) const;
+        virtual void compileStore(CodeBuilder &code) const;
     };
 
-    sptr<Subtype> subtype;
+    const Subtype *subtype;
 
-    Lvalue(sptr<Subtype> s) : subtype{s} {}
+    Lvalue(const Subtype *s) : subtype{s} {}
 
 public:
     /// Return an Lvalue for a variable
     static Lvalue var(VariableName v)
     {
-        return {make_shared<Var>(v)};
+        return {NodeArena::current().make<Var>(v)};
     }
 
     /// Return an Lvalue for an array element
     static Lvalue arrayElement(const Expression &expr)
     {
-        return {make_shared<ArrayElement>(expr)};
+        return {NodeArena::current().make<ArrayElement>(expr)};
     }
 
     /// Return pretty-printed text
     string listText() const;
 
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static Lvalue readSnapshot(SnapshotReader &r);
+
     /// Set the value
     void setValue(Number n, InterpreterEngine &engine) const;
 
     /// Evaluate expression and set value
     void setValue(const Expression &expr, InterpreterEngine &engine) const;
+
+    /// Emit code that pops a value and assigns it
+    void compileStore(CodeBuilder &code) const;
 };
 
 using Lvalues = vec<Lvalue>;
@@ -581,6 +934,17 @@ private:
         virtual void execute(InterpreterEngine &engine) const = 0;
 
         virtual string listText() const = 0;
+
+        /// Append binary representation for a state snapshot
+        ///
+        /// The default implementation is used by statements with no operands.
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+
+        /// Emit specialized code for the statement.
+        ///
+        /// Returns false if there is no specialized code, in which
+        /// case the statement will be executed using the syntax tree.
+        virtual bool compile(CodeBuilder &code) const { return false; }
     };
 
     struct Print : public Subtype
@@ -591,6 +955,7 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     struct PrintNewline : public Subtype
@@ -609,6 +974,7 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     struct Let : public Subtype
@@ -621,6 +987,8 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Input : public Subtype
@@ -631,6 +999,7 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     struct IfThen : public Subtype
@@ -638,13 +1007,15 @@ private:
         Expression lhs;
         RelOp op;
         Expression rhs;
-        sptr<Statement> consequent;
+        const Subtype *consequent;
 
         IfThen(const Expression &left, const RelOp &relop, const Expression &right,
                const Statement &thenStatement);
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Run : public Subtype
@@ -657,6 +1028,7 @@ private:
     {
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Goto : public Subtype
@@ -667,6 +1039,8 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Gosub : public Subtype
@@ -677,12 +1051,15 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Return : public Subtype
     {
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Rem : public Subtype
@@ -693,6 +1070,8 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+        virtual bool compile(CodeBuilder &code) const;
     };
 
     struct Clear : public Subtype
@@ -721,6 +1100,46 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+    };
+
+    struct Randomize : public Subtype
+    {
+        Expression seed;
+
+        Randomize(const Expression &expr) : seed{expr} {}
+
+        virtual void execute(InterpreterEngine &engine) const;
+        virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+    };
+
+    struct Fill : public Subtype
+    {
+        Expression first;
+        Expression count;
+        Expression value;
+
+        Fill(const Expression &f, const Expression &n, const Expression &x)
+            : first{f}, count{n}, value{x} {}
+
+        virtual void execute(InterpreterEngine &engine) const;
+        virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
+    };
+
+    struct Copy : public Subtype
+    {
+        Expression source;
+        Expression destination;
+        Expression count;
+
+        Copy(const Expression &src, const Expression &dst, const Expression &n)
+            : source{src}, destination{dst}, count{n} {}
+
+        virtual void execute(InterpreterEngine &engine) const;
+        virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     struct Save : public Subtype
@@ -731,6 +1150,7 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     struct Load : public Subtype
@@ -741,6 +1161,7 @@ private:
 
         virtual void execute(InterpreterEngine &engine) const;
         virtual string listText() const;
+        virtual void writeSnapshot(SnapshotWriter &w) const;
     };
 
     struct Files : public Subtype
@@ -773,9 +1194,21 @@ private:
         virtual string listText() const;
     };
 
-    sptr<Subtype> subtype;
+    struct Profile : public Subtype
+    {
+        virtual void execute(InterpreterEngine &engine) const;
+        virtual string listText() const;
+    };
+
+    struct Unprofile : public Subtype
+    {
+        virtual void execute(InterpreterEngine &engine) const;
+        virtual string listText() const;
+    };
+
+    const Subtype *subtype;
 
-    Statement(sptr<Subtype> sub) : subtype(sub) {}
+    Statement(const Subtype *sub) : subtype(sub) {}
 
     Statement() : subtype(nullptr) {}
 
@@ -786,16 +1219,30 @@ public:
     /// Return pretty-printed statement text
     string listText() const;
 
+    /// Append binary representation for a state snapshot
+    void writeSnapshot(SnapshotWriter &w) const;
+
+    /// Read an element written by writeSnapshot(), allocating nodes in the
+    /// current arena
+    static Statement readSnapshot(SnapshotReader &r);
+
+    /// Emit code for the statement
+    void compile(CodeBuilder &code) const;
+
     /// Return a PRINT statement that has arguments
     static Statement print(const PrintList &printList)
     {
-        return {make_shared<Print>(printList)};
+        return {NodeArena::current().make<Print>(printList)};
     }
 
+    // Note: Statements that have no operands share a single immutable node,
+    // so they do not need to be allocated in an arena.
+
     /// Return a PRINT statement with no arguments
     static Statement printNewline()
     {
-        return {make_shared<PrintNewline>()};
+        static const PrintNewline node{};
+        return {&node};
     }
 
     /// Return a LIST statement
@@ -803,19 +1250,19 @@ public:
                           const Expression &highLineNumber = Expression::number(
                               numeric_limits<Number>::max()))
     {
-        return {make_shared<List>(lowLineNumber, highLineNumber)};
+        return {NodeArena::current().make<List>(lowLineNumber, highLineNumber)};
     }
 
     /// Return a LET statement
     static Statement let(const Lvalue &lv, const Expression &expr)
     {
-        return {make_shared<Let>(lv, expr)};
+        return {NodeArena::current().make<Let>(lv, expr)};
     }
 
     /// Return an INPUT statement
     static Statement input(const Lvalues &lv)
     {
-        return {make_shared<Input>(lv)};
+        return {NodeArena::current().make<Input>(lv)};
     }
 
     /// Return an IF statement
@@ -824,109 +1271,154 @@ public:
                             const Expression &right,
                             const Statement &thenStatement)
     {
-        return {make_shared<IfThen>(left, relop, right, thenStatement)};
+        return {NodeArena::current().make<IfThen>(left, relop, right, thenStatement)};
     }
 
     /// Return a RUN statement
     static Statement run()
     {
-        return {make_shared<Run>()};
+        static const Run node{};
+        return {&node};
     }
 
     /// Return a END statement
     static Statement end()
     {
-        return {make_shared<End>()};
+        static const End node{};
+        return {&node};
     }
 
     /// Return a GOTO statement
     static Statement gotoStatement(const Expression &expr)
     {
-        return {make_shared<Goto>(expr)};
+        return {NodeArena::current().make<Goto>(expr)};
     }
 
     /// Return a GOSUB statement
     static Statement gosub(const Expression &expr)
     {
-        return {make_shared<Gosub>(expr)};
+        return {NodeArena::current().make<Gosub>(expr)};
     }
 
     /// Return a RETURN statement
     static Statement returnStatement()
     {
-        return {make_shared<Return>()};
+        static const Return node{};
+        return {&node};
     }
 
     /// Return a REM statement
     static Statement rem(const string &s)
     {
-        return {make_shared<Rem>(s)};
+        return {NodeArena::current().make<Rem>(s)};
     }
 
     /// Return a CLEAR statement
     static Statement clear()
     {
-        return {make_shared<Clear>()};
+        static const Clear node{};
+        return {&node};
     }
 
     /// Return a BYE statement
     static Statement bye()
     {
-        return {make_shared<Bye>()};
+        static const Bye node{};
+        return {&node};
     }
 
     /// Return a HELP statement
     static Statement help()
     {
-        return {make_shared<Help>()};
+        static const Help node{};
+        return {&node};
     }
 
     /// Return a DIM statement
     static Statement dim(const Expression &expr)
     {
-        return {make_shared<Dim>(expr)};
+        return {NodeArena::current().make<Dim>(expr)};
+    }
+
+    /// Return a RANDOMIZE statement
+    static Statement randomize(const Expression &seed)
+    {
+        return {NodeArena::current().make<Randomize>(seed)};
+    }
+
+    /// Return a FILL statement
+    static Statement fill(const Expression &first, const Expression &count,
+                          const Expression &value)
+    {
+        return {NodeArena::current().make<Fill>(first, count, value)};
+    }
+
+    /// Return a COPY statement
+    static Statement copy(const Expression &source, const Expression &destination,
+                          const Expression &count)
+    {
+        return {NodeArena::current().make<Copy>(source, destination, count)};
     }
 
     /// Return a SAVE stateent
     static Statement save(string filename)
     {
-        return {make_shared<Save>(filename)};
+        return {NodeArena::current().make<Save>(filename)};
     }
 
     /// Return a LOAD stateent
     static Statement load(string filename)
     {
-        return {make_shared<Load>(filename)};
+        return {NodeArena::current().make<Load>(filename)};
     }
 
     /// Return a FILES stateent
     static Statement files()
     {
-        return {make_shared<Files>()};
+        static const Files node{};
+        return {&node};
     }
 
     /// Return a CLIPSAVE stateent
     static Statement clipSave()
     {
-        return {make_shared<ClipSave>()};
+        static const ClipSave node{};
+        return {&node};
     }
 
     /// Return a CLIPLOAD stateent
     static Statement clipLoad()
     {
-        return {make_shared<ClipLoad>()};
+        static const ClipLoad node{};
+        return {&node};
     }
 
     /// Return a TRON stateent
     static Statement tron()
     {
-        return {make_shared<Tron>()};
+        static const Tron node{};
+        return {&node};
     }
 
     /// Return a TROFF stateent
     static Statement troff()
     {
-        return {make_shared<Troff>()};
+        static const Troff node{};
+        return {&node};
+    }
+
+    /// Return a PROFILE statement
+    static Statement profile()
+    {
+        static const Profile node{};
+        return {&node};
+    }
+
+    /// Return an UNPROFILE statement
+    static Statement unprofile()
+    {
+        static const Unprofile node{};
+        return {&node};
     }
 
     /// Return an invalid Statement
@@ -941,17 +1433,48 @@ struct NumberedStatement
     Number lineNumber;
     Statement statement;
 
+    /// Arena holding the nodes of the statement
+    ///
+    /// Lines that are parsed together, such as the lines of a LOAD, share an
+    /// arena, which is released when none of them remains.
+    sptr<NodeArena> arena;
+
+    /// Number of bytes of the arena used by the nodes of the statement
+    size_t nodeBytes;
+
     // No-arg constructor, provided so that NumberedStatement can be
     // used in vec.
-    NumberedStatement() : lineNumber(0), statement(Statement::invalid()) {}
+    NumberedStatement() : lineNumber(0), statement(Statement::invalid()), nodeBytes(0) {}
 
-    NumberedStatement(Number n, Statement s) : lineNumber(n), statement(s) {}
+    /// Construct a line, building its listed text
+    ///
+    /// The text is built here, before the line can be put into a program
+    /// that forks share, so that reading it never writes to the line.
+    NumberedStatement(Number n, Statement s, sptr<NodeArena> a, size_t bytes);
 
+    // Moving a line, as the program vector does when lines are inserted,
+    // removed, or merged, moves its text rather than copying it.
     NumberedStatement(const NumberedStatement &copy) = default;
+    NumberedStatement(NumberedStatement &&other) = default;
 
     NumberedStatement &operator=(const NumberedStatement &copy) = default;
+    NumberedStatement &operator=(NumberedStatement &&other) = default;
+
+    /// Return the line as it is listed, with its number and a newline
+    ///
+    /// The statement of a program line never changes.  Replacing a line in
+    /// the program replaces its NumberedStatement, and so its text.
+    const string &lineText() const { return text; }
+
+private:
+    string text;
 };
 
+// A vec only moves its elements when it grows if they can't throw while
+// being moved
+static_assert(std::is_nothrow_move_constructible<NumberedStatement>::value,
+              "NumberedStatement must be movable without copying its text");
+
 using Program = vec<NumberedStatement>;
 
 }  // namespace finchlib_cpp
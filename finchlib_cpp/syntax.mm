@@ -23,6 +23,10 @@ WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "syntax.h"
 #include "InterpreterEngine.h"
+#include "bytecode.h"
+
+#include <limits>
+#include <type_traits>
 
 using namespace finchlib_cpp;
 
@@ -45,6 +49,11 @@ void Lvalue::setValue(const Expression &expr, InterpreterEngine &engine) const
     subtype->setValue(number, engine);
 }
 
+void Lvalue::compileStore(CodeBuilder &code) const
+{
+    subtype->compileStore(code);
+}
+
 string Lvalue::Var::listText() const
 {
     return string(1, static_cast<char>(variableName));
@@ -55,6 +64,11 @@ void Lvalue::Var::setValue(Number n, InterpreterEngine &engine) const
     engine.setVariableValue(variableName, n);
 }
 
+void Lvalue::Var::compileStore(CodeBuilder &code) const
+{
+    code.emit(Opcode::StoreVariable, variableName);
+}
+
 string Lvalue::ArrayElement::listText() const
 {
     return "@(" + subscript.listText() + ")";
@@ -65,58 +79,63 @@ void Lvalue::ArrayElement::setValue(Number n, InterpreterEngine &engine) const
     engine.setArrayElementValue(subscript, n);
 }
 
+void Lvalue::ArrayElement::compileStore(CodeBuilder &code) const
+{
+    // The value is already on the stack, so the subscript is evaluated
+    // after it, matching the order used by setValue()
+    subscript.compile(code);
+    code.emit(Opcode::StoreArrayElement);
+}
+
 #pragma mark - ArithOp
 
-// Our division operator returns 0 on an attempt
-// to divide by zero.
-//
-// This is better than letting the interpreter crash
-// if the user attempts to divide something by zero
-// in a BASIC program.  A better solution might be
-// to let the interpreter report an error and abort
-// execution, returning to command mode, but we
-// don't have a way for expression evaluation to
-// signal such a condition.  (In C++, we could do this
-// with exceptions, but we can't port that over to
-// the Swift implementation.)
-struct SafeDivides
-{
-    Number operator()(Number lhs, Number rhs)
-    {
-        if (rhs == 0)
-        {
-            return 0;
-        }
-        return lhs / rhs;
-    }
-};
+// The operator constants are constexpr so that they are initialized at
+// compile time, and can be read from any thread without synchronization.
+constexpr ArithOp ArithOp::Add{ArithOp::Kind::Add};
+constexpr ArithOp ArithOp::Subtract{ArithOp::Kind::Subtract};
+constexpr ArithOp ArithOp::Multiply{ArithOp::Kind::Multiply};
+constexpr ArithOp ArithOp::Divide{ArithOp::Kind::Divide};
 
-const ArithOp ArithOp::Add{plus<Number>{}, "+"};
-const ArithOp ArithOp::Subtract{minus<Number>{}, "-"};
-const ArithOp ArithOp::Multiply{multiplies<Number>{}, "*"};
-const ArithOp ArithOp::Divide{SafeDivides{}, "/"};
+string ArithOp::listText() const
+{
+    // Indexed by Kind
+    static const char *const text[] = {"+", "-", "*", "/"};
+    return text[static_cast<size_t>(k)];
+}
 
 #pragma mark - RelOp
 
-const RelOp RelOp::Less{less<Number>{}, "<"};
-const RelOp RelOp::Greater{greater<Number>{}, ">"};
-const RelOp RelOp::Equal{equal_to<Number>{}, "="};
-const RelOp RelOp::LessOrEqual{less_equal<Number>{}, "<="};
-const RelOp RelOp::GreaterOrEqual{greater_equal<Number>{}, ">="};
-const RelOp RelOp::NotEqual{not_equal_to<Number>{}, "<>"};
+constexpr RelOp RelOp::Less{RelOp::Kind::Less};
+constexpr RelOp RelOp::Greater{RelOp::Kind::Greater};
+constexpr RelOp RelOp::Equal{RelOp::Kind::Equal};
+constexpr RelOp RelOp::LessOrEqual{RelOp::Kind::LessOrEqual};
+constexpr RelOp RelOp::GreaterOrEqual{RelOp::Kind::GreaterOrEqual};
+constexpr RelOp RelOp::NotEqual{RelOp::Kind::NotEqual};
+
+string RelOp::listText() const
+{
+    // Indexed by Kind
+    static const char *const text[] = {"<", ">", "=", "<=", ">=", "<>"};
+    return text[static_cast<size_t>(k)];
+}
 
 #pragma mark - Factor
 
 /// Return the value of the factor
-Number Factor::evaluate(const VariableBindings &v, const Numbers &a) const
+Number Factor::evaluate(const VariableBindings &v,
+                        const ArrayStore &a,
+                        RandomGenerator &rng) const
 {
-    return subtype->evaluate(v, a);
+    return subtype->evaluate(v, a, rng);
 }
 
 string Factor::listText() const { return subtype->listText(); }
 
+void Factor::compile(CodeBuilder &code) const { subtype->compile(code); }
+
 Number Factor::Num::evaluate(const VariableBindings &v,
-                             const Numbers &a) const
+                             const ArrayStore &a,
+                             RandomGenerator &rng) const
 {
     return number;
 }
@@ -128,13 +147,19 @@ string Factor::Num::listText() const
     return s.str();
 }
 
+void Factor::Num::compile(CodeBuilder &code) const
+{
+    code.emit(Opcode::PushNumber, number);
+}
+
 Factor::ParenExpr::ParenExpr(const Expression &expr)
-    : expression{make_shared<Expression>(expr)} {}
+    : expression{NodeArena::current().make<Expression>(expr)} {}
 
 Number Factor::ParenExpr::evaluate(const VariableBindings &v,
-                                   const Numbers &a) const
+                                   const ArrayStore &a,
+                                   RandomGenerator &rng) const
 {
-    return expression->evaluate(v, a);
+    return expression->evaluate(v, a, rng);
 }
 
 string Factor::ParenExpr::listText() const
@@ -142,11 +167,16 @@ string Factor::ParenExpr::listText() const
     return "(" + expression->listText() + ")";
 }
 
+void Factor::ParenExpr::compile(CodeBuilder &code) const
+{
+    expression->compile(code);
+}
+
 Number Factor::Var::evaluate(const VariableBindings &v,
-                             const Numbers &a) const
+                             const ArrayStore &a,
+                             RandomGenerator &rng) const
 {
-    const auto it = v.find(variableName);
-    return it == v.end() ? 0 : it->second;
+    return v[variableName];
 }
 
 string Factor::Var::listText() const
@@ -154,22 +184,19 @@ string Factor::Var::listText() const
     return string(1, static_cast<char>(variableName));
 }
 
+void Factor::Var::compile(CodeBuilder &code) const
+{
+    code.emit(Opcode::PushVariable, variableName);
+}
+
 Factor::ArrayElement::ArrayElement(const Expression &e)
-    : expression{make_shared<Expression>(e)} {}
+    : expression{NodeArena::current().make<Expression>(e)} {}
 
 Number Factor::ArrayElement::evaluate(const VariableBindings &v,
-                                      const Numbers &a) const
+                                      const ArrayStore &a,
+                                      RandomGenerator &rng) const
 {
-    const auto index = expression->evaluate(v, a);
-    if (index >= 0)
-    {
-        return a[index % a.size()];
-    }
-    else
-    {
-        const auto fromEnd = -index % a.size();
-        return a[a.size() - fromEnd];
-    }
+    return a.get(expression->evaluate(v, a, rng));
 }
 
 string Factor::ArrayElement::listText() const
@@ -177,32 +204,146 @@ string Factor::ArrayElement::listText() const
     return "@(" + expression->listText() + ")";
 }
 
+void Factor::ArrayElement::compile(CodeBuilder &code) const
+{
+    expression->compile(code);
+    code.emit(Opcode::PushArrayElement);
+}
+
 Factor::Rnd::Rnd(const Expression &e)
-    : expression{make_shared<Expression>(e)} {}
+    : expression{NodeArena::current().make<Expression>(e)} {}
 
 Number Factor::Rnd::evaluate(const VariableBindings &v,
-                             const Numbers &a) const
+                             const ArrayStore &a,
+                             RandomGenerator &rng) const
+{
+    return randomNumber(rng, expression->evaluate(v, a, rng));
+}
+
+string Factor::Rnd::listText() const
+{
+    return "RND(" + expression->listText() + ")";
+}
+
+void Factor::Rnd::compile(CodeBuilder &code) const
+{
+    expression->compile(code);
+    code.emit(Opcode::Rnd);
+}
+
+Factor::Reduction::Reduction(Kind k, const Expression &f, const Expression &n)
+    : kind{k},
+      first{NodeArena::current().make<Expression>(f)},
+      count{NodeArena::current().make<Expression>(n)} {}
+
+Number Factor::Reduction::evaluate(const VariableBindings &v,
+                                   const ArrayStore &a,
+                                   RandomGenerator &rng) const
+{
+    const auto firstValue = first->evaluate(v, a, rng);
+    const auto countValue = count->evaluate(v, a, rng);
+    switch (kind)
+    {
+        case Kind::Sum:
+            return a.sum(firstValue, countValue);
+        case Kind::Min:
+            return a.minimum(firstValue, countValue);
+        case Kind::Max:
+            return a.maximum(firstValue, countValue);
+    }
+    return 0;  // not reached
+}
+
+string Factor::Reduction::listText() const
+{
+    static const char *const names[] = {"SUM(", "MIN(", "MAX("};
+    return names[static_cast<size_t>(kind)] + first->listText() + ", " +
+           count->listText() + ")";
+}
+
+void Factor::Reduction::compile(CodeBuilder &code) const
+{
+    static const Opcode opcodes[] = {Opcode::ArraySum, Opcode::ArrayMin, Opcode::ArrayMax};
+    first->compile(code);
+    count->compile(code);
+    code.emit(opcodes[static_cast<size_t>(kind)]);
+}
+
+Factor::Find::Find(const Expression &x, const Expression &f, const Expression &n)
+    : value{NodeArena::current().make<Expression>(x)},
+      first{NodeArena::current().make<Expression>(f)},
+      count{NodeArena::current().make<Expression>(n)} {}
+
+Number Factor::Find::evaluate(const VariableBindings &v,
+                              const ArrayStore &a,
+                              RandomGenerator &rng) const
+{
+    const auto valueToFind = value->evaluate(v, a, rng);
+    const auto firstValue = first->evaluate(v, a, rng);
+    const auto countValue = count->evaluate(v, a, rng);
+    return a.find(valueToFind, firstValue, countValue);
+}
+
+string Factor::Find::listText() const
+{
+    return "FIND(" + value->listText() + ", " + first->listText() + ", " +
+           count->listText() + ")";
+}
+
+void Factor::Find::compile(CodeBuilder &code) const
+{
+    value->compile(code);
+    first->compile(code);
+    count->compile(code);
+    code.emit(Opcode::ArrayFind);
+}
+
+Number finchlib_cpp::randomNumber(RandomGenerator &rng, Number n)
 {
-    const auto n = expression->evaluate(v, a);
     if (n < 1)
     {
         // TODO: signal a runtime error?
         return 0;
     }
-    return Number{static_cast<Number>(arc4random_uniform(n))};
+    return static_cast<Number>(rng.nextBelow(static_cast<uint64_t>(n)));
 }
 
-string Factor::Rnd::listText() const
+void finchlib_cpp::appendNumberText(vec<Char> &chars, Number n)
 {
-    return "RND(" + expression->listText() + ")";
+    // Digits are generated from the end of the buffer, using the
+    // magnitude as an unsigned value so that the most negative
+    // number is handled correctly.
+    using Magnitude = std::make_unsigned<Number>::type;
+    Char buffer[std::numeric_limits<Number>::digits10 + 2];
+    auto end = buffer + sizeof(buffer);
+    auto p = end;
+
+    auto magnitude = static_cast<Magnitude>(n);
+    if (n < 0)
+    {
+        magnitude = static_cast<Magnitude>(Magnitude(0) - magnitude);
+    }
+    do
+    {
+        *--p = static_cast<Char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (n < 0)
+    {
+        chars.push_back('-');
+    }
+    chars.insert(chars.end(), p, end);
 }
 
 #pragma mark - Term
 
 /// Return the value of the term
-Number Term::evaluate(const VariableBindings &v, const Numbers &a) const
+Number Term::evaluate(const VariableBindings &v,
+                      const ArrayStore &a,
+                      RandomGenerator &rng) const
 {
-    return subtype->evaluate(v, a);
+    return subtype->evaluate(v, a, rng);
 }
 
 /// Return pretty-printed text
@@ -210,21 +351,27 @@ string Term::listText() const { return subtype->listText(); }
 
 bool Term::isCompound() const { return subtype->isCompound(); }
 
+void Term::compile(CodeBuilder &code) const { subtype->compile(code); }
+
 Number Term::Value::evaluate(const VariableBindings &v,
-                             const Numbers &a) const
+                             const ArrayStore &a,
+                             RandomGenerator &rng) const
 {
-    return factor.evaluate(v, a);
+    return factor.evaluate(v, a, rng);
 }
 
 string Term::Value::listText() const { return factor.listText(); }
 
+void Term::Value::compile(CodeBuilder &code) const { factor.compile(code); }
+
 Term::Compound::Compound(Factor f, ArithOp op, const Term &t)
-    : factor{f}, arithOp{op}, term{make_shared<Term>(t)} {}
+    : factor{f}, arithOp{op}, term{t.subtype} {}
 
 Number Term::Compound::evaluate(const VariableBindings &v,
-                                const Numbers &a) const
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const
 {
-    auto accumulator = factor.evaluate(v, a);
+    auto accumulator = factor.evaluate(v, a, rng);
     auto lastOp = arithOp;
     auto next = term;
     for (;;)
@@ -234,15 +381,15 @@ Number Term::Compound::evaluate(const VariableBindings &v,
             // Pull out the components of the compound term, apply
             // the previous operator to the accumulator and new factor,
             // then go on to next term.
-            auto compound = static_cast<const Term::Compound *>(next->subtype.get());
-            accumulator = lastOp.apply(accumulator, compound->factor.evaluate(v, a));
+            auto compound = static_cast<const Term::Compound *>(next);
+            accumulator = lastOp.apply(accumulator, compound->factor.evaluate(v, a, rng));
             lastOp = compound->arithOp;
             next = compound->term;
         }
         else
         {
             // Reached the final non-compound term, so we can return result
-            return lastOp.apply(accumulator, next->evaluate(v, a));
+            return lastOp.apply(accumulator, next->evaluate(v, a, rng));
         }
     }
 }
@@ -252,36 +399,51 @@ string Term::Compound::listText() const
     return factor.listText() + " " + arithOp.listText() + " " + term->listText();
 }
 
+void Term::Compound::compile(CodeBuilder &code) const
+{
+    // Same left-to-right order of operations as evaluate()
+    factor.compile(code);
+    auto lastOp = arithOp;
+    auto next = term;
+    while (next->isCompound())
+    {
+        auto compound = static_cast<const Term::Compound *>(next);
+        compound->factor.compile(code);
+        code.emit(lastOp);
+        lastOp = compound->arithOp;
+        next = compound->term;
+    }
+    next->compile(code);
+    code.emit(lastOp);
+}
+
 #pragma mark - UnsignedExpression
 
 /// Return the value of the expression
 Number UnsignedExpression::evaluate(const VariableBindings &v,
-                                    const Numbers &a) const
+                                    const ArrayStore &a,
+                                    RandomGenerator &rng) const
 {
-    return subtype->evaluate(v, a);
+    return subtype->evaluate(v, a, rng);
 }
 
 Number
 UnsignedExpression::evaluateWithNegatedFirstTerm(const VariableBindings &v,
-                                                 const Numbers &a) const
+                                                 const ArrayStore &a,
+                                                 RandomGenerator &rng) const
 {
     if (isCompound())
     {
-        // Pull out the components of the compound term, create
-        // a new expression with the first term negated, and evaluate
-        // that.
-        auto compound = static_cast<const UnsignedExpression::Compound *>(subtype.get());
-        const auto termValue = compound->term.evaluate(v, a);
-        const auto negatedFactor = Factor::number(-termValue);
-        const auto negatedTerm = Term::factor(negatedFactor);
-        const auto newUExpr = UnsignedExpression::compound(
-            negatedTerm, compound->arithOp, *compound->tail);
-        const auto newExpr = Expression::unsignedExpr(newUExpr);
-        return newExpr.evaluate(v, a);
+        // Pull out the components of the compound term, negate
+        // the value of the first term, and then apply the
+        // remaining operations to it.
+        auto compound = static_cast<const UnsignedExpression::Compound *>(subtype);
+        const auto termValue = compound->term.evaluate(v, a, rng);
+        return compound->evaluateOperations(-termValue, v, a, rng);
     }
     else
     {
-        return -evaluate(v, a);
+        return -evaluate(v, a, rng);
     }
 }
 
@@ -289,10 +451,32 @@ string UnsignedExpression::listText() const { return subtype->listText(); }
 
 bool UnsignedExpression::isCompound() const { return subtype->isCompound(); }
 
+void UnsignedExpression::compile(CodeBuilder &code) const
+{
+    subtype->compile(code);
+}
+
+void UnsignedExpression::compileWithNegatedFirstTerm(CodeBuilder &code) const
+{
+    if (isCompound())
+    {
+        auto compound = static_cast<const UnsignedExpression::Compound *>(subtype);
+        compound->term.compile(code);
+        code.emit(Opcode::Negate);
+        compound->compileOperations(code);
+    }
+    else
+    {
+        compile(code);
+        code.emit(Opcode::Negate);
+    }
+}
+
 Number UnsignedExpression::Value::evaluate(const VariableBindings &v,
-                                           const Numbers &a) const
+                                           const ArrayStore &a,
+                                           RandomGenerator &rng) const
 {
-    return term.evaluate(v, a);
+    return term.evaluate(v, a, rng);
 }
 
 string UnsignedExpression::Value::listText() const
@@ -300,14 +484,27 @@ string UnsignedExpression::Value::listText() const
     return term.listText();
 }
 
+void UnsignedExpression::Value::compile(CodeBuilder &code) const
+{
+    term.compile(code);
+}
+
 UnsignedExpression::Compound::Compound(Term t, ArithOp op,
                                        const UnsignedExpression &u)
-    : term{t}, arithOp{op}, tail{make_shared<UnsignedExpression>(u)} {}
+    : term{t}, arithOp{op}, tail{u.subtype} {}
 
 Number UnsignedExpression::Compound::evaluate(const VariableBindings &v,
-                                              const Numbers &a) const
+                                              const ArrayStore &a,
+                                              RandomGenerator &rng) const
+{
+    return evaluateOperations(term.evaluate(v, a, rng), v, a, rng);
+}
+
+Number UnsignedExpression::Compound::evaluateOperations(Number accumulator,
+                                                        const VariableBindings &v,
+                                                        const ArrayStore &a,
+                                                        RandomGenerator &rng) const
 {
-    auto accumulator = term.evaluate(v, a);
     auto lastOp = arithOp;
     auto next = tail;
     for (;;)
@@ -317,16 +514,15 @@ Number UnsignedExpression::Compound::evaluate(const VariableBindings &v,
             // Pull out the components of the compound term, apply
             // the previous operator to the accumulator and new factor,
             // then go on to next term.
-            auto compound = static_cast<const UnsignedExpression::Compound *>(
-                next->subtype.get());
-            accumulator = lastOp.apply(accumulator, compound->term.evaluate(v, a));
+            auto compound = static_cast<const UnsignedExpression::Compound *>(next);
+            accumulator = lastOp.apply(accumulator, compound->term.evaluate(v, a, rng));
             lastOp = compound->arithOp;
             next = compound->tail;
         }
         else
         {
             // Reached the final non-compound term, so we can return result
-            return lastOp.apply(accumulator, next->evaluate(v, a));
+            return lastOp.apply(accumulator, next->evaluate(v, a, rng));
         }
     }
 }
@@ -336,6 +532,29 @@ string UnsignedExpression::Compound::listText() const
     return term.listText() + " " + arithOp.listText() + " " + tail->listText();
 }
 
+void UnsignedExpression::Compound::compile(CodeBuilder &code) const
+{
+    term.compile(code);
+    compileOperations(code);
+}
+
+void UnsignedExpression::Compound::compileOperations(CodeBuilder &code) const
+{
+    // Same left-to-right order of operations as evaluate()
+    auto lastOp = arithOp;
+    auto next = tail;
+    while (next->isCompound())
+    {
+        auto compound = static_cast<const UnsignedExpression::Compound *>(next);
+        compound->term.compile(code);
+        code.emit(lastOp);
+        lastOp = compound->arithOp;
+        next = compound->tail;
+    }
+    next->compile(code);
+    code.emit(lastOp);
+}
+
 #pragma mark - Expression
 
 /// Construct an expression from a numeric constant
@@ -348,17 +567,22 @@ Expression Expression::number(Number n)
 }
 
 /// Return the value of the expression
-Number Expression::evaluate(const VariableBindings &v, const Numbers &a) const
+Number Expression::evaluate(const VariableBindings &v,
+                            const ArrayStore &a,
+                            RandomGenerator &rng) const
 {
-    return subtype->evaluate(v, a);
+    return subtype->evaluate(v, a, rng);
 }
 
 string Expression::listText() const { return subtype->listText(); }
 
+void Expression::compile(CodeBuilder &code) const { subtype->compile(code); }
+
 Number Expression::UnsignedExpr::evaluate(const VariableBindings &v,
-                                          const Numbers &a) const
+                                          const ArrayStore &a,
+                                          RandomGenerator &rng) const
 {
-    return unsignedExpression.evaluate(v, a);
+    return unsignedExpression.evaluate(v, a, rng);
 }
 
 string Expression::UnsignedExpr::listText() const
@@ -366,10 +590,16 @@ string Expression::UnsignedExpr::listText() const
     return unsignedExpression.listText();
 }
 
+void Expression::UnsignedExpr::compile(CodeBuilder &code) const
+{
+    unsignedExpression.compile(code);
+}
+
 Number Expression::Plus::evaluate(const VariableBindings &v,
-                                  const Numbers &a) const
+                                  const ArrayStore &a,
+                                  RandomGenerator &rng) const
 {
-    return unsignedExpression.evaluate(v, a);
+    return unsignedExpression.evaluate(v, a, rng);
 }
 
 string Expression::Plus::listText() const
@@ -377,10 +607,16 @@ string Expression::Plus::listText() const
     return string("+") + unsignedExpression.listText();
 }
 
+void Expression::Plus::compile(CodeBuilder &code) const
+{
+    unsignedExpression.compile(code);
+}
+
 Number Expression::Minus::evaluate(const VariableBindings &v,
-                                   const Numbers &a) const
+                                   const ArrayStore &a,
+                                   RandomGenerator &rng) const
 {
-    return unsignedExpression.evaluateWithNegatedFirstTerm(v, a);
+    return unsignedExpression.evaluateWithNegatedFirstTerm(v, a, rng);
 }
 
 string Expression::Minus::listText() const
@@ -388,38 +624,38 @@ string Expression::Minus::listText() const
     return string("-") + unsignedExpression.listText();
 }
 
+void Expression::Minus::compile(CodeBuilder &code) const
+{
+    unsignedExpression.compileWithNegatedFirstTerm(code);
+}
+
 #pragma mark - PrintItem
 
-vec<Char> PrintItem::printText(const VariableBindings &v,
-                               const Numbers &a) const
+void PrintItem::appendPrintText(vec<Char> &output, const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const
 {
-    return subtype->printText(v, a);
+    subtype->appendPrintText(output, v, a, rng);
 }
 
 string PrintItem::listText() const { return subtype->listText(); }
 
-vec<Char> PrintItem::Expr::printText(const VariableBindings &v,
-                                     const Numbers &a) const
+void PrintItem::Expr::appendPrintText(vec<Char> &output,
+                                      const VariableBindings &v,
+                                      const ArrayStore &a,
+                                      RandomGenerator &rng) const
 {
-    const auto n = expression.evaluate(v, a);
-
-    auto s = ostringstream{};
-    s << n;
-
-    vec<Char> result;
-    for (const auto c : s.str())
-    {
-        result.push_back(c);
-    }
-    return result;
+    appendNumberText(output, expression.evaluate(v, a, rng));
 }
 
 string PrintItem::Expr::listText() const { return expression.listText(); }
 
-vec<Char> PrintItem::StringLiteral::printText(const VariableBindings &v,
-                                              const Numbers &a) const
+void PrintItem::StringLiteral::appendPrintText(vec<Char> &output,
+                                               const VariableBindings &v,
+                                               const ArrayStore &a,
+                                               RandomGenerator &rng) const
 {
-    return chars;
+    output.insert(output.end(), chars.cbegin(), chars.cend());
 }
 
 string PrintItem::StringLiteral::listText() const
@@ -436,35 +672,31 @@ string PrintItem::StringLiteral::listText() const
 
 #pragma mark - PrintList
 
-vec<Char> PrintList::printText(const VariableBindings &v,
-                               const Numbers &a) const
+void PrintList::appendPrintText(vec<Char> &output, const VariableBindings &v,
+                                const ArrayStore &a,
+                                RandomGenerator &rng) const
 {
-    auto chars = item.printText(v, a);
-
-    switch (separator)
+    for (auto list = this; list != nullptr; list = list->tail)
     {
-        case PrintSeparatorNewline:
-            chars.push_back('\n');
-            break;
-        case PrintSeparatorTab:
-            chars.push_back('\t');
-            break;
-        case PrintSeparatorEmpty:
-            // nothing
-            break;
-        default:
-            // should be no other cases
-            assert(false);
-            break;
-    }
+        list->item.appendPrintText(output, v, a, rng);
 
-    if (tail != nullptr)
-    {
-        const auto tailChars = tail->printText(v, a);
-        chars.insert(chars.end(), tailChars.cbegin(), tailChars.cend());
+        switch (list->separator)
+        {
+            case PrintSeparatorNewline:
+                output.push_back('\n');
+                break;
+            case PrintSeparatorTab:
+                output.push_back('\t');
+                break;
+            case PrintSeparatorEmpty:
+                // nothing
+                break;
+            default:
+                // should be no other cases
+                assert(false);
+                break;
+        }
     }
-
-    return chars;
 }
 
 string PrintList::listText() const
@@ -506,6 +738,14 @@ void Statement::execute(InterpreterEngine &engine) const
 
 string Statement::listText() const { return subtype->listText(); }
 
+void Statement::compile(CodeBuilder &code) const
+{
+    if (!subtype->compile(code))
+    {
+        code.emitExecute(*this);
+    }
+}
+
 void Statement::Print::execute(InterpreterEngine &engine) const
 {
     engine.PRINT(printList);
@@ -540,6 +780,13 @@ string Statement::Let::listText() const
     return "LET " + lvalue.listText() + " = " + expression.listText();
 }
 
+bool Statement::Let::compile(CodeBuilder &code) const
+{
+    expression.compile(code);
+    lvalue.compileStore(code);
+    return true;
+}
+
 void Statement::Input::execute(InterpreterEngine &engine) const
 {
     engine.INPUT(lvalues);
@@ -569,11 +816,11 @@ string Statement::Input::listText() const
 Statement::IfThen::IfThen(const Expression &left, const RelOp &relop,
                           const Expression &right,
                           const Statement &thenStatement)
-    : lhs{left}, op{relop}, rhs{right}, consequent{make_shared<Statement>(thenStatement)} {}
+    : lhs{left}, op{relop}, rhs{right}, consequent{thenStatement.subtype} {}
 
 void Statement::IfThen::execute(InterpreterEngine &engine) const
 {
-    engine.IF(lhs, op, rhs, *consequent);
+    engine.IF(lhs, op, rhs, Statement{consequent});
 }
 
 string Statement::IfThen::listText() const
@@ -581,6 +828,16 @@ string Statement::IfThen::listText() const
     return "IF " + lhs.listText() + " " + op.listText() + " " + rhs.listText() + " THEN " + consequent->listText();
 }
 
+bool Statement::IfThen::compile(CodeBuilder &code) const
+{
+    lhs.compile(code);
+    rhs.compile(code);
+    const auto jump = code.emitJumpUnless(op);
+    Statement{consequent}.compile(code);
+    code.setJumpTargetToHere(jump);
+    return true;
+}
+
 void Statement::Run::execute(InterpreterEngine &engine) const { engine.RUN(); }
 
 string Statement::Run::listText() const { return "RUN"; }
@@ -589,6 +846,12 @@ void Statement::End::execute(InterpreterEngine &engine) const { engine.END(); }
 
 string Statement::End::listText() const { return "END"; }
 
+bool Statement::End::compile(CodeBuilder &code) const
+{
+    code.emit(Opcode::End);
+    return true;
+}
+
 void Statement::Goto::execute(InterpreterEngine &engine) const
 {
     engine.GOTO(lineNumber);
@@ -599,6 +862,12 @@ string Statement::Goto::listText() const
     return "GOTO " + lineNumber.listText();
 }
 
+bool Statement::Goto::compile(CodeBuilder &code) const
+{
+    code.emitTransfer(lineNumber, Opcode::Goto, Opcode::GotoLineNumber);
+    return true;
+}
+
 void Statement::Gosub::execute(InterpreterEngine &engine) const
 {
     engine.GOSUB(lineNumber);
@@ -609,6 +878,12 @@ string Statement::Gosub::listText() const
     return "GOSUB " + lineNumber.listText();
 }
 
+bool Statement::Gosub::compile(CodeBuilder &code) const
+{
+    code.emitTransfer(lineNumber, Opcode::Gosub, Opcode::GosubLineNumber);
+    return true;
+}
+
 void Statement::Return::execute(InterpreterEngine &engine) const
 {
     engine.RETURN();
@@ -616,6 +891,12 @@ void Statement::Return::execute(InterpreterEngine &engine) const
 
 string Statement::Return::listText() const { return "RETURN"; }
 
+bool Statement::Return::compile(CodeBuilder &code) const
+{
+    code.emit(Opcode::Return);
+    return true;
+}
+
 void Statement::Rem::execute(InterpreterEngine &engine) const
 {
     // does nothing
@@ -623,6 +904,12 @@ void Statement::Rem::execute(InterpreterEngine &engine) const
 
 string Statement::Rem::listText() const { return "REM" + text; }
 
+bool Statement::Rem::compile(CodeBuilder &code) const
+{
+    // no code
+    return true;
+}
+
 void Statement::Clear::execute(InterpreterEngine &engine) const
 {
     engine.CLEAR();
@@ -651,6 +938,38 @@ string Statement::Dim::listText() const
     return "DIM @(" + expression.listText() + ")";
 }
 
+void Statement::Randomize::execute(InterpreterEngine &engine) const
+{
+    engine.RANDOMIZE(seed);
+}
+
+string Statement::Randomize::listText() const
+{
+    return "RANDOMIZE " + seed.listText();
+}
+
+void Statement::Fill::execute(InterpreterEngine &engine) const
+{
+    engine.FILL(first, count, value);
+}
+
+string Statement::Fill::listText() const
+{
+    return "FILL " + first.listText() + ", " + count.listText() + ", " +
+           value.listText();
+}
+
+void Statement::Copy::execute(InterpreterEngine &engine) const
+{
+    engine.COPY(source, destination, count);
+}
+
+string Statement::Copy::listText() const
+{
+    return "COPY " + source.listText() + ", " + destination.listText() + ", " +
+           count.listText();
+}
+
 void Statement::Save::execute(InterpreterEngine &engine) const
 {
     engine.SAVE(filename);
@@ -711,3 +1030,25 @@ void Statement::Troff::execute(InterpreterEngine &engine) const
 }
 
 string Statement::Troff::listText() const { return "TROFF"; }
+
+void Statement::Profile::execute(InterpreterEngine &engine) const
+{
+    engine.PROFILE();
+}
+
+string Statement::Profile::listText() const { return "PROFILE"; }
+
+void Statement::Unprofile::execute(InterpreterEngine &engine) const
+{
+    engine.UNPROFILE();
+}
+
+string Statement::Unprofile::listText() const { return "UNPROFILE"; }
+
+#pragma mark - NumberedStatement
+
+NumberedStatement::NumberedStatement(Number n, Statement s, sptr<NodeArena> a, size_t bytes)
+    : lineNumber(n), statement(s), arena(std::move(a)), nodeBytes(bytes),
+      text(std::to_string(n) + " " + s.listText() + "\n")
+{
+}